@@ -0,0 +1,375 @@
+/**
+ * wake2text_microbench: timings of the code this repository owns.
+ *
+ * Covers the per-chunk helpers of the transcriber (src/audio_utils.h) and
+ * every kernel of the bundled cblas.h at the shapes snowboy's networks use
+ * (a few frames against 128-256 unit layers). Each case is calibrated to
+ * run for --min-time-ms per repeat; the median of --repeats is reported.
+ *
+ * One line per case with fixed columns (`-` where a case does no floating
+ * point work), so the output of two builds can be diffed directly:
+ *
+ *   ./build/wake2text_microbench > before.txt
+ *   ./build/wake2text_microbench --filter=sgemm
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "audio_utils.h"
+#include "cblas.h"
+
+namespace
+{
+    struct Options
+    {
+        std::string filter;
+        double min_time_ms = 100.0;
+        int repeats = 5;
+        std::string isa; // cblas.h variant; empty runs the one dispatch picks
+    };
+
+    // Keeps the compiler from discarding a result or hoisting work out of
+    // the timing loop
+    template <typename T>
+    inline void keep(const T &value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile const void *sink;
+        sink = &value;
+#endif
+    }
+
+    // Runtime constants the optimizer cannot fold
+    volatile float one = 1.0f;
+    volatile float tiny = 1e-6f;
+
+    using Clock = std::chrono::steady_clock;
+
+    template <typename F>
+    double ns_per_op(const Options &options, F &&op)
+    {
+        // Calibrate: double the batch until one batch takes long enough
+        long long batch = 1;
+        while (true)
+        {
+            auto t0 = Clock::now();
+            for (long long i = 0; i < batch; i++)
+                op();
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+            if (ms >= options.min_time_ms / 4 || batch >= (1ll << 40))
+                break;
+            batch *= 2;
+        }
+        batch *= 4;
+
+        std::vector<double> runs;
+        for (int r = 0; r < options.repeats; r++)
+        {
+            auto t0 = Clock::now();
+            for (long long i = 0; i < batch; i++)
+                op();
+            runs.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / batch);
+        }
+        std::sort(runs.begin(), runs.end());
+        return runs[runs.size() / 2];
+    }
+
+    // `flops` per op, 0 when not meaningful
+    template <typename F>
+    void run(const Options &options, const std::string &name, const std::string &shape, double flops, F &&op)
+    {
+        if (!options.filter.empty() && (name + " " + shape).find(options.filter) == std::string::npos)
+            return;
+        double ns = ns_per_op(options, op);
+        if (flops > 0)
+            std::printf("%-22s %-22s %14.1f ns/op %9.2f GFLOP/s\n", name.c_str(), shape.c_str(), ns, flops / ns);
+        else
+            std::printf("%-22s %-22s %14.1f ns/op %9s GFLOP/s\n", name.c_str(), shape.c_str(), ns, "-");
+        std::fflush(stdout);
+    }
+
+    std::vector<float> random_floats(size_t n, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        std::vector<float> out(n);
+        for (float &v : out)
+            v = dist(rng);
+        return out;
+    }
+
+    // Roughly speech-like: a few harmonics under a syllable-rate envelope
+    std::vector<short> speech_like(size_t n, std::mt19937 &rng)
+    {
+        std::normal_distribution<float> noise(0.0f, 200.0f);
+        std::vector<short> out(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            double t = i / 16000.0;
+            double envelope = 0.5 + 0.5 * std::sin(2 * 3.14159265 * 4 * t);
+            double v = envelope * (3000 * std::sin(2 * 3.14159265 * 150 * t) + 1500 * std::sin(2 * 3.14159265 * 450 * t));
+            out[i] = static_cast<short>(std::clamp(v + noise(rng), -32768.0, 32767.0));
+        }
+        return out;
+    }
+
+    std::string dims(const char *a, int x, const char *b = nullptr, int y = 0, const char *c = nullptr, int z = 0)
+    {
+        std::string out = std::string(a) + "=" + std::to_string(x);
+        if (b)
+            out += std::string(" ") + b + "=" + std::to_string(y);
+        if (c)
+            out += std::string(" ") + c + "=" + std::to_string(z);
+        return out;
+    }
+
+    void bench_audio(const Options &options, std::mt19937 &rng)
+    {
+        const int chunk_samples = 3000 * 16; // TRANSCRIPTION_CHUNK_MS
+        std::vector<short> chunk = speech_like(chunk_samples, rng);
+
+        run(options, "convertToFloat", dims("n", chunk_samples), 0, [&]
+            { keep(pcm_to_float(chunk)); });
+
+        run(options, "hasSubstantialSpeech", dims("n", chunk_samples), 0, [&]
+            { keep(chunk_energy(chunk)); });
+
+        // Typical segment text, a few of which the filter drops
+        const std::vector<std::string> segments = {
+            "Turn on the lights in the living room.",
+            "What's the weather going to be like tomorrow morning?",
+            "Set a timer for ten minutes.",
+            "Thank you.",
+            "Remind me to call the dentist at three o'clock on Friday.",
+            "[Music]",
+            "Play the next episode of the podcast I was listening to yesterday.",
+            "Subtitles by the Amara.org community",
+            "Okay.",
+            "Can you add milk, eggs and bread to the shopping list?"};
+        size_t next = 0;
+        run(options, "isHallucination", dims("segments", static_cast<int>(segments.size())), 0, [&]
+            {
+                keep(is_hallucination(segments[next]));
+                next = (next + 1) % segments.size(); });
+
+        // One processAudioChunk step: copy the chunk out of the session
+        // buffer, drop it keeping the overlap, and refill to chunk size
+        std::vector<short> buffer;
+        buffer.reserve(60000 * 16); // MAX_SESSION_MS
+        buffer.assign(chunk.begin(), chunk.end());
+        int chunks_done = 0;
+        run(options, "chunk overlap/erase", dims("n", chunk_samples), 0, [&]
+            {
+                std::vector<short> copy(buffer.begin(), buffer.begin() + chunk_samples);
+                keep(copy.data());
+                chunks_done = chunks_done % 4 + 1;
+                consume_chunk(buffer, chunk_samples, chunk_overlap(chunk_samples, chunks_done, false));
+                buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + (chunk_samples - buffer.size())); });
+    }
+
+    const char *trans_name(CBLAS_TRANSPOSE t) { return t == CblasNoTrans ? "N" : "T"; }
+
+    // The original unblocked cblas_sgemm, kept as the baseline and the
+    // correctness reference for the blocked one
+    void reference_sgemm(CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, int m, int n, int k, float alpha, const float *a, int lda,
+                         const float *b, int ldb, float beta, float *c, int ldc)
+    {
+        for (int i = 0; i < m; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                float sum = 0.0f;
+                for (int p = 0; p < k; p++)
+                {
+                    float a_val = (ta == CblasNoTrans) ? a[i * lda + p] : a[p * lda + i];
+                    float b_val = (tb == CblasNoTrans) ? b[p * ldb + j] : b[j * ldb + p];
+                    sum += a_val * b_val;
+                }
+                c[i * ldc + j] = alpha * sum + beta * c[i * ldc + j];
+            }
+        }
+    }
+
+    // Largest difference from the reference relative to the largest
+    // element, over alpha/beta values that exercise both the scaling and
+    // the beta == 0 path
+    double sgemm_error(int m, int n, int k, CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb, const std::vector<float> &a, int lda,
+                       const std::vector<float> &b, int ldb, const std::vector<float> &c0)
+    {
+        double worst = 0.0;
+        const float params[][2] = {{1.0f, 0.0f}, {0.5f, 1.0f}, {-2.0f, 0.25f}};
+        for (const auto &ab : params)
+        {
+            std::vector<float> expected = c0, actual = c0;
+            reference_sgemm(ta, tb, m, n, k, ab[0], a.data(), lda, b.data(), ldb, ab[1], expected.data(), n);
+            cblas_sgemm(CblasRowMajor, ta, tb, m, n, k, ab[0], a.data(), lda, b.data(), ldb, ab[1], actual.data(), n);
+            double scale = 1e-30;
+            for (float v : expected)
+                scale = std::max(scale, static_cast<double>(std::fabs(v)));
+            for (size_t i = 0; i < expected.size(); i++)
+                worst = std::max(worst, std::fabs(static_cast<double>(expected[i]) - actual[i]) / scale);
+        }
+        return worst;
+    }
+
+    void bench_sgemm(const Options &options, std::mt19937 &rng, int m, int n, int k, CBLAS_TRANSPOSE ta, CBLAS_TRANSPOSE tb)
+    {
+        std::vector<float> a = random_floats(static_cast<size_t>(m) * k, rng);
+        std::vector<float> b = random_floats(static_cast<size_t>(k) * n, rng);
+        std::vector<float> c = random_floats(static_cast<size_t>(m) * n, rng);
+        int lda = ta == CblasNoTrans ? k : m;
+        int ldb = tb == CblasNoTrans ? n : k;
+        std::string name = std::string("sgemm ") + trans_name(ta) + trans_name(tb);
+        std::string shape = dims("M", m, "N", n, "K", k);
+        if (!options.filter.empty() && (name + " " + shape).find(options.filter) == std::string::npos &&
+            (name + " ref " + shape).find(options.filter) == std::string::npos)
+            return;
+
+        double error = sgemm_error(m, n, k, ta, tb, a, lda, b, ldb, c);
+        if (error > 1e-5)
+        {
+            std::fprintf(stderr, "%s %s: differs from the reference by %.3g\n", name.c_str(), shape.c_str(), error);
+            std::exit(1);
+        }
+
+        run(options, name, shape, 2.0 * m * n * k, [&]
+            {
+                cblas_sgemm(CblasRowMajor, ta, tb, m, n, k, one, a.data(), lda, b.data(), ldb, 0.0f, c.data(), n);
+                keep(c.data()); });
+        run(options, name + " ref", shape, 2.0 * m * n * k, [&]
+            {
+                reference_sgemm(ta, tb, m, n, k, one, a.data(), lda, b.data(), ldb, 0.0f, c.data(), n);
+                keep(c.data()); });
+    }
+
+    void bench_blas(const Options &options, std::mt19937 &rng)
+    {
+        // Frames x layer: one frame, a small batch, and square layers
+        const int gemm_shapes[][3] = {{1, 128, 400}, {8, 128, 400}, {16, 256, 256}, {64, 64, 64}, {128, 128, 128},
+                                      {100, 300, 500}};
+        for (const auto &s : gemm_shapes)
+        {
+            for (CBLAS_TRANSPOSE ta : {CblasNoTrans, CblasTrans})
+                for (CBLAS_TRANSPOSE tb : {CblasNoTrans, CblasTrans})
+                    bench_sgemm(options, rng, s[0], s[1], s[2], ta, tb);
+        }
+
+        const int gemv_shapes[][2] = {{128, 400}, {256, 256}};
+        for (const auto &s : gemv_shapes)
+        {
+            int m = s[0], n = s[1];
+            std::vector<float> a = random_floats(static_cast<size_t>(m) * n, rng);
+            std::vector<float> x = random_floats(std::max(m, n), rng);
+            std::vector<float> y = random_floats(std::max(m, n), rng);
+            run(options, "sgemv N", dims("M", m, "N", n), 2.0 * m * n, [&]
+                {
+                    cblas_sgemv(CblasRowMajor, CblasNoTrans, m, n, one, a.data(), n, x.data(), 1, 0.0f, y.data(), 1);
+                    keep(y.data()); });
+            run(options, "sgemv T", dims("M", m, "N", n), 2.0 * m * n, [&]
+                {
+                    cblas_sgemv(CblasRowMajor, CblasTrans, m, n, one, a.data(), n, x.data(), 1, 0.0f, y.data(), 1);
+                    keep(y.data()); });
+        }
+
+        const int ger_shapes[][2] = {{128, 128}, {256, 400}};
+        for (const auto &s : ger_shapes)
+        {
+            int m = s[0], n = s[1];
+            std::vector<float> a = random_floats(static_cast<size_t>(m) * n, rng);
+            std::vector<float> x = random_floats(m, rng);
+            std::vector<float> y = random_floats(n, rng);
+            run(options, "sger", dims("M", m, "N", n), 2.0 * m * n, [&]
+                {
+                    cblas_sger(CblasRowMajor, m, n, tiny, x.data(), 1, y.data(), 1, a.data(), n);
+                    keep(a.data()); });
+        }
+
+        for (int n : {256, 4096})
+        {
+            std::vector<float> x = random_floats(n, rng);
+            std::vector<float> y = random_floats(n, rng);
+            run(options, "sdot", dims("n", n), 2.0 * n, [&]
+                { keep(cblas_sdot(n, x.data(), 1, y.data(), 1)); });
+            run(options, "saxpy", dims("n", n), 2.0 * n, [&]
+                {
+                    cblas_saxpy(n, tiny, x.data(), 1, y.data(), 1);
+                    keep(y.data()); });
+            run(options, "sscal", dims("n", n), 1.0 * n, [&]
+                {
+                    cblas_sscal(n, one, y.data(), 1);
+                    keep(y.data()); });
+        }
+    }
+
+    void print_usage(const char *program)
+    {
+        std::printf("Usage: %s [options]\n", program);
+        std::printf("  --filter=<text>     Only run cases whose name or shape contains <text>\n");
+        std::printf("  --min-time-ms=<n>   Minimum time per repeat (default 100)\n");
+        std::printf("  --repeats=<n>       Repeats per case; the median is reported (default 5)\n");
+        std::printf("  --isa=<name>        cblas.h variant: generic, sse2, avx2 or avx512 (default: best supported)\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        try
+        {
+            if (arg.rfind("--filter=", 0) == 0)
+                options.filter = arg.substr(9);
+            else if (arg.rfind("--min-time-ms=", 0) == 0)
+                options.min_time_ms = std::max(1.0, std::stod(arg.substr(14)));
+            else if (arg.rfind("--repeats=", 0) == 0)
+                options.repeats = std::max(1, std::stoi(arg.substr(10)));
+            else if (arg.rfind("--isa=", 0) == 0)
+                options.isa = arg.substr(6);
+            else
+            {
+                print_usage(argv[0]);
+                return arg == "--help" || arg == "-h" ? 0 : 1;
+            }
+        }
+        catch (...)
+        {
+            std::fprintf(stderr, "Invalid value: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::string supported;
+    for (int i = CblasIsaGeneric; i <= CblasIsaAVX512; i++)
+        if (cblas_isa_supported(static_cast<CBLAS_ISA>(i)))
+            supported += std::string(supported.empty() ? "" : " ") + cblas_isa_name(static_cast<CBLAS_ISA>(i));
+    if (!options.isa.empty())
+    {
+        int isa = CblasIsaGeneric;
+        while (isa <= CblasIsaAVX512 && options.isa != cblas_isa_name(static_cast<CBLAS_ISA>(isa)))
+            isa++;
+        if (isa > CblasIsaAVX512 || !cblas_set_isa(static_cast<CBLAS_ISA>(isa)))
+        {
+            std::fprintf(stderr, "cblas.h variant %s is not available (supported: %s)\n", options.isa.c_str(),
+                         supported.c_str());
+            return 1;
+        }
+    }
+
+    // Fixed seed: every run times the same data
+    std::mt19937 rng(42);
+    std::printf("# cblas.h variant: %s (supported: %s)\n", cblas_isa_name(cblas_get_isa()), supported.c_str());
+    std::printf("# %-20s %-22s %20s %17s\n", "case", "shape", "time", "throughput");
+    bench_audio(options, rng);
+    bench_blas(options, rng);
+    return 0;
+}
@@ -1,7 +1,19 @@
 #pragma once
 
-// Minimal CBLAS implementation for Windows build
-// This is a stub implementation for basic functionality
+// The single-precision CBLAS subset snowboy's networks call (sgemm, sgemv,
+// sger, sdot, saxpy, sscal), so snowman builds without a system BLAS.
+// sgemm is cache-blocked; kernels are dispatched on the CPU, see below.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CBLAS_DISPATCH 1
+#include <immintrin.h>
+#else
+#define CBLAS_DISPATCH 0
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,88 +31,591 @@ typedef enum {
     CblasConjTrans = 113
 } CBLAS_TRANSPOSE;
 
-// Basic CBLAS functions - stub implementations
-static void cblas_sgemm(const CBLAS_ORDER Order,
-                       const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
-                       const int M, const int N, const int K,
-                       const float alpha, const float *A, const int lda,
-                       const float *B, const int ldb,
-                       const float beta, float *C, const int ldc) {
-    // Simple row-major matrix multiplication implementation
-    // This is not optimized but should work for basic functionality
-    if (Order != CblasRowMajor) return; // Only support row major for now
-    
+// Kernel variants, best last. Each kernel is written once below and
+// compiled again for every instruction set with GCC/Clang target
+// attributes (only the AVX2 and AVX-512 sgemm tiles are hand-written), so
+// one binary runs on any x86-64 and still uses AVX2/FMA or AVX-512 where
+// the CPU has them. The variant is chosen from cpuid on first
+// use; WAKE2TEXT_CBLAS_ISA=generic|sse2|avx2|avx512 pins a supported one.
+// Other compilers and architectures get the generic build only.
+//
+// Like every function here the choice is per translation unit, and results
+// may differ between variants in the last bits (FMA, vector partial sums).
+typedef enum {
+    CblasIsaGeneric = 0, // baseline flags of the build
+    CblasIsaSSE2 = 1,
+    CblasIsaAVX2 = 2,    // AVX2 + FMA
+    CblasIsaAVX512 = 3   // AVX-512 F + VL
+} CBLAS_ISA;
+
+#if CBLAS_DISPATCH
+#define CBLAS_INLINE static inline __attribute__((always_inline))
+#define CBLAS_TARGET(isa) __attribute__((target(isa)))
+#else
+#ifdef _MSC_VER
+#define CBLAS_INLINE static __forceinline
+#else
+#define CBLAS_INLINE static inline
+#endif
+#endif
+
+// cblas_sgemm is blocked for the cache (after Goto/BLIS): a KC x NC slice
+// of op(B) and an MC x KC block of op(A) are copied into contiguous
+// panels, and a micro-kernel keeps an MR x NR tile of C in registers
+// while it streams through them. Transposes are resolved while packing,
+// so the kernel only ever sees unit-stride data and the compiler can
+// vectorize it. Each variant has its own MR x NR tile, sized to fill its
+// vector registers.
+#define CBLAS_SGEMM_MC 64
+#define CBLAS_SGEMM_KC 256
+#define CBLAS_SGEMM_NC 1024
+
+// Packing buffer, reused across calls on the same thread
+static inline float *cblas_sgemm_buffer(size_t floats) {
+#ifdef __cplusplus
+    struct Buffer {
+        float *data;
+        size_t size;
+        ~Buffer() { free(data); }
+    };
+    static thread_local Buffer buffer = {0, 0};
+    if (buffer.size < floats) {
+        free(buffer.data);
+        buffer.data = (float *)malloc(floats * sizeof(float));
+        buffer.size = buffer.data ? floats : 0;
+    }
+    return buffer.data;
+#else
+    return (float *)malloc(floats * sizeof(float));
+#endif
+}
+
+static inline void cblas_sgemm_release(float *buffer) {
+#ifdef __cplusplus
+    (void)buffer;
+#else
+    free(buffer);
+#endif
+}
+
+// MR-row panels of op(A)[i0.., p0..], zero-padded to a multiple of MR rows
+CBLAS_INLINE void cblas_sgemm_pack_a(const int mr, const CBLAS_TRANSPOSE TransA, const float *A, const int lda,
+                                     int i0, int mc, int p0, int kc, float *packed) {
+    for (int ir = 0; ir < mc; ir += mr) {
+        int rows = mc - ir < mr ? mc - ir : mr;
+        if (TransA == CblasNoTrans) {
+            for (int r = 0; r < mr; r++) {
+                const float *row = A + (size_t)(i0 + ir + r) * lda + p0;
+                for (int p = 0; p < kc; p++)
+                    packed[p * mr + r] = r < rows ? row[p] : 0.0f;
+            }
+        } else {
+            for (int p = 0; p < kc; p++) {
+                const float *col = A + (size_t)(p0 + p) * lda + i0 + ir;
+                for (int r = 0; r < mr; r++)
+                    packed[p * mr + r] = r < rows ? col[r] : 0.0f;
+            }
+        }
+        packed += (size_t)kc * mr;
+    }
+}
+
+// NR-column panels of op(B)[p0.., j0..], zero-padded to a multiple of NR columns
+CBLAS_INLINE void cblas_sgemm_pack_b(const int nr, const CBLAS_TRANSPOSE TransB, const float *B, const int ldb,
+                                     int p0, int kc, int j0, int nc, float *packed) {
+    for (int jr = 0; jr < nc; jr += nr) {
+        int cols = nc - jr < nr ? nc - jr : nr;
+        if (TransB == CblasNoTrans) {
+            for (int p = 0; p < kc; p++) {
+                const float *row = B + (size_t)(p0 + p) * ldb + j0 + jr;
+                for (int c = 0; c < nr; c++)
+                    packed[p * nr + c] = c < cols ? row[c] : 0.0f;
+            }
+        } else {
+            for (int c = 0; c < nr; c++) {
+                const float *col = B + (size_t)(j0 + jr + c) * ldb + p0;
+                for (int p = 0; p < kc; p++)
+                    packed[p * nr + c] = c < cols ? col[p] : 0.0f;
+            }
+        }
+        packed += (size_t)kc * nr;
+    }
+}
+
+typedef void (*cblas_sgemm_tile_fn)(int kc, const float *a, const float *b, float alpha, float *C, int ldc,
+                                    int rows, int cols);
+
+// C[0..rows, 0..cols] += alpha * (A panel x B panel) for an MR x NR tile,
+// as the body of a tile function. Plain C, left to the auto-vectorizer.
+#define CBLAS_SGEMM_TILE(MR, NR)                                  \
+    do {                                                          \
+        float acc[MR][NR] = {{0.0f}};                             \
+        for (int p = 0; p < kc; p++) {                            \
+            for (int r = 0; r < MR; r++) {                        \
+                float a_val = a[p * MR + r];                      \
+                for (int c = 0; c < NR; c++)                      \
+                    acc[r][c] += a_val * b[p * NR + c];           \
+            }                                                     \
+        }                                                         \
+        for (int r = 0; r < rows; r++)                            \
+            for (int c = 0; c < cols; c++)                        \
+                C[(size_t)r * ldc + c] += alpha * acc[r][c];      \
+    } while (0)
+
+// 4 x 8: eight SSE accumulators
+static inline void cblas_sgemm_tile_generic(int kc, const float *a, const float *b, float alpha, float *C, int ldc,
+                                            int rows, int cols) {
+    CBLAS_SGEMM_TILE(4, 8);
+}
+
+#if CBLAS_DISPATCH
+#ifndef __SSE2__
+CBLAS_TARGET("sse2")
+static inline void cblas_sgemm_tile_sse2(int kc, const float *a, const float *b, float alpha, float *C, int ldc,
+                                         int rows, int cols) {
+    CBLAS_SGEMM_TILE(4, 8);
+}
+#endif
+
+// The wider tiles are written with intrinsics: how well the compiler
+// vectorizes the plain loop at these sizes varies too much between
+// versions. Edge tiles go through a buffer.
+
+// 6 x 16: twelve ymm accumulators, two for B and one broadcast of A
+CBLAS_TARGET("avx2,fma")
+static inline void cblas_sgemm_tile_avx2(int kc, const float *a, const float *b, float alpha, float *C, int ldc,
+                                         int rows, int cols) {
+    __m256 acc[6][2];
+    for (int r = 0; r < 6; r++)
+        acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+    for (int p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_loadu_ps(b + p * 16);
+        __m256 b1 = _mm256_loadu_ps(b + p * 16 + 8);
+        for (int r = 0; r < 6; r++) {
+            __m256 a_val = _mm256_broadcast_ss(a + p * 6 + r);
+            acc[r][0] = _mm256_fmadd_ps(a_val, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(a_val, b1, acc[r][1]);
+        }
+    }
+    __m256 scale = _mm256_set1_ps(alpha);
+    if (rows == 6 && cols == 16) {
+        for (int r = 0; r < 6; r++) {
+            float *c = C + (size_t)r * ldc;
+            _mm256_storeu_ps(c, _mm256_fmadd_ps(scale, acc[r][0], _mm256_loadu_ps(c)));
+            _mm256_storeu_ps(c + 8, _mm256_fmadd_ps(scale, acc[r][1], _mm256_loadu_ps(c + 8)));
+        }
+        return;
+    }
+    float tile[6][16];
+    for (int r = 0; r < 6; r++) {
+        _mm256_storeu_ps(tile[r], acc[r][0]);
+        _mm256_storeu_ps(tile[r] + 8, acc[r][1]);
+    }
+    for (int r = 0; r < rows; r++)
+        for (int c = 0; c < cols; c++)
+            C[(size_t)r * ldc + c] += alpha * tile[r][c];
+}
+
+// 8 x 32: sixteen zmm accumulators, two for B and one broadcast of A
+CBLAS_TARGET("avx512f,avx512vl,avx2,fma")
+static inline void cblas_sgemm_tile_avx512(int kc, const float *a, const float *b, float alpha, float *C, int ldc,
+                                           int rows, int cols) {
+    __m512 acc[8][2];
+    for (int r = 0; r < 8; r++)
+        acc[r][0] = acc[r][1] = _mm512_setzero_ps();
+    for (int p = 0; p < kc; p++) {
+        __m512 b0 = _mm512_loadu_ps(b + p * 32);
+        __m512 b1 = _mm512_loadu_ps(b + p * 32 + 16);
+        for (int r = 0; r < 8; r++) {
+            __m512 a_val = _mm512_set1_ps(a[p * 8 + r]);
+            acc[r][0] = _mm512_fmadd_ps(a_val, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(a_val, b1, acc[r][1]);
+        }
+    }
+    __m512 scale = _mm512_set1_ps(alpha);
+    if (rows == 8 && cols == 32) {
+        for (int r = 0; r < 8; r++) {
+            float *c = C + (size_t)r * ldc;
+            _mm512_storeu_ps(c, _mm512_fmadd_ps(scale, acc[r][0], _mm512_loadu_ps(c)));
+            _mm512_storeu_ps(c + 16, _mm512_fmadd_ps(scale, acc[r][1], _mm512_loadu_ps(c + 16)));
+        }
+        return;
+    }
+    float tile[8][32];
+    for (int r = 0; r < 8; r++) {
+        _mm512_storeu_ps(tile[r], acc[r][0]);
+        _mm512_storeu_ps(tile[r] + 16, acc[r][1]);
+    }
+    for (int r = 0; r < rows; r++)
+        for (int c = 0; c < cols; c++)
+            C[(size_t)r * ldc + c] += alpha * tile[r][c];
+}
+#endif
+
+// x . y over unit-stride vectors, in sixteen partial sums so the
+// reduction can be vectorized
+CBLAS_INLINE float cblas_sdot_unit(const int n, const float *x, const float *y) {
+    float part[16] = {0.0f};
+    float sum = 0.0f;
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        for (int l = 0; l < 16; l++)
+            part[l] += x[i + l] * y[i + l];
+    for (; i < n; i++)
+        sum += x[i] * y[i];
+    for (int l = 0; l < 16; l++)
+        sum += part[l];
+    return sum;
+}
+
+// Fewer rows than a micro-tile (a single frame): packing would cost as much
+// as the multiply, so each row of C is updated directly from A and B
+CBLAS_INLINE void cblas_sgemm_rows(const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
+                                   const int M, const int N, const int K,
+                                   const float alpha, const float *A, const int lda,
+                                   const float *B, const int ldb, float *C, const int ldc,
+                                   float *scratch) {
     for (int i = 0; i < M; i++) {
-        for (int j = 0; j < N; j++) {
-            float sum = 0.0f;
-            for (int k = 0; k < K; k++) {
-                float a_val = (TransA == CblasNoTrans) ? A[i * lda + k] : A[k * lda + i];
-                float b_val = (TransB == CblasNoTrans) ? B[k * ldb + j] : B[j * ldb + k];
-                sum += a_val * b_val;
+        float *c = C + (size_t)i * ldc;
+        // Row i of op(A), gathered when it is a column of A
+        const float *a = A + (size_t)i * lda;
+        if (TransA != CblasNoTrans) {
+            for (int p = 0; p < K; p++)
+                scratch[p] = A[(size_t)p * lda + i];
+            a = scratch;
+        }
+        if (TransB == CblasNoTrans) {
+            for (int p = 0; p < K; p++) {
+                float a_val = alpha * a[p];
+                const float *b = B + (size_t)p * ldb;
+                for (int j = 0; j < N; j++)
+                    c[j] += a_val * b[j];
             }
-            C[i * ldc + j] = alpha * sum + beta * C[i * ldc + j];
+        } else {
+            for (int j = 0; j < N; j++)
+                c[j] += alpha * cblas_sdot_unit(K, a, B + (size_t)j * ldb);
         }
     }
 }
 
-static void cblas_sger(const CBLAS_ORDER order,
-                      const int M, const int N,
-                      const float alpha, const float *X, const int incX,
-                      const float *Y, const int incY, float *A, const int lda) {
-    // Perform the rank-1 update: A := alpha*x*y' + A
-    if (order != CblasRowMajor) return;
-    
+// Row-major C += alpha * op(A) op(B), after beta has been applied
+CBLAS_INLINE void cblas_sgemm_blocked(const int mr, const int nr, cblas_sgemm_tile_fn tile,
+                                      const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
+                                      const int M, const int N, const int K,
+                                      const float alpha, const float *A, const int lda,
+                                      const float *B, const int ldb, float *C, const int ldc) {
+    if (M < mr) {
+        float *scratch = TransA == CblasNoTrans ? 0 : cblas_sgemm_buffer((size_t)K);
+        if (TransA == CblasNoTrans || scratch)
+            cblas_sgemm_rows(TransA, TransB, M, N, K, alpha, A, lda, B, ldb, C, ldc, scratch);
+        if (scratch)
+            cblas_sgemm_release(scratch);
+        return;
+    }
+
+    int mc_max = M < CBLAS_SGEMM_MC ? M : CBLAS_SGEMM_MC;
+    int kc_max = K < CBLAS_SGEMM_KC ? K : CBLAS_SGEMM_KC;
+    int nc_max = N < CBLAS_SGEMM_NC ? N : CBLAS_SGEMM_NC;
+    size_t a_size = (size_t)(mc_max + mr - 1) / mr * mr * kc_max;
+    size_t b_size = (size_t)(nc_max + nr - 1) / nr * nr * kc_max;
+    float *buffer = cblas_sgemm_buffer(a_size + b_size);
+    if (!buffer) return;
+    float *packed_a = buffer;
+    float *packed_b = buffer + a_size;
+
+    for (int j0 = 0; j0 < N; j0 += CBLAS_SGEMM_NC) {
+        int nc = N - j0 < CBLAS_SGEMM_NC ? N - j0 : CBLAS_SGEMM_NC;
+        for (int p0 = 0; p0 < K; p0 += CBLAS_SGEMM_KC) {
+            int kc = K - p0 < CBLAS_SGEMM_KC ? K - p0 : CBLAS_SGEMM_KC;
+            cblas_sgemm_pack_b(nr, TransB, B, ldb, p0, kc, j0, nc, packed_b);
+            for (int i0 = 0; i0 < M; i0 += CBLAS_SGEMM_MC) {
+                int mc = M - i0 < CBLAS_SGEMM_MC ? M - i0 : CBLAS_SGEMM_MC;
+                cblas_sgemm_pack_a(mr, TransA, A, lda, i0, mc, p0, kc, packed_a);
+                for (int jr = 0; jr < nc; jr += nr) {
+                    int cols = nc - jr < nr ? nc - jr : nr;
+                    const float *b = packed_b + (size_t)(jr / nr) * kc * nr;
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        int rows = mc - ir < mr ? mc - ir : mr;
+                        const float *a = packed_a + (size_t)(ir / mr) * kc * mr;
+                        tile(kc, a, b, alpha, C + (size_t)(i0 + ir) * ldc + j0 + jr, ldc, rows, cols);
+                    }
+                }
+            }
+        }
+    }
+    cblas_sgemm_release(buffer);
+}
+
+// A := alpha*x*y' + A, row-major
+CBLAS_INLINE void cblas_sger_impl(const int M, const int N, const float alpha, const float *X, const int incX,
+                                  const float *Y, const int incY, float *A, const int lda) {
     for (int i = 0; i < M; i++) {
-        for (int j = 0; j < N; j++) {
-            A[i * lda + j] += alpha * X[i * incX] * Y[j * incY];
+        float *row = A + (size_t)i * lda;
+        float x_val = alpha * X[(size_t)i * incX];
+        if (incY == 1) {
+            for (int j = 0; j < N; j++)
+                row[j] += x_val * Y[j];
+        } else {
+            for (int j = 0; j < N; j++)
+                row[j] += x_val * Y[(size_t)j * incY];
         }
     }
 }
 
-static void cblas_sscal(const int N, const float alpha, float *X, const int incX) {
-    // Scale vector X by alpha
-    for (int i = 0; i < N; i++) {
-        X[i * incX] *= alpha;
+CBLAS_INLINE void cblas_sscal_impl(const int N, const float alpha, float *X, const int incX) {
+    if (incX == 1) {
+        for (int i = 0; i < N; i++)
+            X[i] *= alpha;
+        return;
     }
+    for (int i = 0; i < N; i++)
+        X[(size_t)i * incX] *= alpha;
 }
 
-static float cblas_sdot(const int N, const float *X, const int incX,
-                       const float *Y, const int incY) {
-    // Compute dot product of two vectors
+CBLAS_INLINE float cblas_sdot_impl(const int N, const float *X, const int incX, const float *Y, const int incY) {
+    if (incX == 1 && incY == 1)
+        return cblas_sdot_unit(N, X, Y);
     float result = 0.0f;
-    for (int i = 0; i < N; i++) {
-        result += X[i * incX] * Y[i * incY];
-    }
+    for (int i = 0; i < N; i++)
+        result += X[(size_t)i * incX] * Y[(size_t)i * incY];
     return result;
 }
 
-static void cblas_sgemv(const CBLAS_ORDER order,
-                       const CBLAS_TRANSPOSE TransA, const int M, const int N,
-                       const float alpha, const float *A, const int lda,
-                       const float *X, const int incX,
-                       const float beta, float *Y, const int incY) {
-    // Matrix-vector multiplication: Y := alpha*A*X + beta*Y
-    if (order != CblasRowMajor) return;
-    
-    int rows = (TransA == CblasNoTrans) ? M : N;
-    int cols = (TransA == CblasNoTrans) ? N : M;
-    
-    for (int i = 0; i < rows; i++) {
-        float sum = 0.0f;
-        for (int j = 0; j < cols; j++) {
-            float a_val = (TransA == CblasNoTrans) ? A[i * lda + j] : A[j * lda + i];
-            sum += a_val * X[j * incX];
+// Y := alpha*op(A)*X + beta*Y, row-major; beta = 0 overwrites Y
+CBLAS_INLINE void cblas_sgemv_impl(const CBLAS_TRANSPOSE TransA, const int M, const int N,
+                                   const float alpha, const float *A, const int lda,
+                                   const float *X, const int incX,
+                                   const float beta, float *Y, const int incY) {
+    if (TransA == CblasNoTrans) {
+        // One dot product per row of A
+        for (int i = 0; i < M; i++) {
+            const float *row = A + (size_t)i * lda;
+            float sum = incX == 1 ? cblas_sdot_unit(N, row, X) : cblas_sdot_impl(N, row, 1, X, incX);
+            float *y = Y + (size_t)i * incY;
+            *y = alpha * sum + (beta == 0.0f ? 0.0f : beta * *y);
+        }
+        return;
+    }
+    // A^T x: scale Y, then add alpha*x_i times each row of A
+    for (int j = 0; j < N; j++) {
+        float *y = Y + (size_t)j * incY;
+        *y = beta == 0.0f ? 0.0f : beta * *y;
+    }
+    for (int i = 0; i < M; i++) {
+        const float *row = A + (size_t)i * lda;
+        float x_val = alpha * X[(size_t)i * incX];
+        if (incY == 1) {
+            for (int j = 0; j < N; j++)
+                Y[j] += x_val * row[j];
+        } else {
+            for (int j = 0; j < N; j++)
+                Y[(size_t)j * incY] += x_val * row[j];
         }
-        Y[i * incY] = alpha * sum + beta * Y[i * incY];
     }
 }
 
-static void cblas_saxpy(const int N, const float alpha, const float *X, const int incX,
-                       float *Y, const int incY) {
-    // Y := alpha*X + Y
-    for (int i = 0; i < N; i++) {
-        Y[i * incY] += alpha * X[i * incX];
+CBLAS_INLINE void cblas_saxpy_impl(const int N, const float alpha, const float *X, const int incX,
+                                   float *Y, const int incY) {
+    if (incX == 1 && incY == 1) {
+        for (int i = 0; i < N; i++)
+            Y[i] += alpha * X[i];
+        return;
+    }
+    for (int i = 0; i < N; i++)
+        Y[(size_t)i * incY] += alpha * X[(size_t)i * incX];
+}
+
+// One variant's entry points, all row-major
+typedef struct {
+    CBLAS_ISA isa;
+    void (*sgemm)(CBLAS_TRANSPOSE, CBLAS_TRANSPOSE, int, int, int, float, const float *, int,
+                  const float *, int, float *, int);
+    void (*sger)(int, int, float, const float *, int, const float *, int, float *, int);
+    void (*sscal)(int, float, float *, int);
+    float (*sdot)(int, const float *, int, const float *, int);
+    void (*sgemv)(CBLAS_TRANSPOSE, int, int, float, const float *, int, const float *, int, float, float *, int);
+    void (*saxpy)(int, float, const float *, int, float *, int);
+} cblas_kernels;
+
+// Compiles every kernel for one variant: `target` is its CBLAS_TARGET (or
+// nothing for the build's baseline), mr x nr the shape of its
+// cblas_sgemm_tile_<name>
+#define CBLAS_DEFINE_KERNELS(name, target, mr, nr)                                                                 \
+    target static void cblas_sgemm_##name(CBLAS_TRANSPOSE TransA, CBLAS_TRANSPOSE TransB, int M, int N, int K,     \
+                                          float alpha, const float *A, int lda, const float *B, int ldb,           \
+                                          float *C, int ldc) {                                                     \
+        cblas_sgemm_blocked(mr, nr, cblas_sgemm_tile_##name, TransA, TransB, M, N, K, alpha, A, lda, B, ldb,       \
+                            C, ldc);                                                                               \
+    }                                                                                                              \
+    target static void cblas_sger_##name(int M, int N, float alpha, const float *X, int incX, const float *Y,      \
+                                         int incY, float *A, int lda) {                                            \
+        cblas_sger_impl(M, N, alpha, X, incX, Y, incY, A, lda);                                                    \
+    }                                                                                                              \
+    target static void cblas_sscal_##name(int N, float alpha, float *X, int incX) {                                \
+        cblas_sscal_impl(N, alpha, X, incX);                                                                       \
+    }                                                                                                              \
+    target static float cblas_sdot_##name(int N, const float *X, int incX, const float *Y, int incY) {             \
+        return cblas_sdot_impl(N, X, incX, Y, incY);                                                               \
+    }                                                                                                              \
+    target static void cblas_sgemv_##name(CBLAS_TRANSPOSE TransA, int M, int N, float alpha, const float *A,       \
+                                          int lda, const float *X, int incX, float beta, float *Y, int incY) {     \
+        cblas_sgemv_impl(TransA, M, N, alpha, A, lda, X, incX, beta, Y, incY);                                     \
+    }                                                                                                              \
+    target static void cblas_saxpy_##name(int N, float alpha, const float *X, int incX, float *Y, int incY) {      \
+        cblas_saxpy_impl(N, alpha, X, incX, Y, incY);                                                              \
+    }
+
+#define CBLAS_KERNEL_TABLE(isa, name)                                                                              \
+    {isa, cblas_sgemm_##name, cblas_sger_##name, cblas_sscal_##name, cblas_sdot_##name, cblas_sgemv_##name,        \
+     cblas_saxpy_##name}
+
+CBLAS_DEFINE_KERNELS(generic, , 4, 8)
+#if CBLAS_DISPATCH
+#ifndef __SSE2__
+CBLAS_DEFINE_KERNELS(sse2, CBLAS_TARGET("sse2"), 4, 8)
+#endif
+CBLAS_DEFINE_KERNELS(avx2, CBLAS_TARGET("avx2,fma"), 6, 16)
+CBLAS_DEFINE_KERNELS(avx512, CBLAS_TARGET("avx512f,avx512vl,avx2,fma"), 8, 32)
+#endif
+
+static const cblas_kernels cblas_kernel_tables[] = {
+    CBLAS_KERNEL_TABLE(CblasIsaGeneric, generic),
+#if CBLAS_DISPATCH
+#ifdef __SSE2__
+    // The baseline build already targets SSE2
+    CBLAS_KERNEL_TABLE(CblasIsaSSE2, generic),
+#else
+    CBLAS_KERNEL_TABLE(CblasIsaSSE2, sse2),
+#endif
+    CBLAS_KERNEL_TABLE(CblasIsaAVX2, avx2),
+    CBLAS_KERNEL_TABLE(CblasIsaAVX512, avx512),
+#endif
+};
+
+static inline const char *cblas_isa_name(CBLAS_ISA isa) {
+    static const char *const names[] = {"generic", "sse2", "avx2", "avx512"};
+    return isa >= CblasIsaGeneric && isa <= CblasIsaAVX512 ? names[isa] : "unknown";
+}
+
+static inline int cblas_isa_supported(CBLAS_ISA isa) {
+#if CBLAS_DISPATCH
+    __builtin_cpu_init();
+    switch (isa) {
+    case CblasIsaGeneric:
+        return 1;
+    case CblasIsaSSE2:
+        return __builtin_cpu_supports("sse2");
+    case CblasIsaAVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case CblasIsaAVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+               __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
     }
+    return 0;
+#else
+    return isa == CblasIsaGeneric;
+#endif
+}
+
+#if CBLAS_DISPATCH
+static const cblas_kernels *cblas_active_kernels = 0;
+#endif
+
+// Selects a variant for this translation unit; 0 if the CPU lacks it
+static inline int cblas_set_isa(CBLAS_ISA isa) {
+    if (!cblas_isa_supported(isa)) return 0;
+#if CBLAS_DISPATCH
+    __atomic_store_n(&cblas_active_kernels, &cblas_kernel_tables[isa], __ATOMIC_RELEASE);
+#endif
+    return 1;
+}
+
+static inline const cblas_kernels *cblas_kernels_active(void) {
+#if CBLAS_DISPATCH
+    const cblas_kernels *kernels = __atomic_load_n(&cblas_active_kernels, __ATOMIC_ACQUIRE);
+    if (kernels) return kernels;
+
+    // First use: the best the CPU supports, unless the environment pins one
+    int best = CblasIsaAVX512;
+    while (best > CblasIsaGeneric && !cblas_isa_supported((CBLAS_ISA)best))
+        best--;
+    const char *pinned = getenv("WAKE2TEXT_CBLAS_ISA");
+    for (int isa = CblasIsaGeneric; pinned && isa <= CblasIsaAVX512; isa++)
+        if (strcmp(pinned, cblas_isa_name((CBLAS_ISA)isa)) == 0 && cblas_isa_supported((CBLAS_ISA)isa))
+            best = isa;
+    // Racing first calls store the same pointer
+    kernels = &cblas_kernel_tables[best];
+    __atomic_store_n(&cblas_active_kernels, kernels, __ATOMIC_RELEASE);
+    return kernels;
+#else
+    return &cblas_kernel_tables[CblasIsaGeneric];
+#endif
+}
+
+// The variant the kernels below run
+static inline CBLAS_ISA cblas_get_isa(void) {
+    return cblas_kernels_active()->isa;
+}
+
+static inline void cblas_sgemm(const CBLAS_ORDER Order,
+                              const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB,
+                              const int M, const int N, const int K,
+                              const float alpha, const float *A, const int lda,
+                              const float *B, const int ldb,
+                              const float beta, float *C, const int ldc) {
+    // C = A B is C^T = B^T A^T, so column-major is row-major with A and B swapped
+    if (Order == CblasColMajor) {
+        cblas_sgemm(CblasRowMajor, TransB, TransA, N, M, K, alpha, B, ldb, A, lda, beta, C, ldc);
+        return;
+    }
+    if (Order != CblasRowMajor || M <= 0 || N <= 0) return;
+
+    // C := beta*C first; beta = 0 overwrites without reading C
+    if (beta != 1.0f) {
+        for (int i = 0; i < M; i++) {
+            float *row = C + (size_t)i * ldc;
+            for (int j = 0; j < N; j++)
+                row[j] = beta == 0.0f ? 0.0f : beta * row[j];
+        }
+    }
+    if (K <= 0 || alpha == 0.0f) return;
+    cblas_kernels_active()->sgemm(TransA, TransB, M, N, K, alpha, A, lda, B, ldb, C, ldc);
+}
+
+static inline void cblas_sger(const CBLAS_ORDER order,
+                             const int M, const int N,
+                             const float alpha, const float *X, const int incX,
+                             const float *Y, const int incY, float *A, const int lda) {
+    // Perform the rank-1 update: A := alpha*x*y' + A
+    if (order != CblasRowMajor) return;
+    cblas_kernels_active()->sger(M, N, alpha, X, incX, Y, incY, A, lda);
+}
+
+static inline void cblas_sscal(const int N, const float alpha, float *X, const int incX) {
+    // Scale vector X by alpha
+    cblas_kernels_active()->sscal(N, alpha, X, incX);
+}
+
+static inline float cblas_sdot(const int N, const float *X, const int incX,
+                              const float *Y, const int incY) {
+    // Compute dot product of two vectors
+    return cblas_kernels_active()->sdot(N, X, incX, Y, incY);
+}
+
+static inline void cblas_sgemv(const CBLAS_ORDER order,
+                              const CBLAS_TRANSPOSE TransA, const int M, const int N,
+                              const float alpha, const float *A, const int lda,
+                              const float *X, const int incX,
+                              const float beta, float *Y, const int incY) {
+    // Matrix-vector multiplication: Y := alpha*A*X + beta*Y
+    if (order != CblasRowMajor) return;
+    cblas_kernels_active()->sgemv(TransA, M, N, alpha, A, lda, X, incX, beta, Y, incY);
+}
+
+static inline void cblas_saxpy(const int N, const float alpha, const float *X, const int incX,
+                              float *Y, const int incY) {
+    // Y := alpha*X + Y
+    cblas_kernels_active()->saxpy(N, alpha, X, incX, Y, incY);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,222 @@
+#pragma once
+
+/**
+ * Admission control and graceful degradation for Whisper decodes.
+ *
+ * Every decode asks for admission and reports its queue wait and decode
+ * time afterwards. A decode that takes longer than its deadline (the audio
+ * it covers, scaled by a factor, but never less than one chunk) means
+ * inference is falling behind real time. After a few consecutive misses
+ * the controller escalates one level; after a run of on-time decodes with
+ * the queue drained it steps back down:
+ *
+ *   0  normal
+ *   1  interim and speculative decodes are refused; sessions keep their
+ *      audio and decode it later (or at the end)
+ *   2  beam search is replaced by greedy sampling
+ *   3  decodes run on the smaller fallback model, if one is loaded
+ *
+ * Steps that would change nothing (greedy without beam search, no
+ * fallback model) are skipped.
+ *
+ * Final decodes are always admitted, whatever the level or queue depth.
+ * Interim decodes are also refused while the global queue is full. Every
+ * refusal and degraded decode is counted.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "output_channel.h"
+
+class AdmissionController
+{
+public:
+    enum Level
+    {
+        NORMAL = 0,
+        DROP_INTERIM = 1,
+        GREEDY = 2,
+        SMALL_MODEL = 3
+    };
+
+    enum class Kind
+    {
+        Interim,
+        Speculative,
+        Final
+    };
+
+    struct Config
+    {
+        int max_pending = 4;          // admitted but unfinished decodes, all streams
+        double deadline_factor = 1.0; // decode deadline = covered audio x factor
+        int min_deadline_ms = 3000;   // one transcription chunk
+        int escalate_after = 2;       // consecutive deadline misses
+        int recover_after = 5;        // consecutive on-time decodes
+        int max_level = SMALL_MODEL;  // NORMAL disables degradation
+        bool beam = false;            // GREEDY is skipped when decoding is greedy already
+        bool fallback = false;        // SMALL_MODEL needs a fallback model
+    };
+
+    struct Counters
+    {
+        long long admitted = 0;
+        long long finals = 0;
+        long long interim_dropped = 0;     // refused because of the level
+        long long speculative_dropped = 0; // refused because of the level
+        long long queue_full = 0;          // interim/speculative refused at max_pending
+        long long deadline_misses = 0;
+        long long greedy_decodes = 0;   // beam search downgraded
+        long long fallback_decodes = 0; // ran on the smaller model
+        long long escalations = 0;
+        long long recoveries = 0;
+        int level = NORMAL;
+        int max_level_reached = NORMAL;
+        int pending = 0;
+    };
+
+    static const char *describe(int level)
+    {
+        switch (level)
+        {
+        case NORMAL:
+            return "normal";
+        case DROP_INTERIM:
+            return "dropping interim decodes";
+        case GREEDY:
+            return "greedy decoding";
+        default:
+            return "fallback model";
+        }
+    }
+
+private:
+    Config config;
+    std::mutex mutex;
+    Counters counters;
+    std::atomic<int> current_level{NORMAL};
+    int consecutive_misses = 0;
+    int consecutive_ok = 0;
+
+    bool applicable(int level) const
+    {
+        return (level != GREEDY || config.beam) && (level != SMALL_MODEL || config.fallback);
+    }
+
+    void step(int direction)
+    {
+        int level = counters.level + direction;
+        while (level > NORMAL && level <= config.max_level && !applicable(level))
+            level += direction;
+        if (level > config.max_level)
+            return;
+        setLevel(level);
+    }
+
+    void setLevel(int level)
+    {
+        level = std::clamp(level, static_cast<int>(NORMAL), config.max_level);
+        if (level == counters.level)
+            return;
+        if (level > counters.level)
+            counters.escalations++;
+        else
+            counters.recoveries++;
+        counters.level = level;
+        counters.max_level_reached = std::max(counters.max_level_reached, level);
+        current_level = level;
+        consecutive_misses = 0;
+        consecutive_ok = 0;
+        OutputChannel::global().line(OutputKind::Status)
+            << "\n[admission] level " << level << ": " << describe(level) << " (" << counters.deadline_misses
+            << " deadline misses so far, " << counters.pending << " decode(s) pending)\n";
+    }
+
+public:
+    explicit AdmissionController(const Config &cfg) : config(cfg) {}
+
+    // Final decodes always return true. Every true must be paired with
+    // complete() or abandon(). A retry of work refused before is not
+    // counted again.
+    bool admit(Kind kind, bool retry = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (kind != Kind::Final)
+        {
+            if (counters.level >= DROP_INTERIM)
+            {
+                if (retry)
+                    return false;
+                if (kind == Kind::Interim)
+                    counters.interim_dropped++;
+                else
+                    counters.speculative_dropped++;
+                return false;
+            }
+            if (counters.pending >= config.max_pending)
+            {
+                if (!retry)
+                    counters.queue_full++;
+                return false;
+            }
+        }
+        else
+        {
+            counters.finals++;
+        }
+        counters.admitted++;
+        counters.pending++;
+        return true;
+    }
+
+    void complete(double wait_ms, double decode_ms, double audio_ms)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.pending--;
+
+        double deadline = std::max(audio_ms, static_cast<double>(config.min_deadline_ms)) * config.deadline_factor;
+        if (wait_ms + decode_ms > deadline)
+        {
+            counters.deadline_misses++;
+            consecutive_ok = 0;
+            if (++consecutive_misses >= config.escalate_after)
+                step(+1);
+        }
+        else
+        {
+            consecutive_misses = 0;
+            if (++consecutive_ok >= config.recover_after && counters.pending <= 1)
+                step(-1);
+        }
+    }
+
+    // A decode that was preempted or aborted: it frees its slot but says
+    // nothing about the deadline, since a cut-short decode looks fast
+    void abandon()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.pending--;
+    }
+
+    int level() const { return current_level.load(); }
+
+    void noteGreedy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.greedy_decodes++;
+    }
+
+    void noteFallback()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.fallback_decodes++;
+    }
+
+    Counters snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+};
@@ -0,0 +1,35 @@
+/**
+ * Global operator new/delete replacements that count allocations for
+ * MemoryStats. Built only with -DWAKE2TEXT_COUNT_ALLOCATIONS=ON: every
+ * allocation in the process (whisper.cpp and snowboy included) then pays
+ * for two relaxed atomic adds.
+ *
+ * Kept out of main.cpp so the replacements are never inlined into callers;
+ * the array, nothrow and sized forms of the standard library forward here.
+ */
+
+#include <cstdlib>
+#include <new>
+#include "memory_stats.h"
+
+void *operator new(std::size_t size)
+{
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    MemoryStats::countAllocation(size);
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (!p)
+        return;
+    MemoryStats::countFree();
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    operator delete(p);
+}
@@ -0,0 +1,594 @@
+#pragma once
+
+/**
+ * Native capture backends and the source factory.
+ *
+ *   pulse        PulseAudio simple API: blocking reads of one period
+ *   pulse-async  PulseAudio asynchronous API: the server pushes fragments
+ *                from its own thread and reads never wait for a full period
+ *   alsa[:dev]   ALSA in mmap mode: the transcriber reads periods straight
+ *                out of the driver's buffer, without a sound server
+ *
+ * Period and buffer sizes come from AudioSourceOptions. Each backend records
+ * the capture latency of every block from the device or server delay
+ * (pa_simple_get_latency, pa_stream_get_latency, snd_pcm_delay).
+ *
+ * On Windows, "pulse" is the WinMM capture of the snowman wrapper.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "audio_source.h"
+#include "session_recorder.h"
+
+#ifdef _WIN32
+#include "pulseaudio.hh"
+#endif
+#ifdef HAVE_PULSEAUDIO
+#include <pulse/error.h>
+#include <pulse/pulseaudio.h>
+#include <pulse/simple.h>
+#endif
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#ifdef _WIN32
+// Default capture device through the snowman WinMM wrapper
+class WinMMSource : public AudioSource
+{
+private:
+    pulseaudio::pa::simple_record_stream stream;
+
+public:
+    explicit WinMMSource(const std::string &client_name) : stream(client_name) {}
+
+    std::string name() const override { return "winmm"; }
+
+    bool read(std::vector<short> &samples) override
+    {
+        stream.read(samples);
+        return true;
+    }
+};
+#endif
+
+#ifdef HAVE_PULSEAUDIO
+inline uint32_t pulse_bytes(int ms) { return ms > 0 ? static_cast<uint32_t>(ms) * 16 * sizeof(short) : static_cast<uint32_t>(-1); }
+
+// Record-stream attributes: explicit byte values win over the period and
+// buffer sizes; -1 leaves a field to the server
+inline pa_buffer_attr pulse_record_attr(const AudioSourceOptions &options, int default_period_ms)
+{
+    pa_buffer_attr attr;
+    attr.maxlength = options.pa_maxlength > 0 ? options.pa_maxlength : pulse_bytes(options.buffer_ms);
+    attr.tlength = static_cast<uint32_t>(-1);
+    attr.prebuf = static_cast<uint32_t>(-1);
+    attr.minreq = static_cast<uint32_t>(-1);
+    attr.fragsize = options.pa_fragsize > 0 ? options.pa_fragsize
+                                            : pulse_bytes(options.period_ms > 0 ? options.period_ms : default_period_ms);
+    attr.fragsize -= attr.fragsize % sizeof(short);
+    return attr;
+}
+
+inline std::string pulse_attr_text(const pa_buffer_attr &attr)
+{
+    auto field = [](uint32_t bytes)
+    {
+        if (bytes == static_cast<uint32_t>(-1))
+            return std::string("server default");
+        return std::to_string(bytes) + " B (" + std::to_string(bytes / 32) + " ms)";
+    };
+    return "fragsize " + field(attr.fragsize) + ", maxlength " + field(attr.maxlength);
+}
+
+// Blocking reads of one period through the simple API. A smaller fragsize
+// lets the server hand over partial buffers sooner; maxlength bounds how
+// much it queues before dropping.
+class PulseSimpleSource : public AudioSource
+{
+private:
+    pa_simple *stream = nullptr;
+    size_t block_samples;
+    pa_buffer_attr attr;
+
+public:
+    static constexpr int DEFAULT_PERIOD_MS = 100;
+
+    PulseSimpleSource(const std::string &client_name, const AudioSourceOptions &options)
+    {
+        attr = pulse_record_attr(options, DEFAULT_PERIOD_MS);
+        // Reads are one fragment long, so a block arrives as soon as the
+        // server has a fragment
+        block_samples = std::max<size_t>(1, attr.fragsize / sizeof(short));
+
+        pa_sample_spec spec;
+        spec.format = PA_SAMPLE_S16LE;
+        spec.rate = 16000;
+        spec.channels = 1;
+
+        int error = 0;
+        stream = pa_simple_new(nullptr, client_name.c_str(), PA_STREAM_RECORD, nullptr, "capture", &spec, nullptr, &attr,
+                               &error);
+        if (!stream)
+            throw std::runtime_error("Cannot open PulseAudio capture: " + std::string(pa_strerror(error)));
+    }
+
+    ~PulseSimpleSource() override
+    {
+        if (stream)
+            pa_simple_free(stream);
+    }
+
+    PulseSimpleSource(const PulseSimpleSource &) = delete;
+    PulseSimpleSource &operator=(const PulseSimpleSource &) = delete;
+
+    std::string name() const override { return "pulse"; }
+
+    std::string settings() const override { return pulse_attr_text(attr); }
+
+    bool read(std::vector<short> &samples) override
+    {
+        samples.resize(block_samples);
+        int error = 0;
+        if (pa_simple_read(stream, samples.data(), samples.size() * sizeof(short), &error) < 0)
+            throw std::runtime_error("PulseAudio read failed: " + std::string(pa_strerror(error)));
+
+        // What is still queued at the server, plus the block just read
+        pa_usec_t queued = pa_simple_get_latency(stream, &error);
+        if (queued != static_cast<pa_usec_t>(-1))
+            noteCaptureAge(queued / 1000.0 + block_samples / 16.0);
+        return true;
+    }
+};
+
+// Callback-driven capture: the server's fragments are appended to a queue
+// on PulseAudio's mainloop thread as they arrive, stamped with the capture
+// time of their first sample; read() takes whatever has accumulated.
+class PulseAsyncSource : public AudioSource
+{
+private:
+    pa_threaded_mainloop *mainloop = nullptr;
+    pa_context *context = nullptr;
+    pa_stream *stream = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<short> pending;
+    std::chrono::steady_clock::time_point pending_since; // capture time of pending[0]
+    size_t max_pending;
+    std::atomic<long long> dropped{0};
+    std::atomic<long long> overflows{0};
+    bool failed = false;
+    pa_buffer_attr attr;
+
+    static void onContextState(pa_context *, void *userdata)
+    {
+        auto *self = static_cast<PulseAsyncSource *>(userdata);
+        pa_threaded_mainloop_signal(self->mainloop, 0);
+    }
+
+    static void onStreamState(pa_stream *s, void *userdata)
+    {
+        auto *self = static_cast<PulseAsyncSource *>(userdata);
+        pa_stream_state_t state = pa_stream_get_state(s);
+        if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED)
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->failed = true;
+            self->cv.notify_all();
+        }
+        pa_threaded_mainloop_signal(self->mainloop, 0);
+    }
+
+    static void onRead(pa_stream *s, size_t, void *userdata)
+    {
+        auto *self = static_cast<PulseAsyncSource *>(userdata);
+        const void *data = nullptr;
+        size_t bytes = 0;
+        while (pa_stream_readable_size(s) > 0 && pa_stream_peek(s, &data, &bytes) == 0 && bytes > 0)
+        {
+            size_t n = bytes / sizeof(short);
+            // A fragment's first sample is the server latency plus its own
+            // length older than now
+            pa_usec_t latency = 0;
+            int negative = 0;
+            double age_ms = n / 16.0;
+            if (pa_stream_get_latency(s, &latency, &negative) == 0 && !negative)
+                age_ms += latency / 1000.0;
+            auto captured = std::chrono::steady_clock::now() -
+                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double, std::milli>(age_ms));
+            {
+                std::lock_guard<std::mutex> lock(self->mutex);
+                if (self->pending.empty())
+                    self->pending_since = captured;
+                if (data)
+                {
+                    const short *samples = static_cast<const short *>(data);
+                    self->pending.insert(self->pending.end(), samples, samples + n);
+                }
+                else
+                {
+                    // A hole in the stream: keep the timeline with silence
+                    self->pending.insert(self->pending.end(), n, 0);
+                }
+                if (self->pending.size() > self->max_pending)
+                {
+                    size_t excess = self->pending.size() - self->max_pending;
+                    self->pending.erase(self->pending.begin(), self->pending.begin() + excess);
+                    self->pending_since += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(excess / 16000.0));
+                    self->dropped += static_cast<long long>(excess);
+                    self->overflows++;
+                }
+            }
+            self->cv.notify_one();
+            pa_stream_drop(s);
+        }
+    }
+
+    void shutdown()
+    {
+        if (mainloop)
+            pa_threaded_mainloop_stop(mainloop);
+        if (stream)
+        {
+            pa_stream_disconnect(stream);
+            pa_stream_unref(stream);
+        }
+        if (context)
+        {
+            pa_context_disconnect(context);
+            pa_context_unref(context);
+        }
+        if (mainloop)
+            pa_threaded_mainloop_free(mainloop);
+    }
+
+public:
+    static constexpr int DEFAULT_PERIOD_MS = 20;
+
+    PulseAsyncSource(const std::string &client_name, const AudioSourceOptions &options)
+        : max_pending(static_cast<size_t>(std::max(options.buffer_ms, 30000)) * 16)
+    {
+        mainloop = pa_threaded_mainloop_new();
+        if (!mainloop)
+            throw std::runtime_error("Cannot create PulseAudio mainloop");
+        context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), client_name.c_str());
+        pa_context_set_state_callback(context, &PulseAsyncSource::onContextState, this);
+
+        pa_threaded_mainloop_lock(mainloop);
+        std::string error;
+        if (pa_context_connect(context, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0 || pa_threaded_mainloop_start(mainloop) < 0)
+        {
+            error = pa_strerror(pa_context_errno(context));
+        }
+        else
+        {
+            while (true)
+            {
+                pa_context_state_t state = pa_context_get_state(context);
+                if (state == PA_CONTEXT_READY)
+                    break;
+                if (!PA_CONTEXT_IS_GOOD(state))
+                {
+                    error = pa_strerror(pa_context_errno(context));
+                    break;
+                }
+                pa_threaded_mainloop_wait(mainloop);
+            }
+        }
+
+        if (error.empty())
+        {
+            pa_sample_spec spec;
+            spec.format = PA_SAMPLE_S16LE;
+            spec.rate = 16000;
+            spec.channels = 1;
+
+            attr = pulse_record_attr(options, DEFAULT_PERIOD_MS);
+            stream = pa_stream_new(context, "capture", &spec, nullptr);
+            pa_stream_set_state_callback(stream, &PulseAsyncSource::onStreamState, this);
+            pa_stream_set_read_callback(stream, &PulseAsyncSource::onRead, this);
+            auto flags = static_cast<pa_stream_flags_t>(PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING |
+                                                        PA_STREAM_AUTO_TIMING_UPDATE);
+            if (pa_stream_connect_record(stream, nullptr, &attr, flags) < 0)
+            {
+                error = pa_strerror(pa_context_errno(context));
+            }
+            else
+            {
+                while (true)
+                {
+                    pa_stream_state_t state = pa_stream_get_state(stream);
+                    if (state == PA_STREAM_READY)
+                        break;
+                    if (!PA_STREAM_IS_GOOD(state))
+                    {
+                        error = pa_strerror(pa_context_errno(context));
+                        break;
+                    }
+                    pa_threaded_mainloop_wait(mainloop);
+                }
+            }
+        }
+        pa_threaded_mainloop_unlock(mainloop);
+
+        if (!error.empty())
+        {
+            shutdown();
+            throw std::runtime_error("Cannot open PulseAudio capture: " + error);
+        }
+    }
+
+    ~PulseAsyncSource() override { shutdown(); }
+
+    PulseAsyncSource(const PulseAsyncSource &) = delete;
+    PulseAsyncSource &operator=(const PulseAsyncSource &) = delete;
+
+    std::string name() const override { return "pulse-async"; }
+
+    std::string settings() const override { return pulse_attr_text(attr); }
+
+    bool read(std::vector<short> &samples) override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]
+                { return failed || !pending.empty(); });
+        if (pending.empty())
+            return false;
+        noteCaptureAge(replay_age_ms(pending_since));
+        samples.swap(pending);
+        pending.clear();
+        return true;
+    }
+
+    long long overruns() const override { return overflows.load(); }
+    long long lostSamples() const override { return dropped.load(); }
+};
+#endif
+
+#ifdef HAVE_ALSA
+// Direct ALSA capture in mmap mode. Blocks are handed out as pointers into
+// the driver's ring and committed back on the next call, so there is no
+// sound server, no read copy, and the buffer only holds what the period
+// and buffer sizes allow. Overruns are recovered and counted.
+class AlsaSource : public AudioSource
+{
+private:
+    snd_pcm_t *pcm = nullptr;
+    std::string device;
+    snd_pcm_uframes_t period = 0;
+    snd_pcm_uframes_t buffer = 0;
+    snd_pcm_uframes_t lent_offset = 0;
+    snd_pcm_uframes_t lent_frames = 0;
+    long long xruns = 0;
+
+    void check(int err, const char *what)
+    {
+        if (err < 0)
+            throw std::runtime_error("ALSA " + device + ": " + what + ": " + snd_strerror(err));
+    }
+
+    void recover(int err)
+    {
+        xruns++;
+        lent_frames = 0;
+        check(snd_pcm_recover(pcm, err, 1), "recover");
+        check(snd_pcm_start(pcm), "restart");
+    }
+
+public:
+    static constexpr int DEFAULT_PERIOD_MS = 10;
+    // Room for the capture thread to finish a committed decode without an
+    // overrun; reads start as soon as a period is ready, so it adds no latency
+    static constexpr int DEFAULT_BUFFER_MS = 2000;
+
+    AlsaSource(const std::string &name, const AudioSourceOptions &options) : device(name.empty() ? "default" : name)
+    {
+        check(snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_CAPTURE, 0), "open");
+
+        snd_pcm_hw_params_t *hw = nullptr;
+        snd_pcm_hw_params_malloc(&hw);
+        try
+        {
+            unsigned int rate = 16000;
+            period = static_cast<snd_pcm_uframes_t>(options.period_ms > 0 ? options.period_ms : DEFAULT_PERIOD_MS) * 16;
+            buffer = static_cast<snd_pcm_uframes_t>(options.buffer_ms > 0 ? options.buffer_ms : DEFAULT_BUFFER_MS) * 16;
+            check(snd_pcm_hw_params_any(pcm, hw), "hw params");
+            check(snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED), "mmap access");
+            check(snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16_LE), "S16_LE format");
+            check(snd_pcm_hw_params_set_channels(pcm, hw, 1), "mono");
+            check(snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, nullptr), "rate");
+            if (rate != 16000)
+                throw std::runtime_error("ALSA " + device + " cannot capture at 16 kHz (use plughw: or pulse)");
+            check(snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, nullptr), "period size");
+            check(snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer), "buffer size");
+            check(snd_pcm_hw_params(pcm, hw), "apply hw params");
+        }
+        catch (...)
+        {
+            snd_pcm_hw_params_free(hw);
+            snd_pcm_close(pcm);
+            throw;
+        }
+        snd_pcm_hw_params_free(hw);
+
+        snd_pcm_sw_params_t *sw = nullptr;
+        snd_pcm_sw_params_malloc(&sw);
+        snd_pcm_sw_params_current(pcm, sw);
+        snd_pcm_sw_params_set_avail_min(pcm, sw, period);
+        snd_pcm_sw_params_set_start_threshold(pcm, sw, 1);
+        int err = snd_pcm_sw_params(pcm, sw);
+        snd_pcm_sw_params_free(sw);
+        if (err < 0)
+        {
+            snd_pcm_close(pcm);
+            throw std::runtime_error("ALSA " + device + ": sw params: " + snd_strerror(err));
+        }
+
+        snd_pcm_prepare(pcm);
+        snd_pcm_start(pcm);
+    }
+
+    ~AlsaSource() override
+    {
+        if (pcm)
+            snd_pcm_close(pcm);
+    }
+
+    AlsaSource(const AlsaSource &) = delete;
+    AlsaSource &operator=(const AlsaSource &) = delete;
+
+    std::string name() const override { return "alsa:" + device; }
+
+    std::string settings() const override
+    {
+        return "period " + std::to_string(periodMs()) + " ms, buffer " + std::to_string(bufferMs()) + " ms";
+    }
+
+    int periodMs() const { return static_cast<int>(period / 16); }
+    int bufferMs() const { return static_cast<int>(buffer / 16); }
+    long long overruns() const override { return xruns; }
+
+    bool next(const short *&data, size_t &n) override
+    {
+        if (lent_frames > 0)
+        {
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, lent_offset, lent_frames);
+            lent_frames = 0;
+            if (committed < 0)
+                recover(static_cast<int>(committed));
+        }
+
+        while (true)
+        {
+            snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+            if (avail < 0)
+            {
+                recover(static_cast<int>(avail));
+                continue;
+            }
+            if (static_cast<snd_pcm_uframes_t>(avail) < period)
+            {
+                int err = snd_pcm_wait(pcm, 1000);
+                if (err < 0)
+                    recover(err);
+                continue;
+            }
+
+            const snd_pcm_channel_area_t *areas = nullptr;
+            snd_pcm_uframes_t offset = 0;
+            snd_pcm_uframes_t frames = static_cast<snd_pcm_uframes_t>(avail);
+            int err = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+            if (err < 0)
+            {
+                recover(err);
+                continue;
+            }
+            if (areas[0].step != 16)
+                throw std::runtime_error("ALSA " + device + ": unexpected mmap layout");
+
+            // Everything captured but not yet committed back, oldest first
+            snd_pcm_sframes_t delay = 0;
+            if (snd_pcm_delay(pcm, &delay) == 0)
+                noteCaptureAge(delay / 16.0);
+
+            data = reinterpret_cast<const short *>(static_cast<const char *>(areas[0].addr) + areas[0].first / 8) + offset;
+            n = frames;
+            lent_offset = offset;
+            lent_frames = frames;
+            return true;
+        }
+    }
+
+    bool read(std::vector<short> &samples) override
+    {
+        const short *data;
+        size_t n;
+        if (!next(data, n))
+            return false;
+        samples.assign(data, data + n);
+        return true;
+    }
+};
+#endif
+
+inline bool has_suffix(const std::string &s, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() > n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+inline bool is_fifo(const std::string &path)
+{
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
+}
+
+// "pulse" / "pulse-async" / "alsa[:device]" for capture devices, "-" for
+// raw s16le on stdin, a named pipe or .raw/.pcm file of the same,
+// "synth:<kind>[:seconds]", "shm:<name>" for a shared-memory ring (Linux),
+// or a path to a 16 kHz WAV file
+inline std::unique_ptr<AudioSource> make_audio_source(const std::string &spec, const AudioSourceOptions &options)
+{
+    const std::string client = "Whisper Streaming Transcriber";
+    if (spec.empty() || spec == "pulse")
+    {
+#if defined(HAVE_PULSEAUDIO)
+        return std::make_unique<PulseSimpleSource>(client, options);
+#elif defined(_WIN32)
+        return std::make_unique<WinMMSource>(client);
+#else
+        throw std::runtime_error("Built without PulseAudio; use --input=alsa or --input=- to read raw PCM from stdin");
+#endif
+    }
+    if (spec == "pulse-async")
+    {
+#ifdef HAVE_PULSEAUDIO
+        return std::make_unique<PulseAsyncSource>(client, options);
+#else
+        throw std::runtime_error("Built without PulseAudio");
+#endif
+    }
+    if (spec == "alsa" || spec.rfind("alsa:", 0) == 0)
+    {
+#ifdef HAVE_ALSA
+        return std::make_unique<AlsaSource>(spec.size() > 5 ? spec.substr(5) : "", options);
+#else
+        throw std::runtime_error("Built without ALSA (install libasound2-dev and rebuild)");
+#endif
+    }
+    if (spec.rfind("synth:", 0) == 0)
+        return std::make_unique<SynthSource>(spec.substr(6), options);
+    if (spec == "-" || has_suffix(spec, ".raw") || has_suffix(spec, ".pcm") || is_fifo(spec))
+        return std::make_unique<RawPcmSource>(spec, options.replay_speed);
+    if (has_suffix(spec, ".wav"))
+        return std::make_unique<WavFileSource>(spec, options.replay_speed);
+    if (spec.rfind("replay:", 0) == 0)
+        return std::make_unique<SessionReplaySource>(spec.substr(7), options.replay_speed);
+    if (spec.rfind("shm:", 0) == 0)
+    {
+#ifdef __linux__
+        return std::make_unique<ShmAudioSource>(spec.substr(4));
+#else
+        throw std::runtime_error("Shared-memory audio rings are only supported on Linux");
+#endif
+    }
+    throw std::runtime_error("Unknown audio source: " + spec +
+                             " (expected pulse, pulse-async, alsa[:device], -, a named pipe, synth:<kind>, shm:<name>,"
+                             " replay:<recording> or a .wav/.raw file)");
+}
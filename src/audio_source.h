@@ -0,0 +1,634 @@
+#pragma once
+
+/**
+ * Audio input backends. Every source delivers 16 kHz mono 16-bit PCM in
+ * blocks of whatever size suits it; AudioFramer re-slices them downstream.
+ *
+ * Sources that know when their samples were captured record the capture
+ * latency of each block: the age of its oldest sample when the block is
+ * handed to the transcriber. Native capture backends (PulseAudio, ALSA)
+ * live in audio_backends.h.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "shm_ring.h"
+#include "wav.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Period and buffer sizes apply to capture devices; 0 keeps the backend's
+// default. Replay speed paces file and synthetic sources (0 = unpaced).
+struct AudioSourceOptions
+{
+    double replay_speed = 1.0;
+    int period_ms = 0;
+    int buffer_ms = 0;
+    // PulseAudio buffer attributes in bytes; 0 derives them from the period
+    // (fragsize) and buffer (maxlength)
+    uint32_t pa_fragsize = 0;
+    uint32_t pa_maxlength = 0;
+};
+
+// Named capture periods for --latency. Only the period is preset: a
+// capture buffer adds no latency when it is read as soon as a period is
+// ready, and it has to absorb the time the capture thread spends in
+// committed decodes, so buffers keep their (large) defaults.
+struct LatencyPreset
+{
+    const char *name;
+    int period_ms; // 0 = backend default
+};
+
+inline const LatencyPreset LATENCY_PRESETS[] = {
+    {"low", 10},
+    {"balanced", 20},
+    {"default", 0},
+    {"powersave", 200},
+};
+
+// Sets the period unless it was given explicitly
+inline void apply_latency_preset(const std::string &name, AudioSourceOptions &options)
+{
+    for (const LatencyPreset &preset : LATENCY_PRESETS)
+    {
+        if (name == preset.name)
+        {
+            if (options.period_ms <= 0)
+                options.period_ms = preset.period_ms;
+            return;
+        }
+    }
+    throw std::runtime_error("Unknown latency preset: " + name + " (expected low, balanced, default or powersave)");
+}
+
+// Capture latency per block, kept by the capture thread and read once it
+// has stopped (or by the same thread)
+class CaptureLatency
+{
+public:
+    struct Summary
+    {
+        long long blocks = 0;
+        double mean_ms = 0.0;
+        double p50_ms = 0.0;
+        double p99_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+private:
+    static constexpr size_t WINDOW = 4096;
+    std::vector<float> recent;
+    size_t next_slot = 0;
+    long long count = 0;
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+
+public:
+    void record(double ms)
+    {
+        ms = std::max(0.0, ms);
+        if (recent.size() < WINDOW)
+            recent.push_back(static_cast<float>(ms));
+        else
+            recent[next_slot] = static_cast<float>(ms);
+        next_slot = (next_slot + 1) % WINDOW;
+        count++;
+        total_ms += ms;
+        max_ms = std::max(max_ms, ms);
+    }
+
+    bool measured() const { return count > 0; }
+
+    // Percentiles over the most recent blocks, mean and max over all
+    Summary summary() const
+    {
+        Summary out;
+        out.blocks = count;
+        if (count == 0)
+            return out;
+        std::vector<float> sorted = recent;
+        std::sort(sorted.begin(), sorted.end());
+        out.mean_ms = total_ms / count;
+        out.p50_ms = sorted[(sorted.size() - 1) / 2];
+        out.p99_ms = sorted[static_cast<size_t>((sorted.size() - 1) * 0.99)];
+        out.max_ms = max_ms;
+        return out;
+    }
+};
+
+// Audio lost between capture and the reader, located by sample index.
+// Fed once per block by the capture thread, in order. A source that
+// counts what it drops (ring overruns, full queues) is taken at its
+// word; otherwise a gap is inferred when a block was captured later than
+// the previous block's end by more than the timestamp jitter allows.
+class CaptureGaps
+{
+public:
+    struct Gap
+    {
+        long long index = 0; // samples received before the gap
+        double lost_ms = 0.0;
+        bool exact = false; // counted by the source, not inferred from timestamps
+    };
+
+    // Timestamps from sound servers jitter by a few ms; a gap must exceed
+    // this plus a quarter of the previous block to count
+    static constexpr double TOLERANCE_MS = 50.0;
+    static constexpr size_t MAX_KEPT = 1024;
+
+private:
+    long long received = 0;
+    long long source_lost = 0;
+    std::chrono::steady_clock::time_point last_captured{};
+    double last_block_ms = 0.0;
+    std::vector<Gap> gaps;
+    long long gap_count = 0;
+    double lost_total_ms = 0.0;
+
+    void add(double lost_ms, bool exact)
+    {
+        gap_count++;
+        lost_total_ms += lost_ms;
+        if (gaps.size() == MAX_KEPT)
+            gaps.erase(gaps.begin());
+        gaps.push_back({received, lost_ms, exact});
+    }
+
+public:
+    // `captured` is the capture time of the block's first sample (the epoch
+    // when unknown); `source_lost_samples` the source's running count of
+    // dropped samples. Returns the audio lost just before this block, in ms.
+    double block(size_t n, std::chrono::steady_clock::time_point captured, long long source_lost_samples)
+    {
+        double lost_ms = 0.0;
+        if (source_lost_samples > source_lost)
+        {
+            lost_ms = (source_lost_samples - source_lost) / 16.0;
+            source_lost = source_lost_samples;
+            add(lost_ms, true);
+        }
+        else if (captured.time_since_epoch().count() != 0 && last_captured.time_since_epoch().count() != 0)
+        {
+            double late_ms = std::chrono::duration<double, std::milli>(captured - last_captured).count() - last_block_ms;
+            if (late_ms > TOLERANCE_MS + last_block_ms / 4)
+            {
+                lost_ms = late_ms;
+                add(lost_ms, false);
+            }
+        }
+        last_captured = captured;
+        last_block_ms = n / 16.0;
+        received += static_cast<long long>(n);
+        return lost_ms;
+    }
+
+    // Index of the next sample to be received
+    long long samples() const { return received; }
+    long long count() const { return gap_count; }
+    double lostMs() const { return lost_total_ms; }
+
+    // Audio lost inside [from, to) of the received-sample index (only the
+    // most recent MAX_KEPT gaps are remembered)
+    double lostBetween(long long from, long long to) const
+    {
+        double ms = 0.0;
+        for (const Gap &g : gaps)
+            if (g.index > from && g.index < to)
+                ms += g.lost_ms;
+        return ms;
+    }
+};
+
+class RecordedDecisions; // session_recorder.h
+
+class AudioSource
+{
+private:
+    std::vector<short> block;
+
+protected:
+    CaptureLatency capture_latency;
+    std::chrono::steady_clock::time_point block_captured{};
+
+    // Sources that know how old the oldest sample of the block they are
+    // about to return is call this once per block
+    void noteCaptureAge(double age_ms)
+    {
+        capture_latency.record(age_ms);
+        block_captured = std::chrono::steady_clock::now() -
+                         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                             std::chrono::duration<double, std::milli>(std::max(0.0, age_ms)));
+    }
+
+public:
+    virtual ~AudioSource() = default;
+
+    virtual std::string name() const = 0;
+
+    // Blocks until a block of samples is available. Returns false at end of stream.
+    virtual bool read(std::vector<short> &samples) = 0;
+
+    // Like read(), but the block stays owned by the source and is valid
+    // until the next call. Sources that already hold the samples in memory
+    // override this to skip the copy.
+    virtual bool next(const short *&data, size_t &n)
+    {
+        if (!read(block))
+            return false;
+        data = block.data();
+        n = block.size();
+        return true;
+    }
+
+    // Empty (measured() == false) for sources without capture timestamps,
+    // such as pipes and unpaced replays
+    const CaptureLatency &captureLatency() const { return capture_latency; }
+
+    // Capture time of the oldest sample of the last block returned; the
+    // epoch (a default time_point) when the source cannot tell
+    std::chrono::steady_clock::time_point blockCaptured() const { return block_captured; }
+
+    // Buffer settings in effect, for the startup banner; empty if none apply
+    virtual std::string settings() const { return ""; }
+
+    // Times audio was lost because the reader fell behind the capture side
+    virtual long long overruns() const { return 0; }
+
+    // Samples dropped so far by sources that can count them; 0 otherwise
+    virtual long long lostSamples() const { return 0; }
+
+    // Hotword and VAD decisions to use instead of the detectors' own, for
+    // a replayed session recording; null for every other source
+    virtual RecordedDecisions *recordedDecisions() { return nullptr; }
+};
+
+// Age of a sample that was due at `due` in a paced replay
+inline double replay_age_ms(std::chrono::steady_clock::time_point due)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - due).count();
+}
+
+// Replays a WAV file, paced to real time unless speed is 0 (as fast as possible)
+class WavFileSource : public AudioSource
+{
+private:
+    std::string path;
+    std::vector<short> audio;
+    size_t position = 0;
+    double speed;
+    size_t block_samples;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    WavFileSource(const std::string &file, double replay_speed = 1.0, size_t block = 2048)
+        : path(file), audio(read_wav_file(file).samples), speed(replay_speed), block_samples(std::max<size_t>(1, block))
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    std::string name() const override { return path; }
+
+    bool read(std::vector<short> &samples) override
+    {
+        if (position >= audio.size())
+            return false;
+
+        size_t n = std::min(block_samples, audio.size() - position);
+        if (speed > 0.0)
+        {
+            // Deliver a block no earlier than its capture time would have been
+            auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>((position + n) / (16000.0 * speed)));
+            std::this_thread::sleep_until(due);
+            noteCaptureAge(replay_age_ms(due) + n / (16.0 * speed));
+        }
+
+        samples.assign(audio.begin() + position, audio.begin() + position + n);
+        position += n;
+        return true;
+    }
+};
+
+// Headerless 16 kHz mono s16le from stdin ("-"), a named pipe or a raw
+// file, e.g. piped from arecord or ffmpeg. Reads are large (up to a second
+// of audio) but return whatever a pipe has, so live input is not delayed;
+// a pipe is consumed as fast as its writer produces, which makes
+// `cat capture.raw | wake2text --input=-` an unpaced replay. Regular files
+// are paced like WAV files.
+class RawPcmSource : public AudioSource
+{
+private:
+    std::string label;
+    int fd;
+    bool owns_fd;
+    std::vector<char> buffer;
+    size_t carry = 0; // odd trailing byte from the previous read
+    double speed;
+    size_t position = 0;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit RawPcmSource(const std::string &path, double replay_speed = 1.0, size_t max_samples = 16000)
+        : label(path == "-" ? "stdin" : path), buffer(max_samples * sizeof(short)), speed(0.0)
+    {
+        if (path == "-")
+        {
+            fd = 0;
+            owns_fd = false;
+#ifdef _WIN32
+            _setmode(fd, _O_BINARY);
+#endif
+        }
+        else
+        {
+#ifdef _WIN32
+            fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+            fd = open(path.c_str(), O_RDONLY);
+#endif
+            if (fd < 0)
+                throw std::runtime_error("Cannot open raw audio input " + path);
+            owns_fd = true;
+        }
+#ifndef _WIN32
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+            speed = replay_speed;
+#endif
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~RawPcmSource() override
+    {
+        if (owns_fd)
+        {
+#ifdef _WIN32
+            _close(fd);
+#else
+            close(fd);
+#endif
+        }
+    }
+
+    RawPcmSource(const RawPcmSource &) = delete;
+    RawPcmSource &operator=(const RawPcmSource &) = delete;
+
+    std::string name() const override { return label; }
+
+    bool read(std::vector<short> &samples) override
+    {
+        long got;
+        do
+        {
+#ifdef _WIN32
+            got = _read(fd, buffer.data() + carry, static_cast<unsigned>(buffer.size() - carry));
+#else
+            got = static_cast<long>(::read(fd, buffer.data() + carry, buffer.size() - carry));
+#endif
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0)
+            return false;
+
+        size_t bytes = carry + static_cast<size_t>(got);
+        size_t n = bytes / sizeof(short);
+        samples.resize(n);
+        memcpy(samples.data(), buffer.data(), n * sizeof(short));
+        carry = bytes % sizeof(short);
+        if (carry)
+            buffer[0] = buffer[bytes - 1];
+
+        if (speed > 0.0)
+        {
+            auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>((position + n) / (16000.0 * speed)));
+            std::this_thread::sleep_until(due);
+            noteCaptureAge(replay_age_ms(due) + n / (16.0 * speed));
+        }
+        position += n;
+        // A lone byte is not a sample yet; keep reading
+        return n > 0 || read(samples);
+    }
+};
+
+// Samples pushed by another thread, e.g. a network connection. The writer
+// keeps a handle to the shared channel, so it stays valid however long the
+// reading transcriber lives. read() blocks until samples arrive or the
+// channel is closed.
+class PushAudioSource : public AudioSource
+{
+public:
+    class Channel
+    {
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<short> pending;
+        bool closed = false;
+        size_t max_samples;
+        long long dropped = 0;
+        std::atomic<long long> overflows{0};
+
+        friend class PushAudioSource;
+
+    public:
+        // Holds at most max_seconds of unread audio; older samples are
+        // dropped (and counted) like a capture overrun
+        explicit Channel(double max_seconds = 30.0) : max_samples(static_cast<size_t>(max_seconds * 16000)) {}
+
+        void push(const short *samples, size_t n)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (closed)
+                    return;
+                pending.insert(pending.end(), samples, samples + n);
+                if (pending.size() > max_samples)
+                {
+                    size_t excess = pending.size() - max_samples;
+                    pending.erase(pending.begin(), pending.begin() + excess);
+                    dropped += static_cast<long long>(excess);
+                    overflows++;
+                }
+            }
+            cv.notify_one();
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            cv.notify_all();
+        }
+
+        long long droppedSamples()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return dropped;
+        }
+    };
+
+private:
+    std::shared_ptr<Channel> channel;
+    std::string label;
+
+public:
+    PushAudioSource(std::shared_ptr<Channel> shared, const std::string &name) : channel(std::move(shared)), label(name) {}
+
+    std::string name() const override { return label; }
+
+    long long overruns() const override { return channel->overflows.load(); }
+    long long lostSamples() const override { return channel->droppedSamples(); }
+
+    bool read(std::vector<short> &samples) override
+    {
+        std::unique_lock<std::mutex> lock(channel->mutex);
+        channel->cv.wait(lock, [this]
+                         { return channel->closed || !channel->pending.empty(); });
+        if (channel->pending.empty())
+            return false;
+        // Swap so both buffers keep their capacity across reads
+        samples.swap(channel->pending);
+        channel->pending.clear();
+        return true;
+    }
+};
+
+// Generated audio for exercising the pipeline without a device:
+// "synth:sine", "synth:noise" or "synth:silence", optionally followed by
+// ":<seconds>" (default: endless). Paced like a replay, in period-sized
+// blocks (default 10 ms).
+class SynthSource : public AudioSource
+{
+private:
+    std::string label;
+    std::string kind;
+    double seconds = 0.0;
+    double speed;
+    size_t block_samples;
+    size_t position = 0;
+    uint32_t noise_state = 0x12345678;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    SynthSource(const std::string &spec, const AudioSourceOptions &options)
+        : label("synth:" + spec), speed(options.replay_speed),
+          block_samples(static_cast<size_t>(std::max(1, options.period_ms > 0 ? options.period_ms : 10)) * 16)
+    {
+        size_t colon = spec.find(':');
+        kind = spec.substr(0, colon);
+        if (kind != "sine" && kind != "noise" && kind != "silence")
+            throw std::runtime_error("Unknown synthetic source: " + spec + " (expected sine, noise or silence)");
+        if (colon != std::string::npos)
+            seconds = std::stod(spec.substr(colon + 1));
+        start = std::chrono::steady_clock::now();
+    }
+
+    std::string name() const override { return label; }
+
+    bool read(std::vector<short> &samples) override
+    {
+        size_t n = block_samples;
+        if (seconds > 0.0)
+        {
+            size_t total = static_cast<size_t>(seconds * 16000);
+            if (position >= total)
+                return false;
+            n = std::min(n, total - position);
+        }
+
+        constexpr double kPi = 3.14159265358979323846; // M_PI needs _USE_MATH_DEFINES on MSVC
+        samples.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (kind == "sine")
+            {
+                samples[i] = static_cast<short>(8000 * std::sin(2 * kPi * 440 * (position + i) / 16000.0));
+            }
+            else if (kind == "noise")
+            {
+                noise_state = noise_state * 1664525u + 1013904223u;
+                samples[i] = static_cast<short>((static_cast<int>(noise_state >> 16) - 32768) / 8);
+            }
+            else
+            {
+                samples[i] = 0;
+            }
+        }
+
+        if (speed > 0.0)
+        {
+            auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>((position + n) / (16000.0 * speed)));
+            std::this_thread::sleep_until(due);
+            noteCaptureAge(replay_age_ms(due) + n / (16.0 * speed));
+        }
+        position += n;
+        return true;
+    }
+};
+
+#ifdef __linux__
+// Frames straight out of a producer's shared-memory ring (see shm_ring.h)
+class ShmAudioSource : public AudioSource
+{
+private:
+    ShmRingReader reader;
+    std::string label;
+    long long laps = 0;
+    long long overrun_seen = 0;
+
+public:
+    explicit ShmAudioSource(const std::string &spec) : reader(spec), label("shm:" + spec) {}
+
+    std::string name() const override { return label; }
+
+    const ShmRingReader::Stats &ringStats() const { return reader.ringStats(); }
+
+    bool next(const short *&data, size_t &n) override
+    {
+        if (!reader.next(data, n))
+            return false;
+        noteCaptureAge(reader.ringStats().last_latency_ms);
+        if (reader.ringStats().overrun_samples != overrun_seen)
+        {
+            overrun_seen = reader.ringStats().overrun_samples;
+            laps++;
+        }
+        return true;
+    }
+
+    long long overruns() const override { return laps; }
+    long long lostSamples() const override { return reader.ringStats().overrun_samples; }
+
+    bool read(std::vector<short> &samples) override
+    {
+        const short *data;
+        size_t n;
+        if (!next(data, n))
+            return false;
+        samples.assign(data, data + n);
+        return true;
+    }
+};
+#endif
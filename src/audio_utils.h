@@ -0,0 +1,123 @@
+#pragma once
+
+/**
+ * Per-chunk helpers of the transcriber.
+ *
+ * These run on every chunk or segment, so they live here, free of Whisper
+ * and snowboy, where bench/microbench.cpp can time them in isolation.
+ * Behaviour is exactly that of the transcriber; its messages and
+ * thresholds stay in main.cpp.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// int16 PCM -> the [-1, 1) floats whisper_full expects
+inline std::vector<float> pcm_to_float(const std::vector<short> &audio_data)
+{
+    std::vector<float> float_data;
+    float_data.reserve(audio_data.size());
+    for (short sample : audio_data)
+    {
+        float_data.push_back(static_cast<float>(sample) / 32768.0f);
+    }
+    return float_data;
+}
+
+struct ChunkEnergy
+{
+    double rms = 0.0;
+    double speech_ratio = 0.0; // share of samples above `speech_threshold`
+};
+
+// RMS and activity of a chunk, used to skip decoding silence
+inline ChunkEnergy chunk_energy(const std::vector<short> &audio_chunk, short speech_threshold = 200)
+{
+    ChunkEnergy energy;
+    if (audio_chunk.empty())
+        return energy;
+
+    long long sum_squares = 0;
+    for (short sample : audio_chunk)
+    {
+        sum_squares += (long long)sample * sample;
+    }
+    energy.rms = sqrt((double)sum_squares / audio_chunk.size());
+
+    int speech_samples = 0;
+    for (short sample : audio_chunk)
+    {
+        if (abs(sample) > speech_threshold)
+        {
+            speech_samples++;
+        }
+    }
+    energy.speech_ratio = (double)speech_samples / audio_chunk.size();
+    return energy;
+}
+
+// Check for common Whisper hallucinations
+inline bool is_hallucination(const std::string &text)
+{
+    std::string lower_text = text;
+    std::transform(lower_text.begin(), lower_text.end(), lower_text.begin(), ::tolower);
+
+    std::vector<std::string> hallucinations = {
+        "υπότιτλοι", "authorwave", "subtitles", "subtitle", "closed captions",
+        "captioning", "transcription", "transcript", "audio", "music",
+        "[music]", "[sound]", "[noise]", "[silence]", "[inaudible]",
+        "thank you", "thanks for watching", "subscribe", "like and subscribe",
+        "www.", ".com", "http", "https",
+        "undertekster", "ai-media", "ai media", "undertekst", "tekster",
+        "untertitel", "sous-titres", "legendas", "sottotitoli"};
+
+    for (const auto &halluc : hallucinations)
+    {
+        if (lower_text.find(halluc) != std::string::npos)
+        {
+            return true;
+        }
+    }
+
+    // Check for standalone hallucinations
+    std::string trimmed = lower_text;
+    trimmed.erase(std::remove_if(trimmed.begin(), trimmed.end(),
+                                 [](char c)
+                                 { return c == '.' || c == ',' || c == '!' || c == '?' || c == ' ' || c == '\t' || c == '\n' || c == '\r'; }),
+                  trimmed.end());
+
+    std::vector<std::string> standalone_hallucinations = {
+        "thankyou", "thankyouforwatching", "thanks", "thanksforwatching",
+        "subscribe", "likeandsubscribe", "pleasesubscribe"};
+
+    for (const auto &standalone : standalone_hallucinations)
+    {
+        if (trimmed == standalone)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Samples of a chunk kept in the buffer after it is processed, so a word
+// cut at the boundary is heard again; `chunks_done` counts decoded chunks
+// including this one
+inline int chunk_overlap(int chunk_samples, int chunks_done, bool skipped)
+{
+    if (skipped)
+        return chunk_samples / 8; // Smaller overlap for skipped chunks
+    if (chunks_done == 1)
+        return chunk_samples / 32; // Very small overlap for first chunk
+    return chunk_samples / 64;     // Minimal overlap for subsequent chunks
+}
+
+// Drops a processed chunk from the front of the buffer, keeping `overlap`
+inline void consume_chunk(std::vector<short> &buffer, int chunk_samples, int overlap)
+{
+    buffer.erase(buffer.begin(), buffer.begin() + chunk_samples - overlap);
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+/**
+ * Cross-session decode batching.
+ *
+ * Committed chunks from all streams are queued here instead of leasing a
+ * Whisper state directly. A dispatcher waits up to a batching window after
+ * the first queued chunk (or until the batch is full), then runs the whole
+ * batch together: one pooled state per chunk, with the engine's thread
+ * budget divided between them, so several short sequences share the cores
+ * that a single whisper_full call would underuse. Callers block until their
+ * chunk has been decoded.
+ *
+ * Queued chunks are taken by priority class (with the state pool's aging),
+ * and a queued final is dispatched at once instead of waiting out the
+ * window.
+ *
+ * whisper.cpp has no public API for a multi-sequence encoder pass, so a
+ * batch is co-scheduled on parallel states rather than fused into one graph.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "whisper_engine.h"
+
+class BatchScheduler
+{
+public:
+    // Decodes one chunk on the given state with the given thread count
+    using Job = std::function<void(struct whisper_state *, int)>;
+
+    struct Stats
+    {
+        long long batches = 0;
+        long long jobs = 0;
+        double queue_wait_ms = 0.0; // time from submit until the batch started
+        double max_queue_wait_ms = 0.0;
+    };
+
+private:
+    struct Pending
+    {
+        Job job;
+        DecodePriority priority;
+        std::chrono::steady_clock::time_point enqueued;
+        std::promise<double> done; // resolves to the queue wait in ms
+    };
+
+    std::shared_ptr<WhisperEngine> engine;
+    const std::chrono::milliseconds window;
+    const size_t max_batch;
+    const int thread_budget;
+
+    std::deque<std::unique_ptr<Pending>> queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+    Stats stats;
+    std::thread dispatcher;
+
+    void dispatchLoop()
+    {
+        while (true)
+        {
+            std::vector<std::unique_ptr<Pending>> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]
+                        { return stop || !queue.empty(); });
+                if (stop && queue.empty())
+                    return;
+
+                // Hold the batch open until it is full, a final is waiting,
+                // or the oldest chunk has waited for the whole window
+                auto deadline = queue.front()->enqueued + window;
+                cv.wait_until(lock, deadline, [this]
+                              { return stop || queue.size() >= max_batch || hasFinal(); });
+
+                // Queue order is arrival order, so a stable sort keeps FIFO
+                // within each (aged) class
+                auto now = std::chrono::steady_clock::now();
+                std::stable_sort(queue.begin(), queue.end(), [now](const auto &a, const auto &b)
+                                 { return effectiveClass(*a, now) < effectiveClass(*b, now); });
+                while (!queue.empty() && batch.size() < max_batch)
+                {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+
+            runBatch(batch);
+        }
+    }
+
+    bool hasFinal() const
+    {
+        for (const auto &pending : queue)
+        {
+            if (pending->priority == DecodePriority::Final)
+                return true;
+        }
+        return false;
+    }
+
+    static int effectiveClass(const Pending &p, std::chrono::steady_clock::time_point now)
+    {
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - p.enqueued).count();
+        return static_cast<int>(p.priority) - static_cast<int>(waited / WhisperEngine::AGING_MS);
+    }
+
+    void runBatch(std::vector<std::unique_ptr<Pending>> &batch)
+    {
+        // The batch competes for states at the class of its most urgent chunk
+        // (it is sorted); leases may wait while a speculative decode finishes
+        std::vector<WhisperEngine::Lease> leases;
+        for (size_t i = 0; i < batch.size(); i++)
+            leases.push_back(engine->acquire(batch.front()->priority));
+
+        auto started = std::chrono::steady_clock::now();
+        int threads = std::max(1, thread_budget / static_cast<int>(batch.size()));
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < batch.size(); i++)
+        {
+            workers.emplace_back([&, i]()
+                                 { batch[i]->job(leases[i].get(), threads); });
+        }
+        batch[0]->job(leases[0].get(), threads);
+        for (auto &worker : workers)
+            worker.join();
+        leases.clear();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.batches++;
+        for (auto &pending : batch)
+        {
+            double wait_ms = std::chrono::duration<double, std::milli>(started - pending->enqueued).count();
+            stats.jobs++;
+            stats.queue_wait_ms += wait_ms;
+            stats.max_queue_wait_ms = std::max(stats.max_queue_wait_ms, wait_ms);
+            pending->done.set_value(wait_ms);
+        }
+    }
+
+public:
+    // The batch size is capped at the engine's state count; the engine's
+    // per-decode thread budget times its state count is shared by a batch.
+    BatchScheduler(std::shared_ptr<WhisperEngine> shared_engine, int window_ms, int batch_size)
+        : engine(std::move(shared_engine)), window(std::max(0, window_ms)),
+          max_batch(static_cast<size_t>(std::clamp(batch_size, 1, engine->stateCount()))),
+          thread_budget(engine->threadsPerDecode() * engine->stateCount())
+    {
+        dispatcher = std::thread(&BatchScheduler::dispatchLoop, this);
+    }
+
+    ~BatchScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        dispatcher.join();
+    }
+
+    BatchScheduler(const BatchScheduler &) = delete;
+    BatchScheduler &operator=(const BatchScheduler &) = delete;
+
+    // Blocks until the job has run as part of a batch; returns the time it
+    // spent queued (the latency added by batching plus state contention)
+    double run(Job job, DecodePriority priority = DecodePriority::Interim)
+    {
+        auto pending = std::make_unique<Pending>();
+        pending->job = std::move(job);
+        pending->priority = priority;
+        pending->enqueued = std::chrono::steady_clock::now();
+        std::future<double> done = pending->done.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(pending));
+        }
+        cv.notify_all();
+        return done.get();
+    }
+
+    Stats snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    int windowMs() const { return static_cast<int>(window.count()); }
+    int maxBatch() const { return static_cast<int>(max_batch); }
+};
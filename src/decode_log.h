@@ -0,0 +1,186 @@
+#pragma once
+
+/**
+ * Per-decode Whisper timings as JSON lines.
+ *
+ * whisper_get_timings() only reports on a context's default state, and
+ * every decode here runs on a pooled state (the context is created
+ * without one), so the phases are measured from whisper_full's own
+ * callbacks instead:
+ *
+ *   mel     whisper_full start -> encoder_begin_callback
+ *   encode  encoder start -> first logits_filter_callback (first decoder step)
+ *   decode  first decoder step -> whisper_full returns
+ *
+ * Audio longer than one 30 s window is encoded again for each window;
+ * those later encodes are counted in `decode`. `steps` counts decoder
+ * steps across all beams and temperature fallbacks.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include "whisper.h"
+
+class DecodeProbe
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start;
+    Clock::time_point encoder_begin{};
+    Clock::time_point first_step{};
+    Clock::time_point end;
+    long long steps = 0;
+
+    static bool onEncoderBegin(struct whisper_context *, struct whisper_state *, void *data)
+    {
+        DecodeProbe *self = static_cast<DecodeProbe *>(data);
+        if (self->encoder_begin.time_since_epoch().count() == 0)
+            self->encoder_begin = Clock::now();
+        return true;
+    }
+
+    static void onLogits(struct whisper_context *, struct whisper_state *, const whisper_token_data *, int, float *, void *data)
+    {
+        DecodeProbe *self = static_cast<DecodeProbe *>(data);
+        if (self->steps++ == 0)
+            self->first_step = Clock::now();
+    }
+
+    static double ms(Clock::time_point from, Clock::time_point to)
+    {
+        if (from.time_since_epoch().count() == 0 || to.time_since_epoch().count() == 0)
+            return -1.0;
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+public:
+    // Must stay alive until whisper_full returns; the params must not
+    // already use these callbacks
+    void attach(struct whisper_full_params &params)
+    {
+        params.encoder_begin_callback = onEncoderBegin;
+        params.encoder_begin_callback_user_data = this;
+        params.logits_filter_callback = onLogits;
+        params.logits_filter_callback_user_data = this;
+    }
+
+    void begin() { start = Clock::now(); }
+    void finish() { end = Clock::now(); }
+
+    Clock::time_point startTime() const { return start; }
+    Clock::time_point encoderTime() const { return encoder_begin; }
+    Clock::time_point firstStepTime() const { return first_step; }
+    Clock::time_point endTime() const { return end; }
+
+    double wallMs() const { return ms(start, end); }
+    double melMs() const { return ms(start, encoder_begin); }
+    double encodeMs() const { return ms(encoder_begin, first_step); }
+    double decodeMs() const { return ms(first_step, end); }
+    long long decoderSteps() const { return steps; }
+};
+
+// One record per whisper_full call; see --decode-log
+struct DecodeRecord
+{
+    std::string stream;
+    const char *priority = "";
+    double audio_ms = 0.0;
+    int threads = 0;
+    bool ok = false;
+    int segments = 0;
+    int tokens = 0;
+};
+
+class DecodeLog
+{
+private:
+    std::mutex mutex;
+    FILE *out = nullptr;
+    bool owned = false;
+
+    static std::string quote(const std::string &text)
+    {
+        std::string out = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                out += c;
+        }
+        return out + "\"";
+    }
+
+    static std::string number(double v)
+    {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.3f", v);
+        return buf;
+    }
+
+public:
+    static DecodeLog &global()
+    {
+        static DecodeLog instance;
+        return instance;
+    }
+
+    ~DecodeLog()
+    {
+        if (owned)
+            std::fclose(out);
+    }
+
+    // "-" writes to stderr
+    void open(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (path == "-")
+        {
+            out = stderr;
+            return;
+        }
+        out = std::fopen(path.c_str(), "a");
+        if (!out)
+            throw std::runtime_error("Cannot open decode log: " + path);
+        owned = true;
+    }
+
+    bool enabled() const { return out != nullptr; }
+
+    // Segment and token counts are read from `state`, so call this before
+    // the state is released
+    void write(DecodeRecord record, const DecodeProbe &probe, struct whisper_state *state)
+    {
+        if (!out)
+            return;
+        if (record.ok)
+        {
+            record.segments = whisper_full_n_segments_from_state(state);
+            for (int i = 0; i < record.segments; i++)
+                record.tokens += whisper_full_n_tokens_from_state(state, i);
+        }
+
+        long long unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+        double wall_ms = probe.wallMs();
+        std::string line = "{\"time_ms\":" + std::to_string(unix_ms) + ",\"stream\":" + quote(record.stream) +
+                           ",\"priority\":\"" + record.priority + "\",\"ok\":" + (record.ok ? "true" : "false") +
+                           ",\"audio_ms\":" + number(record.audio_ms) + ",\"wall_ms\":" + number(wall_ms) +
+                           ",\"rtf\":" + number(record.audio_ms > 0 ? wall_ms / record.audio_ms : 0.0) +
+                           ",\"mel_ms\":" + number(probe.melMs()) + ",\"encode_ms\":" + number(probe.encodeMs()) +
+                           ",\"decode_ms\":" + number(probe.decodeMs()) +
+                           ",\"steps\":" + std::to_string(probe.decoderSteps()) +
+                           ",\"segments\":" + std::to_string(record.segments) + ",\"tokens\":" + std::to_string(record.tokens) +
+                           ",\"threads\":" + std::to_string(record.threads) + "}\n";
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::fputs(line.c_str(), out);
+        std::fflush(out);
+    }
+};
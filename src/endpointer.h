@@ -0,0 +1,185 @@
+#pragma once
+
+/**
+ * Adaptive end-of-utterance detection.
+ *
+ * Instead of a fixed run of silent reads, the silence window that ends a
+ * session adapts to the speaker: it grows with the pauses observed inside
+ * the current utterance (dictation) and shrinks to the minimum once the
+ * partial transcript looks finished: a phrase from the command grammar, or
+ * sentence punctuation on a short utterance. Whisper punctuates nearly every
+ * chunk, so punctuation alone says little about longer dictation.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct EndpointConfig
+{
+    bool adaptive = true;
+    int min_silence_ms = 300;   // window once the transcript looks complete
+    int base_silence_ms = 800;  // window before any pause has been observed
+    int max_silence_ms = 2000;  // upper bound, and the window in fixed mode
+    int min_pause_ms = 150;     // shorter gaps are ignored as pause samples
+    int short_utterance_ms = 2500; // punctuation only counts up to this much speech
+    std::string grammar_path;   // one command phrase per line, '*' = any words
+};
+
+class Endpointer
+{
+private:
+    EndpointConfig config;
+    std::vector<std::string> grammar;
+
+    std::vector<int> pauses; // silence runs inside the utterance that were followed by speech
+    int silence_ms = 0;
+    int speech_ms = 0;
+    bool sentence_end = false; // partial transcript ends a sentence
+    bool command = false;      // partial transcript matches the grammar
+
+    static std::string normalize(const std::string &text)
+    {
+        std::string out;
+        bool space = false;
+        for (unsigned char c : text)
+        {
+            if (std::isalnum(c) || c >= 0x80 || c == '*')
+            {
+                if (space && !out.empty())
+                    out += ' ';
+                out += static_cast<char>(std::tolower(c));
+                space = false;
+            }
+            else if (c != '\'')
+            {
+                space = true;
+            }
+        }
+        return out;
+    }
+
+    static bool matchesPhrase(const std::string &text, const std::string &phrase)
+    {
+        size_t star = phrase.find('*');
+        if (star == std::string::npos)
+            return text == phrase;
+
+        // "set a timer for *" requires at least one word in place of '*'
+        std::string prefix = phrase.substr(0, star);
+        return text.size() > prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+    }
+
+public:
+    explicit Endpointer(const EndpointConfig &cfg = EndpointConfig()) : config(cfg)
+    {
+        if (config.min_silence_ms <= 0 || config.max_silence_ms <= 0)
+            throw std::invalid_argument("Endpoint silence windows must be positive");
+        if (config.min_silence_ms > config.max_silence_ms)
+            throw std::invalid_argument("Endpoint minimum window (" + std::to_string(config.min_silence_ms) +
+                                        " ms) exceeds the maximum (" + std::to_string(config.max_silence_ms) + " ms)");
+
+        if (config.grammar_path.empty())
+            return;
+
+        std::ifstream in(config.grammar_path);
+        if (!in)
+        {
+            throw std::runtime_error("Cannot open command grammar: " + config.grammar_path);
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::string phrase = normalize(line);
+            if (!phrase.empty())
+                grammar.push_back(phrase);
+        }
+    }
+
+    void reset()
+    {
+        pauses.clear();
+        silence_ms = 0;
+        speech_ms = 0;
+        sentence_end = false;
+        command = false;
+    }
+
+    // Feed one VAD decision covering `ms` of audio. Returns true when the
+    // utterance should be finalized.
+    bool update(bool speech, int ms)
+    {
+        if (speech)
+        {
+            if (silence_ms >= config.min_pause_ms && speech_ms > 0)
+            {
+                pauses.push_back(silence_ms);
+            }
+            // Speech after the last transcript update makes its "complete"
+            // cue stale until the next update
+            sentence_end = false;
+            command = false;
+            silence_ms = 0;
+            speech_ms += ms;
+            return false;
+        }
+
+        silence_ms += ms;
+        return speech_ms > 0 && silence_ms >= silenceWindowMs();
+    }
+
+    // Partial transcript cue: a matched command, or a finished sentence on
+    // a short utterance, lets the endpoint fire after the minimum window.
+    void setTranscript(const std::string &text)
+    {
+        sentence_end = false;
+        command = false;
+        size_t last = text.find_last_not_of(" \t\n\r");
+        if (last == std::string::npos)
+            return;
+
+        char c = text[last];
+        sentence_end = (c == '.' || c == '?' || c == '!');
+
+        std::string normalized = normalize(text);
+        for (const auto &phrase : grammar)
+        {
+            if (matchesPhrase(normalized, phrase))
+            {
+                command = true;
+                break;
+            }
+        }
+    }
+
+    bool transcriptComplete() const { return command || (sentence_end && speech_ms <= config.short_utterance_ms); }
+
+    int silenceWindowMs() const
+    {
+        if (!config.adaptive)
+            return config.max_silence_ms;
+        if (transcriptComplete())
+            return config.min_silence_ms;
+
+        int window = config.base_silence_ms;
+        if (!pauses.empty())
+        {
+            // Allow somewhat more than the longest recent pause so a speaker
+            // who pauses mid-dictation is not cut off
+            std::vector<int> recent(pauses.end() - std::min<size_t>(pauses.size(), 8), pauses.end());
+            int longest = *std::max_element(recent.begin(), recent.end());
+            window = std::max(window, longest + longest / 2);
+        }
+        return std::clamp(window, config.min_silence_ms, config.max_silence_ms);
+    }
+
+    int silenceMs() const { return silence_ms; }
+    int speechMs() const { return speech_ms; }
+    bool adaptive() const { return config.adaptive; }
+    size_t grammarSize() const { return grammar.size(); }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+/**
+ * Fixed-size audio framing.
+ *
+ * Capture backends return blocks of whatever size the device or sound
+ * server prefers. AudioFramer slices that stream into frames of a fixed
+ * duration so hotword detection, VAD and all timing thresholds see the same
+ * granularity regardless of the backend. Full frames inside an input block
+ * are passed through without copying; only the remainder is staged in a
+ * buffer allocated once at construction.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+class AudioFramer
+{
+private:
+    size_t frame_samples;
+    int rate;
+    std::vector<short> staging;
+    size_t staged = 0;
+
+public:
+    AudioFramer(int frame_ms, int sample_rate = 16000) : rate(sample_rate)
+    {
+        if (frame_ms != 10 && frame_ms != 20 && frame_ms != 30)
+        {
+            throw std::runtime_error("Frame size must be 10, 20 or 30 ms");
+        }
+        frame_samples = static_cast<size_t>(sample_rate / 1000 * frame_ms);
+        staging.resize(frame_samples);
+    }
+
+    size_t frameSamples() const { return frame_samples; }
+
+    int frameMs() const { return static_cast<int>(frame_samples * 1000 / rate); }
+
+    // Calls on_frame(const short *frame) once per complete frame
+    template <typename Fn>
+    void push(const short *samples, size_t n, Fn &&on_frame)
+    {
+        if (staged > 0)
+        {
+            size_t take = std::min(frame_samples - staged, n);
+            std::copy(samples, samples + take, staging.begin() + staged);
+            staged += take;
+            samples += take;
+            n -= take;
+            if (staged < frame_samples)
+                return;
+            on_frame(static_cast<const short *>(staging.data()));
+            staged = 0;
+        }
+
+        while (n >= frame_samples)
+        {
+            on_frame(samples);
+            samples += frame_samples;
+            n -= frame_samples;
+        }
+
+        std::copy(samples, samples + n, staging.begin());
+        staged = n;
+    }
+
+    void reset() { staged = 0; }
+};
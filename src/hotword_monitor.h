@@ -0,0 +1,169 @@
+#pragma once
+
+/**
+ * Hotword detection on a dedicated thread.
+ *
+ * The capture thread only copies frames into a fixed ring; the detector
+ * runs here, including while a transcription session is active, so saying
+ * the hotword again can cancel a running session (barge-in). During
+ * sessions the thread sleeps in proportion to the time spent in
+ * RunDetection to stay within its CPU share; if it falls behind, the
+ * oldest frames are dropped and counted.
+ *
+ * Frames carry the capture time of their newest sample when the source
+ * knows it; the gap between that and the moment the detector starts on
+ * the frame is recorded per frame.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "audio_source.h"
+#include "stage_latency.h"
+#include "trace.h"
+#include "snowboy-detect.h"
+
+class HotwordMonitor
+{
+private:
+    snowboy::SnowboyDetect &detector;
+    const size_t frame_samples;
+    const size_t capacity;
+    const double cpu_share;
+    std::atomic<int> &cancel_generation;
+
+    std::vector<short> ring;
+    std::vector<std::chrono::steady_clock::time_point> captured;
+    size_t head = 0;
+    size_t count = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+    std::thread worker;
+
+    std::atomic<bool> session_active{false};
+    std::atomic<int> detections{0};
+    std::atomic<long long> dropped{0};
+    int consumed = 0; // capture-thread side of `detections`
+
+    std::mutex gap_mutex;
+    CaptureLatency gap; // capture -> RunDetection
+
+    void run()
+    {
+        Tracer::global().nameThread("hotword");
+        std::vector<short> frame(frame_samples);
+        while (true)
+        {
+            std::chrono::steady_clock::time_point frame_captured;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]
+                        { return stop || count > 0; });
+                if (stop)
+                    return;
+                std::copy(ring.begin() + head * frame_samples, ring.begin() + (head + 1) * frame_samples, frame.begin());
+                frame_captured = captured[head];
+                head = (head + 1) % capacity;
+                count--;
+            }
+
+            auto t0 = std::chrono::steady_clock::now();
+            if (frame_captured.time_since_epoch().count() != 0)
+            {
+                std::lock_guard<std::mutex> lock(gap_mutex);
+                gap.record(std::chrono::duration<double, std::milli>(t0 - frame_captured).count());
+            }
+            int result;
+            {
+                TraceScope trace("RunDetection");
+                result = detector.RunDetection(frame.data(), static_cast<int>(frame_samples), false);
+            }
+            auto busy = std::chrono::steady_clock::now() - t0;
+            if (frame_captured.time_since_epoch().count() != 0)
+                StageLatency::global().record(Stage::Hotword, frame_captured);
+
+            if (result > 0)
+            {
+                // Bump the generation first so in-flight Whisper work sees
+                // the cancel before the capture thread starts a new session
+                if (session_active.load())
+                    cancel_generation++;
+                detections++;
+            }
+
+            if (session_active.load() && cpu_share < 1.0)
+            {
+                std::this_thread::sleep_for(busy * (1.0 / cpu_share - 1.0));
+            }
+        }
+    }
+
+public:
+    HotwordMonitor(snowboy::SnowboyDetect &det, size_t frame_size, double share, std::atomic<int> &cancel,
+                   size_t capacity_frames = 100)
+        : detector(det), frame_samples(frame_size), capacity(capacity_frames),
+          cpu_share(std::clamp(share, 0.01, 1.0)), cancel_generation(cancel)
+    {
+        ring.resize(frame_samples * capacity);
+        captured.resize(capacity);
+        worker = std::thread(&HotwordMonitor::run, this);
+    }
+
+    ~HotwordMonitor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    HotwordMonitor(const HotwordMonitor &) = delete;
+    HotwordMonitor &operator=(const HotwordMonitor &) = delete;
+
+    // `when` is the capture time of the frame's newest sample, or a
+    // default time_point if unknown
+    void push(const short *frame, std::chrono::steady_clock::time_point when = {})
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == capacity)
+            {
+                head = (head + 1) % capacity;
+                count--;
+                dropped++;
+            }
+            size_t slot = (head + count) % capacity;
+            std::copy(frame, frame + frame_samples, ring.begin() + slot * frame_samples);
+            captured[slot] = when;
+            count++;
+        }
+        cv.notify_one();
+    }
+
+    // Capture thread: true once per detection
+    bool takeDetection()
+    {
+        int current = detections.load();
+        if (current == consumed)
+            return false;
+        consumed = current;
+        return true;
+    }
+
+    void setSessionActive(bool active) { session_active = active; }
+
+    long long droppedFrames() const { return dropped.load(); }
+
+    CaptureLatency::Summary detectorGap()
+    {
+        std::lock_guard<std::mutex> lock(gap_mutex);
+        return gap.summary();
+    }
+};
@@ -8,16 +8,41 @@
 #include "helper.h"
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <thread>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <memory>
+#include <new>
 #include <vector>
 #include "snowboy-detect.h"
-#include "pulseaudio.hh"
+#include "admission.h"
+#include "audio_utils.h"
+#include "audio_backends.h"
+#include "audio_source.h"
+#include "batch_scheduler.h"
+#include "decode_log.h"
+#include "endpointer.h"
+#include "framer.h"
+#include "hotword_monitor.h"
+#include "memory_stats.h"
+#include "metrics.h"
+#include "output_channel.h"
+#include "session_recorder.h"
+#include "stage_latency.h"
+#include "stream_server.h"
+#include "trace.h"
+#include "vad.h"
+#include "wav.h"
+#include "whisper_engine.h"
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4244) // Suppress conversion warnings from Whisper.cpp
@@ -31,10 +56,78 @@
 #include <windows.h>
 #include <filesystem>
 #else
+#include <sys/resource.h>
 #include <sys/wait.h>
 #endif
 
-namespace pa = pulseaudio::pa;
+// Optional callbacks for embedding a transcriber (API server). They run on
+// the transcriber's capture thread and must not block.
+struct TranscriptEvents
+{
+    std::function<void(bool barge_in)> on_hotword;
+    std::function<void(const std::string &text)> on_partial;
+    std::function<void(const std::string &text, double audio_seconds, double latency_ms, double finalize_ms, bool speculative)> on_final;
+};
+
+struct TranscriberOptions
+{
+    std::string hotword_model; // empty = resources/pmdl/hey_casper.pmdl
+    std::string language = "en";
+    bool quiet = false;
+    std::string vad_engine = "snowboy";
+    std::string vad_model;
+    EndpointConfig endpoint;
+    int frame_ms = 20;
+    bool speculative = true;
+    double barge_in_share = 0.25;
+    std::string stream_name; // tags output lines when several streams share a process
+    TranscriptEvents events;
+    int beam_size = 5; // > 1 = beam search, otherwise greedy
+    std::string record_path; // session recording (--record); single stream only
+};
+
+// Whisper resources shared by every stream in the process
+struct SharedInference
+{
+    std::shared_ptr<WhisperEngine> engine;
+    std::shared_ptr<WhisperEngine> fallback; // smaller model used under overload; may be null
+    std::shared_ptr<BatchScheduler> batcher; // null: decode on a leased state directly
+    std::shared_ptr<AdmissionController> admission;
+};
+
+// whisper_full and its phases on the --trace timeline
+inline void trace_decode(const DecodeProbe &probe, long long samples)
+{
+    Tracer &tracer = Tracer::global();
+    if (!tracer.enabled())
+        return;
+    int64_t start_us = tracer.toUs(probe.startTime());
+    int64_t end_us = tracer.toUs(probe.endTime());
+    tracer.record("whisper_full", start_us, end_us - start_us, samples);
+    if (probe.encoderTime().time_since_epoch().count() == 0)
+        return;
+    int64_t encode_us = tracer.toUs(probe.encoderTime());
+    tracer.record("mel", start_us, encode_us - start_us);
+    if (probe.firstStepTime().time_since_epoch().count() == 0)
+        return;
+    int64_t decode_us = tracer.toUs(probe.firstStepTime());
+    tracer.record("encode", encode_us, decode_us - encode_us);
+    tracer.record("decode", decode_us, end_us - decode_us, probe.decoderSteps());
+}
+
+// Per-stream counters, read by the server summary after the stream ends
+struct StreamStats
+{
+    double audio_seconds = 0.0;
+    int sessions = 0;
+    int decodes = 0;
+    double decode_ms = 0.0;
+    double decoded_audio_seconds = 0.0;
+    double state_wait_ms = 0.0;
+    long long capture_gaps = 0;
+    double capture_lost_ms = 0.0;
+    std::vector<double> final_latency_ms;
+};
 
 class WhisperStreamingTranscriber
 {
@@ -42,94 +135,152 @@ private:
     std::string root;
     std::string model;
     std::string hotword;
-    pa::simple_record_stream *audio_in;
-    snowboy::SnowboyDetect *detector;
-    snowboy::SnowboyVad *vad;
+    std::string prefix;
+    std::string stream_name;
 
-    // Whisper C API integration
-    struct whisper_context *whisper_ctx;
+    OutputChannel::Line say(OutputKind kind, std::string payload = {})
+    {
+        return OutputChannel::global().line(kind, stream_name, std::move(payload));
+    }
+    std::unique_ptr<AudioSource> source;
+    TranscriptEvents events;
+    snowboy::SnowboyDetect *detector;
+    std::unique_ptr<HotwordMonitor> monitor;
+    std::unique_ptr<VadEngine> vad;
+    Endpointer endpointer;
+    AudioFramer framer;
+    // Capture time of the newest sample of the frame being processed (epoch
+    // if the source has no timestamps), and the gap until it is processed
+    std::chrono::steady_clock::time_point frame_captured;
+    CaptureLatency frame_gap;
+    // Audio the source lost, by position in the received stream; the frame
+    // being processed ends at frame_end and the session began at session_origin
+    CaptureGaps capture_gaps;
+    long long frame_end = 0;
+    long long session_origin = 0;
+    // Process-wide allocation counts when the session started, and the
+    // largest the session's audio buffer got
+    MemoryStats::Allocations session_allocations;
+    size_t session_buffer_peak = 0;
+    // --record writes what the capture thread sees; a replay:<file> source
+    // supplies the recorded decisions. frame_number counts frames from 0.
+    std::unique_ptr<SessionRecorder> recorder;
+    RecordedDecisions *replay = nullptr;
+    std::atomic<int> replay_cancel_sink{0};
+    long long frame_number = -1;
+    // Replays ignore decode timing: no speculation, no overload deferral and
+    // no load-driven downgrade, so the same recording gives the same text
+    bool deterministic = false;
+
+    // Whisper C API integration; the model and its states are shared
+    std::shared_ptr<WhisperEngine> engine;
+    std::shared_ptr<WhisperEngine> fallback;
+    std::shared_ptr<BatchScheduler> batcher;
+    std::shared_ptr<AdmissionController> admission;
     struct whisper_full_params whisper_params;
-    std::string whisper_model_path;
     std::string lang_code = "en";
-    int ngl_layers = 0;
+    StreamStats stats;
+
+    // All timing thresholds are in milliseconds of audio and counted in
+    // fixed frames, independent of the capture block size.
+    const int MIN_SPEECH_MS = 500;
+    const int TRANSCRIPTION_CHUNK_MS = 3000;
+    const int MAX_SESSION_MS = 60000;
+    const int MAX_DEFERRED_MS = 20000; // undecoded audio a session may hold under overload
+    const int TRANSCRIPTION_CHUNK_SIZE = TRANSCRIPTION_CHUNK_MS * 16;
 
     std::vector<short> audio_buffer;
     bool is_listening = false;
-    int silence_counter = 0;
-    int speech_counter = 0;
-    const int SILENCE_THRESHOLD = 30;
-    const int MIN_SPEECH_LENGTH = 8000;
-    const int TRANSCRIPTION_CHUNK_SIZE = 48000;
+    int silence_ms = 0;
+    int speech_ms = 0;
+    int idle_ms = 0;
+    size_t deferred_size = 0; // buffer size when an interim decode was last refused
 
     std::string current_transcription;
     bool transcription_started = false;
     int chunk_count = 0;
     bool quiet_mode = false;
 
-    // Convert short samples to float samples (Whisper expects float)
-    std::vector<float> convertToFloat(const std::vector<short> &audio_data)
+    // Speculative decoding: a background worker re-decodes the uncommitted
+    // tail on a spare pooled Whisper state while the user is still speaking,
+    // so the final transcript is usually ready when the endpoint fires.
+    struct SpeculativeResult
     {
-        std::vector<float> float_data;
-        float_data.reserve(audio_data.size());
-        for (short sample : audio_data)
-        {
-            float_data.push_back(static_cast<float>(sample) / 32768.0f);
-        }
-        return float_data;
-    }
-
-    // Check for common Whisper hallucinations
-    bool isHallucination(const std::string &text)
+        int session = -1;
+        long long origin = -1; // absolute sample index of audio_buffer[0]
+        size_t length = 0;     // samples covered from origin
+        std::string text;
+    };
+    const int SPECULATIVE_STEP_MS = 400;
+    bool speculative_enabled = true;
+    std::thread spec_thread;
+    std::mutex spec_mutex;
+    std::condition_variable spec_cv;
+    bool spec_stop = false;
+    bool spec_pending = false;
+    bool spec_running = false;
+    bool main_decoding = false;
+    std::vector<short> spec_audio;
+    SpeculativeResult spec_request;
+    SpeculativeResult spec_inflight;
+    SpeculativeResult spec_result;
+    std::atomic<int> spec_generation{0};
+    int spec_seen_generation = 0;
+    long long spec_submitted_origin = -1;
+    size_t spec_submitted_length = 0;
+    int spec_submitted_speech_ms = 0;
+    int session_id = 0;
+
+    // Barge-in: the monitor bumps this when the hotword is heard during a
+    // session; Whisper calls started under an older value abort.
+    std::atomic<int> cancel_generation{0};
+    bool barge_in = true;
+    double barge_in_cpu_share = 0.25;
+
+    struct AbortCheck
     {
-        std::string lower_text = text;
-        std::transform(lower_text.begin(), lower_text.end(), lower_text.begin(), ::tolower);
-
-        std::vector<std::string> hallucinations = {
-            "υπότιτλοι", "authorwave", "subtitles", "subtitle", "closed captions",
-            "captioning", "transcription", "transcript", "audio", "music",
-            "[music]", "[sound]", "[noise]", "[silence]", "[inaudible]",
-            "thank you", "thanks for watching", "subscribe", "like and subscribe",
-            "www.", ".com", "http", "https",
-            "undertekster", "ai-media", "ai media", "undertekst", "tekster",
-            "untertitel", "sous-titres", "legendas", "sottotitoli"};
-
-        for (const auto &halluc : hallucinations)
-        {
-            if (lower_text.find(halluc) != std::string::npos)
-            {
-                return true;
-            }
-        }
-
-        // Check for standalone hallucinations
-        std::string trimmed = lower_text;
-        trimmed.erase(std::remove_if(trimmed.begin(), trimmed.end(),
-                                     [](char c)
-                                     { return c == '.' || c == ',' || c == '!' || c == '?' || c == ' ' || c == '\t' || c == '\n' || c == '\r'; }),
-                      trimmed.end());
+        const std::atomic<int> *generation;
+        int start;
+        const WhisperEngine *yield_to = nullptr; // background decodes: engine with queued higher-priority work
+    };
 
-        std::vector<std::string> standalone_hallucinations = {
-            "thankyou", "thankyouforwatching", "thanks", "thanksforwatching",
-            "subscribe", "likeandsubscribe", "pleasesubscribe"};
-
-        for (const auto &standalone : standalone_hallucinations)
-        {
-            if (trimmed == standalone)
-            {
-                return true;
-            }
-        }
-
-        return false;
+    static bool abortRequested(void *data)
+    {
+        const AbortCheck *check = static_cast<const AbortCheck *>(data);
+        return check->generation->load() != check->start ||
+               (check->yield_to && check->yield_to->preemptRequested(DecodePriority::Background));
     }
 
+    std::chrono::steady_clock::time_point last_speech_time;
+    int latency_sessions = 0;
+    double latency_total_ms = 0.0;
+
 public:
-    WhisperStreamingTranscriber(const std::string &model_path = "", const std::string &language = "en", int ngl = 0, bool quiet = false)
+    WhisperStreamingTranscriber(const TranscriberOptions &options, const SharedInference &shared,
+                                std::unique_ptr<AudioSource> input)
+        : source(std::move(input)), endpointer(options.endpoint), framer(options.frame_ms), engine(shared.engine),
+          fallback(shared.fallback), batcher(shared.batcher), admission(shared.admission)
     {
-        ngl_layers = ngl;
-        lang_code = language;
-        quiet_mode = quiet;
-        whisper_ctx = nullptr;
+        lang_code = options.language;
+        quiet_mode = options.quiet;
+        speculative_enabled = options.speculative;
+        barge_in = options.barge_in_share > 0.0;
+        barge_in_cpu_share = options.barge_in_share;
+        prefix = options.stream_name.empty() ? "" : "[" + options.stream_name + "] ";
+        stream_name = options.stream_name;
+        events = options.events;
+
+        replay = source->recordedDecisions();
+        if (replay && replay->frameSamples() != framer.frameSamples())
+            throw std::runtime_error("Recording uses " + std::to_string(replay->frameSamples()) +
+                                     "-sample frames; replay it with --frame-ms=" + std::to_string(replay->frameSamples() / 16));
+        if (replay)
+        {
+            deterministic = true;
+            speculative_enabled = false;
+        }
+        if (!options.record_path.empty())
+            recorder = std::make_unique<SessionRecorder>(options.record_path, source->name(), framer.frameSamples());
 
 #ifdef _WIN32
         char module_path[MAX_PATH];
@@ -142,26 +293,8 @@ public:
 
         std::filesystem::path base = std::filesystem::path(detect_project_root());
         std::filesystem::path default_model = base / "resources" / "pmdl" / "hey_casper.pmdl";
-        std::filesystem::path large_v3_project = base / "models" / "ggml-large-v3.bin";
-        std::filesystem::path large_v3_whisper = base / "whisper.cpp" / "models" / "ggml-large-v3.bin";
 
-        model = model_path.empty() ? default_model.string() : model_path;
-
-        // Find Whisper model
-        if (std::filesystem::exists(large_v3_project))
-        {
-            whisper_model_path = std::filesystem::absolute(large_v3_project).string();
-        }
-        else if (std::filesystem::exists(large_v3_whisper))
-        {
-            whisper_model_path = std::filesystem::absolute(large_v3_whisper).string();
-        }
-        else
-        {
-            std::string msg = "Required model ggml-large-v3.bin not found. Checked:\n  " + (large_v3_project.string()) + "\n  " + (large_v3_whisper.string()) +
-                              "\nYou can download it with: whisper.cpp\\models\\download-ggml-model.cmd large-v3";
-            throw std::runtime_error(msg);
-        }
+        model = options.hotword_model.empty() ? default_model.string() : options.hotword_model;
 
 #ifdef _WIN32
         auto to_win_path = [](std::string s)
@@ -171,24 +304,21 @@ public:
                     c = '\\';
             return s;
         };
-        whisper_model_path = to_win_path(whisper_model_path);
         model = to_win_path(model);
 #endif
 
-        // Initialize Whisper
-        struct whisper_context_params cparams = whisper_context_default_params();
-        cparams.use_gpu = (ngl_layers > 0);
-
-        whisper_ctx = whisper_init_from_file_with_params(whisper_model_path.c_str(), cparams);
-        if (!whisper_ctx)
+        // Setup Whisper parameters
+        if (options.beam_size > 1)
         {
-            throw std::runtime_error("Failed to initialize Whisper model: " + whisper_model_path);
+            whisper_params = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+            whisper_params.beam_search.beam_size = options.beam_size;
+        }
+        else
+        {
+            whisper_params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
         }
-
-        // Setup Whisper parameters
-        whisper_params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
         whisper_params.language = lang_code.c_str();
-        whisper_params.n_threads = static_cast<int>(std::thread::hardware_concurrency() / 2);
+        whisper_params.n_threads = engine->threadsPerDecode();
         whisper_params.offset_ms = 0;
         whisper_params.duration_ms = 0;
         whisper_params.translate = false;
@@ -199,9 +329,7 @@ public:
         whisper_params.print_realtime = false;
         whisper_params.print_timestamps = false;
 
-        // Quality settings equivalent to --best-of 5 --beam-size 5
-        whisper_params.strategy = WHISPER_SAMPLING_BEAM_SEARCH;
-        whisper_params.beam_search.beam_size = 5;
+        // Candidates per temperature fallback when decoding greedily
         whisper_params.greedy.best_of = 5;
 
         // Quality thresholds
@@ -210,6 +338,11 @@ public:
         whisper_params.suppress_blank = true;
         whisper_params.suppress_nst = true;
 
+        if (speculative_enabled)
+        {
+            spec_thread = std::thread(&WhisperStreamingTranscriber::speculativeLoop, this);
+        }
+
         // Determine hotword name from model file
         hotword = "unknown";
         if (model.find("computer.umdl") != std::string::npos)
@@ -233,68 +366,147 @@ public:
             }
         }
 
-        // Initialize audio and detection
-        audio_in = new pa::simple_record_stream("Whisper Streaming Transcriber");
+        // Session audio is bounded, so reserve it once instead of growing per read
+        audio_buffer.reserve(static_cast<size_t>(MAX_SESSION_MS) * 16 + framer.frameSamples());
+
+        // Initialize detection
         detector = new snowboy::SnowboyDetect(root + "resources/common.res", model);
-        vad = new snowboy::SnowboyVad(root + "resources/common.res");
+        vad = make_vad_engine(options.vad_engine, root + "resources/common.res", options.vad_model);
 
         detector->SetSensitivity("0.45");
         detector->SetAudioGain(1.5);
         detector->ApplyFrontend(true);
+        // On replay, detections come from the recording, and so do the
+        // barge-in cancels the monitor would otherwise signal
+        monitor = std::make_unique<HotwordMonitor>(*detector, framer.frameSamples(), barge_in_cpu_share,
+                                                   replay ? replay_cancel_sink : cancel_generation);
 
         if (!quiet_mode)
         {
-            std::cout << "[init] Whisper Streaming Transcriber initialized (C API)" << std::endl;
-            std::cout << "Hotword: '" << hotword << "'" << std::endl;
-            std::cout << "Model: " << model << std::endl;
-            std::cout << "Whisper model: " << whisper_model_path << std::endl;
-            std::cout << "Language: " << lang_code << std::endl;
-            std::cout << "GPU offload: " << (cparams.use_gpu ? "enabled" : "disabled") << std::endl;
+            OutputChannel::Line banner = say(OutputKind::Decoration);
+            banner << prefix << "[init] Whisper Streaming Transcriber initialized (C API)\n";
+            banner << "Hotword: '" << hotword << "'\n";
+            banner << "Model: " << model << "\n";
+            banner << "Audio source: " << source->name() << "\n";
+            banner << "Whisper model: " << engine->modelPath() << " (shared, " << engine->stateCount()
+                   << " state(s) x " << engine->threadsPerDecode() << " threads)\n";
+            banner << "Language: " << lang_code << "\n";
+            banner << "VAD: " << vad->name() << ", " << framer.frameMs() << " ms frames\n";
+            banner << "Endpointing: " << (endpointer.adaptive() ? "adaptive" : "fixed");
+            if (endpointer.grammarSize() > 0)
+                banner << " (" << endpointer.grammarSize() << " command phrases)";
+            banner << "\n";
+            banner << "GPU offload: " << (engine->usesGpu() ? "enabled" : "disabled") << "\n";
+            banner << "Decoding: "
+                   << (whisper_params.strategy == WHISPER_SAMPLING_BEAM_SEARCH ? "beam " + std::to_string(options.beam_size) : std::string("greedy"));
+            if (fallback)
+                banner << ", overload fallback " << fallback->modelPath();
+            banner << "\n";
+            banner << "Speculative decoding: " << (speculative_enabled ? "enabled" : deterministic ? "disabled (replay)" : "disabled") << "\n";
+            if (barge_in)
+                banner << "Barge-in: enabled (detector CPU share " << (int)(barge_in_cpu_share * 100) << "% during sessions)\n";
+            else
+                banner << "Barge-in: disabled\n";
         }
     }
 
     ~WhisperStreamingTranscriber()
     {
-        if (whisper_ctx)
+        monitor.reset();
+        if (spec_thread.joinable())
         {
-            whisper_free(whisper_ctx);
+            {
+                std::lock_guard<std::mutex> lock(spec_mutex);
+                spec_stop = true;
+            }
+            spec_cv.notify_all();
+            spec_thread.join();
         }
-        delete audio_in;
         delete detector;
-        delete vad;
     }
 
-    std::string transcribeWithWhisper(const std::vector<short> &audio_chunk)
+    // Decodes on a state leased from `model`. The speculative worker passes
+    // echo = false and must not print anything. n_threads overrides the
+    // per-decode thread count when a batch shares the cores. Background
+    // decodes abort as soon as a final or interim decode is waiting.
+    std::string transcribeWithWhisper(const std::vector<short> &audio_chunk, WhisperEngine &model, struct whisper_state *state,
+                                      DecodePriority priority, bool echo = true, int n_threads = 0, bool *completed = nullptr)
     {
-        if (!whisper_ctx)
+        if (!state)
         {
             return "[Whisper not initialized]";
         }
 
-        if (!quiet_mode)
+        if (!quiet_mode && echo)
         {
-            std::cout << "[proc] " << std::flush;
+            say(OutputKind::Diagnostic) << "[proc] ";
         }
 
         // Convert audio to float format
-        std::vector<float> float_audio = convertToFloat(audio_chunk);
+        std::vector<float> float_audio;
+        {
+            TraceScope trace("convertToFloat", static_cast<long long>(audio_chunk.size()));
+            float_audio = pcm_to_float(audio_chunk);
+        }
+        MemoryStats::global().noteBuffer(MemoryBuffer::FloatPcm, float_audio.capacity() * sizeof(float));
+
+        // Abort if the hotword is heard again while this call is running
+        AbortCheck check{&cancel_generation, cancel_generation.load(),
+                         priority == DecodePriority::Background ? &model : nullptr};
+        struct whisper_full_params params = whisper_params;
+        params.abort_callback = abortRequested;
+        params.abort_callback_user_data = &check;
+        if (n_threads > 0)
+            params.n_threads = n_threads;
+        if (params.strategy == WHISPER_SAMPLING_BEAM_SEARCH && !deterministic && admission->level() >= AdmissionController::GREEDY)
+        {
+            params.strategy = WHISPER_SAMPLING_GREEDY;
+            admission->noteGreedy();
+        }
+
+        DecodeProbe probe;
+        if (DecodeLog::global().enabled() || Tracer::global().enabled())
+            probe.attach(params);
 
         // Run Whisper transcription
-        if (whisper_full(whisper_ctx, whisper_params, float_audio.data(), static_cast<int>(float_audio.size())) != 0)
+        probe.begin();
+        int rc = whisper_full_with_state(model.context(), state, params, float_audio.data(), static_cast<int>(float_audio.size()));
+        probe.finish();
+        StageLatency::global().record(Stage::Whisper, probe.wallMs());
+        trace_decode(probe, static_cast<long long>(audio_chunk.size()));
+        if (rc == 0)
+            Metrics::global().noteDecode(audio_chunk.size() / 16000.0, probe.wallMs());
+        DecodeRecord record;
+        record.stream = stream_name;
+        record.priority = priority_name(priority);
+        record.audio_ms = audio_chunk.size() / 16.0;
+        record.threads = params.n_threads;
+        record.ok = rc == 0;
+        DecodeLog::global().write(record, probe, state);
+        if (completed)
+            *completed = rc == 0;
+        if (rc != 0)
         {
-            if (!quiet_mode)
+            if (check.yield_to && check.yield_to->preemptRequested(DecodePriority::Background))
+                model.metrics().notePreempted(priority);
+            if (!quiet_mode && echo)
             {
-                std::cout << "[ERROR] Whisper transcription failed" << std::endl;
+                if (abortRequested(&check))
+                    say(OutputKind::Diagnostic) << "[cancelled] ";
+                else
+                    say(OutputKind::Status) << "[ERROR] Whisper transcription failed\n";
             }
             return "";
         }
 
         // Extract transcribed text
+        TraceScope trace_filter("filter");
+        auto filter_start = std::chrono::steady_clock::now();
         std::string result;
-        const int n_segments = whisper_full_n_segments(whisper_ctx);
+        const int n_segments = whisper_full_n_segments_from_state(state);
         for (int i = 0; i < n_segments; ++i)
         {
-            const char *text = whisper_full_get_segment_text(whisper_ctx, i);
+            const char *text = whisper_full_get_segment_text_from_state(state, i);
             if (text && text[0] != '\0')
             {
                 std::string segment_text = text;
@@ -306,38 +518,95 @@ public:
                 {
                     segment_text = segment_text.substr(start, end - start + 1);
 
-                    if (!isHallucination(segment_text))
+                    if (!is_hallucination(segment_text))
                     {
                         if (!result.empty())
                             result += " ";
                         result += segment_text;
-                        std::cout << segment_text << " " << std::flush;
+                        if (echo)
+                            say(OutputKind::Partial) << segment_text << " ";
                     }
                     else
                     {
-                        if (!quiet_mode)
+                        Metrics::global().hallucinations.add();
+                        if (!quiet_mode && echo)
                         {
-                            std::cout << "[filtered: " << segment_text << "] " << std::flush;
+                            say(OutputKind::Diagnostic) << "[filtered: " << segment_text << "] ";
                         }
                     }
                 }
             }
         }
+        StageLatency::global().record(Stage::Filter, filter_start);
 
         return result;
     }
 
+    // Committed decodes lease a state from the shared pool, waiting while
+    // every state is busy with other streams. With a batch scheduler the
+    // chunk is queued instead and decoded together with other sessions'.
+    // The caller must already hold an admission for this decode.
+    std::string decodeCommitted(const std::vector<short> &chunk, DecodePriority priority)
+    {
+        TraceScope trace("decodeCommitted", static_cast<long long>(chunk.size()));
+        {
+            std::lock_guard<std::mutex> lock(spec_mutex);
+            main_decoding = true;
+        }
+
+        std::string text;
+        double wait_ms = 0.0;
+        auto wait_start = std::chrono::steady_clock::now();
+        Metrics::global().queue_depth.add(1);
+        if (fallback && !deterministic && admission->level() >= AdmissionController::SMALL_MODEL)
+        {
+            admission->noteFallback();
+            WhisperEngine::Lease lease = fallback->acquire(priority);
+            wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+            text = transcribeWithWhisper(chunk, *fallback, lease.get(), priority);
+        }
+        else if (batcher)
+        {
+            wait_ms = batcher->run([&](struct whisper_state *state, int n_threads)
+                                   { text = transcribeWithWhisper(chunk, *engine, state, priority, true, n_threads); },
+                                   priority);
+        }
+        else
+        {
+            WhisperEngine::Lease lease = engine->acquire(priority);
+            wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+            text = transcribeWithWhisper(chunk, *engine, lease.get(), priority);
+        }
+        double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+        Metrics::global().queue_depth.add(-1);
+        if (Tracer::global().enabled())
+            Tracer::global().record("state wait", Tracer::global().toUs(wait_start), static_cast<int64_t>(wait_ms * 1000));
+        admission->complete(wait_ms, total_ms - wait_ms, chunk.size() / 16.0);
+        engine->metrics().record(priority, wait_ms, total_ms - wait_ms);
+        StageLatency::global().record(Stage::Queue, wait_ms);
+
+        stats.decodes++;
+        stats.state_wait_ms += wait_ms;
+        stats.decode_ms += total_ms - wait_ms;
+        stats.decoded_audio_seconds += chunk.size() / 16000.0;
+
+        {
+            std::lock_guard<std::mutex> lock(spec_mutex);
+            main_decoding = false;
+        }
+        spec_cv.notify_all();
+        return text;
+    }
+
     bool hasSubstantialSpeech(const std::vector<short> &audio_chunk)
     {
+        TraceScope trace("hasSubstantialSpeech");
         if (audio_chunk.empty())
             return false;
 
-        long long sum_squares = 0;
-        for (short sample : audio_chunk)
-        {
-            sum_squares += (long long)sample * sample;
-        }
-        double rms = sqrt((double)sum_squares / audio_chunk.size());
+        const short SPEECH_THRESHOLD = 200;
+        ChunkEnergy energy = chunk_energy(audio_chunk, SPEECH_THRESHOLD);
+        double rms = energy.rms;
 
         const double MIN_RMS_THRESHOLD = 50.0;
 
@@ -345,34 +614,24 @@ public:
         {
             if (!quiet_mode)
             {
-                std::cout << "[near silence: RMS=" << (int)rms << "] " << std::flush;
+                say(OutputKind::Diagnostic) << "[near silence: RMS=" << (int)rms << "] ";
             }
             return false;
         }
 
-        int speech_samples = 0;
-        const short SPEECH_THRESHOLD = 200;
-        for (short sample : audio_chunk)
-        {
-            if (abs(sample) > SPEECH_THRESHOLD)
-            {
-                speech_samples++;
-            }
-        }
-
-        double speech_ratio = (double)speech_samples / audio_chunk.size();
+        double speech_ratio = energy.speech_ratio;
         if (speech_ratio < 0.005)
         {
             if (!quiet_mode)
             {
-                std::cout << "[no audio activity: " << (int)(speech_ratio * 1000) << "‰] " << std::flush;
+                say(OutputKind::Diagnostic) << "[no audio activity: " << (int)(speech_ratio * 1000) << "‰] ";
             }
             return false;
         }
 
         if (!quiet_mode)
         {
-            std::cout << "[audio OK: RMS=" << (int)rms << ", activity=" << (int)(speech_ratio * 100) << "%] " << std::flush;
+            say(OutputKind::Diagnostic) << "[audio OK: RMS=" << (int)rms << ", activity=" << (int)(speech_ratio * 100) << "%] ";
         }
         return true;
     }
@@ -381,80 +640,311 @@ public:
     {
         if (audio_buffer.size() >= TRANSCRIPTION_CHUNK_SIZE)
         {
+            TraceScope trace("processAudioChunk");
+
+            // Under overload interim decodes are refused and the audio stays
+            // buffered; past MAX_DEFERRED_MS it is decoded as if final so the
+            // backlog per session stays bounded and no text is lost. A
+            // replay decodes every chunk where the recording reached it.
+            bool overdue = deterministic || audio_buffer.size() > static_cast<size_t>(MAX_DEFERRED_MS) * 16;
+            bool retry = deferred_size > 0 && audio_buffer.size() < deferred_size + TRANSCRIPTION_CHUNK_SIZE;
+            // A refused chunk is retried every frame; the head of the buffer
+            // has not moved since, so it already passed the speech check and
+            // only the admission is asked again, before copying anything
+            bool admitted = false;
+            if (retry && !overdue)
+            {
+                if (!admission->admit(AdmissionController::Kind::Interim, true))
+                    return;
+                admitted = true;
+            }
+
             std::vector<short> chunk(audio_buffer.begin(),
                                      audio_buffer.begin() + TRANSCRIPTION_CHUNK_SIZE);
+            MemoryStats::global().noteBuffer(MemoryBuffer::Chunk, chunk.capacity() * sizeof(short));
 
-            if (!hasSubstantialSpeech(chunk))
+            if (!admitted && !hasSubstantialSpeech(chunk))
             {
+                Metrics::global().chunks_skipped.add();
                 if (!quiet_mode)
                 {
-                    std::cout << "[skipping chunk - insufficient speech] " << std::flush;
+                    say(OutputKind::Diagnostic) << "[skipping chunk - insufficient speech] ";
                 }
-                int overlap = TRANSCRIPTION_CHUNK_SIZE / 8; // Smaller overlap for skipped chunks
-                audio_buffer.erase(audio_buffer.begin(),
-                                   audio_buffer.begin() + TRANSCRIPTION_CHUNK_SIZE - overlap);
+                consume_chunk(audio_buffer, TRANSCRIPTION_CHUNK_SIZE, chunk_overlap(TRANSCRIPTION_CHUNK_SIZE, chunk_count, true));
+                return;
+            }
+
+            if (!admitted && !admission->admit(overdue ? AdmissionController::Kind::Final : AdmissionController::Kind::Interim))
+            {
+                deferred_size = audio_buffer.size();
+                if (!quiet_mode)
+                    say(OutputKind::Diagnostic) << "[deferring chunk - inference behind] ";
                 return;
             }
+            deferred_size = 0;
 
-            std::string transcribed_text = transcribeWithWhisper(chunk);
+            long long chunk_start = session_origin + bufferOrigin();
+            double chunk_lost_ms = capture_gaps.lostBetween(chunk_start, chunk_start + static_cast<long long>(chunk.size()));
+            if (chunk_lost_ms > 0 && !quiet_mode)
+                say(OutputKind::Diagnostic) << "[chunk spans " << (int)chunk_lost_ms << " ms capture gap] ";
+
+            auto enqueued = std::chrono::steady_clock::now();
+            std::string transcribed_text = decodeCommitted(chunk, DecodePriority::Interim);
 
             if (!transcribed_text.empty())
             {
+                TraceScope trace_output("output");
+                StageLatency::global().record(Stage::Output, enqueued);
                 if (!transcription_started)
                 {
-                    std::cout << "\nTranscription: ";
+                    say(OutputKind::Decoration) << "\n" << prefix << "Transcription: ";
                     transcription_started = true;
                 }
                 current_transcription += transcribed_text + " ";
+                endpointer.setTranscript(current_transcription);
+                if (events.on_partial)
+                    events.on_partial(current_transcription);
             }
 
             chunk_count++;
 
-            int overlap;
-            if (chunk_count == 1)
+            int overlap = chunk_overlap(TRANSCRIPTION_CHUNK_SIZE, chunk_count, false);
+
+            if (!quiet_mode)
+            {
+                say(OutputKind::Diagnostic) << "[chunk " << chunk_count << ", removing " << (TRANSCRIPTION_CHUNK_SIZE - overlap) << " samples, keeping " << overlap << " overlap] ";
+            }
+            consume_chunk(audio_buffer, TRANSCRIPTION_CHUNK_SIZE, overlap);
+        }
+    }
+
+    long long bufferOrigin() const
+    {
+        return static_cast<long long>(recorded_samples) - static_cast<long long>(audio_buffer.size());
+    }
+
+    void speculativeLoop()
+    {
+        Tracer::global().nameThread(prefix + "speculative");
+        std::vector<short> audio;
+        std::chrono::steady_clock::time_point queued_since{};
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(spec_mutex);
+                // Only take the CPU while the committed decode path is idle
+                spec_cv.wait(lock, [this]
+                             { return spec_stop || (spec_pending && !main_decoding); });
+                if (spec_stop)
+                    return;
+            }
+
+            // ...and queue for a state in the background class, behind
+            // every final and interim decode of every stream. The timeout
+            // only bounds how long a stop request can go unnoticed.
+            if (queued_since == std::chrono::steady_clock::time_point{})
+                queued_since = std::chrono::steady_clock::now();
+            WhisperEngine::Lease lease = engine->acquireFor(DecodePriority::Background, std::chrono::milliseconds(100), queued_since);
+            if (!lease)
+                continue;
+            double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queued_since).count();
+            queued_since = {};
+
+            SpeculativeResult job;
+            {
+                std::lock_guard<std::mutex> lock(spec_mutex);
+                if (spec_stop)
+                    return;
+                if (!spec_pending || main_decoding)
+                    continue;
+                job = spec_request;
+                audio.swap(spec_audio);
+                spec_pending = false;
+                spec_running = true;
+                spec_inflight = job;
+            }
+
+            // Speculation is the first work shed under overload
+            if (!admission->admit(AdmissionController::Kind::Speculative))
             {
-                overlap = TRANSCRIPTION_CHUNK_SIZE / 32; // Very small overlap for first chunk
+                std::lock_guard<std::mutex> lock(spec_mutex);
+                spec_running = false;
+                spec_cv.notify_all();
+                continue;
             }
+            auto spec_start = std::chrono::steady_clock::now();
+            // A re-decode that had to age past the other classes to get a
+            // state is not preempted again
+            bool completed = false;
+            DecodePriority run_as = wait_ms >= 2 * WhisperEngine::AGING_MS ? DecodePriority::Interim : DecodePriority::Background;
+            job.text = transcribeWithWhisper(audio, *engine, lease.get(), run_as, false, 0, &completed);
+            lease.reset();
+            double spec_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - spec_start).count();
+            if (completed)
+                admission->complete(0.0, spec_ms, audio.size() / 16.0);
             else
+                admission->abandon();
+            engine->metrics().record(DecodePriority::Background, wait_ms, spec_ms);
+
+            if (!completed)
             {
-                overlap = TRANSCRIPTION_CHUNK_SIZE / 64; // Minimal overlap for subsequent chunks
+                // Preempted or cancelled: publish nothing, the tail is
+                // resubmitted once more speech arrives or decoded at the end
+                std::lock_guard<std::mutex> lock(spec_mutex);
+                spec_running = false;
+                spec_cv.notify_all();
+                continue;
             }
 
-            if (!quiet_mode)
             {
-                std::cout << "[chunk " << chunk_count << ", removing " << (TRANSCRIPTION_CHUNK_SIZE - overlap) << " samples, keeping " << overlap << " overlap] " << std::flush;
+                std::lock_guard<std::mutex> lock(spec_mutex);
+                spec_result = job;
+                spec_running = false;
             }
-            audio_buffer.erase(audio_buffer.begin(),
-                               audio_buffer.begin() + TRANSCRIPTION_CHUNK_SIZE - overlap);
+            spec_generation++;
+            spec_cv.notify_all();
         }
     }
 
+    // Hands the current tail to the worker once enough new speech has arrived
+    void submitSpeculative()
+    {
+        long long origin = bufferOrigin();
+        bool tail_changed = origin != spec_submitted_origin;
+        if (!tail_changed && (audio_buffer.size() < spec_submitted_length + SPECULATIVE_STEP_MS * 16 ||
+                              speech_ms == spec_submitted_speech_ms))
+            return;
+        if (audio_buffer.size() < static_cast<size_t>(MIN_SPEECH_MS) * 16 || speech_ms <= MIN_SPEECH_MS)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(spec_mutex);
+            spec_audio.assign(audio_buffer.begin(), audio_buffer.end());
+            MemoryStats::global().noteBuffer(MemoryBuffer::Speculative, spec_audio.capacity() * sizeof(short));
+            spec_request.session = session_id;
+            spec_request.origin = origin;
+            spec_request.length = audio_buffer.size();
+            spec_pending = true;
+        }
+        spec_cv.notify_all();
+        spec_submitted_origin = origin;
+        spec_submitted_length = audio_buffer.size();
+        spec_submitted_speech_ms = speech_ms;
+    }
+
+    // Feeds the newest speculative text to the endpointer as a partial transcript
+    void pollSpeculative()
+    {
+        int generation = spec_generation.load();
+        if (generation == spec_seen_generation)
+            return;
+        spec_seen_generation = generation;
+
+        std::lock_guard<std::mutex> lock(spec_mutex);
+        if (spec_result.session == session_id && spec_result.origin == bufferOrigin())
+        {
+            endpointer.setTranscript(current_transcription + spec_result.text);
+        }
+    }
+
+    // Returns the speculative text when it covers everything in the tail
+    // except the trailing silence that triggered the endpoint.
+    bool takeSpeculativeResult(std::string &text)
+    {
+        if (!speculative_enabled)
+            return false;
+
+        const long long origin = bufferOrigin();
+        const size_t trailing = std::min(audio_buffer.size(), static_cast<size_t>(endpointer.silenceMs()) * 16);
+        const size_t needed = audio_buffer.size() - trailing;
+        auto covers = [&](const SpeculativeResult &r)
+        {
+            return r.session == session_id && r.origin == origin && r.length >= needed;
+        };
+
+        std::unique_lock<std::mutex> lock(spec_mutex);
+        spec_pending = false;
+        // An in-flight decode that covers the speech finishes sooner than a fresh one
+        spec_cv.wait(lock, [&]
+                     { return !(spec_running && covers(spec_inflight)); });
+        if (!covers(spec_result))
+            return false;
+        text = spec_result.text;
+        return true;
+    }
+
     void finalizeTranscription()
     {
-        if (!audio_buffer.empty() && transcription_started && audio_buffer.size() >= 8000)
+        TraceScope trace("finalizeTranscription");
+        auto finalize_start = std::chrono::steady_clock::now();
+        bool decoded = false;
+        bool speculative_hit = false;
+
+        std::string final_text;
+        if (!audio_buffer.empty() && audio_buffer.size() >= static_cast<size_t>(MIN_SPEECH_MS) * 16 && speech_ms > MIN_SPEECH_MS &&
+            takeSpeculativeResult(final_text))
         {
-            if (audio_buffer.size() >= TRANSCRIPTION_CHUNK_SIZE / 2)
+            speculative_hit = true;
+            decoded = true;
+            if (!quiet_mode)
             {
-                std::cout << "🔄 " << std::flush;
-                std::string final_text = transcribeWithWhisper(audio_buffer);
-                if (!final_text.empty())
-                {
-                    current_transcription += final_text;
-                    std::cout << final_text << std::flush;
-                }
+                say(OutputKind::Diagnostic) << "[speculative] ";
+            }
+        }
+
+        // Sessions shorter than one chunk have no committed text yet, so
+        // their tail is decoded whenever it contains enough speech.
+        if (!decoded && !audio_buffer.empty() && audio_buffer.size() >= static_cast<size_t>(MIN_SPEECH_MS) * 16 &&
+            (transcription_started || speech_ms > MIN_SPEECH_MS))
+        {
+            if (!transcription_started || audio_buffer.size() >= TRANSCRIPTION_CHUNK_SIZE / 2)
+            {
+                say(OutputKind::Diagnostic) << "🔄 ";
+                admission->admit(AdmissionController::Kind::Final); // never refused
+                final_text = decodeCommitted(audio_buffer, DecodePriority::Final);
+                decoded = true;
             }
             else
             {
                 if (!quiet_mode)
                 {
-                    std::cout << "[skipping final chunk - too small] " << std::flush;
+                    say(OutputKind::Diagnostic) << "[skipping final chunk - too small] ";
                 }
             }
         }
 
+        if (!final_text.empty())
+        {
+            if (!transcription_started)
+            {
+                say(OutputKind::Decoration) << "\n" << prefix << "Transcription: ";
+                transcription_started = true;
+            }
+            current_transcription += final_text;
+            say(OutputKind::Partial) << final_text;
+        }
+
+        double latency_ms = 0.0;
+        double finalize_ms = 0.0;
+        if (decoded)
+        {
+            auto now = std::chrono::steady_clock::now();
+            latency_ms = std::chrono::duration<double, std::milli>(now - last_speech_time).count();
+            finalize_ms = std::chrono::duration<double, std::milli>(now - finalize_start).count();
+            latency_sessions++;
+            latency_total_ms += latency_ms;
+            stats.final_latency_ms.push_back(latency_ms);
+            StageLatency::global().record(Stage::Final, latency_ms);
+            say(OutputKind::Diagnostic) << "\n" << prefix << "[latency] end of speech -> final text: " << (int)latency_ms << " ms (silence window "
+                                        << (int)(latency_ms - finalize_ms) << " ms + " << (speculative_hit ? "speculative " : "decode ")
+                                        << (int)finalize_ms << " ms), mean " << (int)(latency_total_ms / latency_sessions)
+                                        << " ms over " << latency_sessions << " session(s)";
+        }
+
+        std::string clean_text;
         if (transcription_started)
         {
-            std::string clean_text = current_transcription;
+            clean_text = current_transcription;
 
             size_t pos = 0;
             while ((pos = clean_text.find("  ", pos)) != std::string::npos)
@@ -465,12 +955,20 @@ public:
             clean_text.erase(0, clean_text.find_first_not_of(" "));
             clean_text.erase(clean_text.find_last_not_of(" ") + 1);
 
-            std::cout << "\n\nComplete transcription:\n\"" << clean_text << "\"" << std::endl;
+            say(OutputKind::Final, clean_text) << "\n\n" << prefix << "Complete transcription:\n\"" << clean_text << "\"\n";
+
+            double session_lost_ms = capture_gaps.lostBetween(session_origin, frame_end + 1);
+            if (session_lost_ms > 0)
+                say(OutputKind::Status) << prefix << "[warning] " << (int)session_lost_ms
+                                        << " ms of audio were lost during capture; the transcription may be missing words\n";
 
             float duration = (float)recorded_samples / 16000.0f;
-            std::cout << "Audio: " << duration << "s, Words: " << std::count(clean_text.begin(), clean_text.end(), ' ') + 1 << std::endl;
+            say(OutputKind::Decoration) << "Audio: " << duration << "s, Words: " << std::count(clean_text.begin(), clean_text.end(), ' ') + 1 << "\n";
         }
 
+        if (events.on_final)
+            events.on_final(clean_text, recorded_samples / 16000.0, latency_ms, finalize_ms, speculative_hit);
+
         audio_buffer.clear();
         current_transcription.clear();
         transcription_started = false;
@@ -486,105 +984,340 @@ public:
 
     void startStreaming()
     {
-        std::cout << "\n=== Real-time Whisper Transcriber Started (C API) ===" << std::endl;
-        std::cout << "Say '" << hotword << "' to start real-time transcription..." << std::endl;
-        std::cout << "Audio will be transcribed using Whisper as you speak." << std::endl;
-        std::cout << "Stop speaking for ~2 seconds to end transcription." << std::endl;
-        std::cout << "Press Ctrl+C to exit.\n"
-                  << std::endl;
-
-        std::vector<short> samples;
-        int loop_count = 0;
+        Tracer::global().nameThread(prefix + "capture");
+        say(OutputKind::Decoration) << "\n" << prefix << "=== Real-time Whisper Transcriber Started (C API) ===\n";
+        say(OutputKind::Decoration) << "Say '" << hotword << "' to start real-time transcription...\n";
+        say(OutputKind::Decoration) << "Audio will be transcribed using Whisper as you speak.\n";
+        if (endpointer.adaptive())
+            say(OutputKind::Decoration) << "Stop speaking to end transcription (pause length adapts to your speech).\n";
+        else
+            say(OutputKind::Decoration) << "Stop speaking for ~" << endpointer.silenceWindowMs() / 1000.0 << " seconds to end transcription.\n";
+        say(OutputKind::Decoration) << "Press Ctrl+C to exit.\n\n";
+
+        // Blocks stay owned by the source (a shared-memory ring hands out
+        // its own pages), and the framer passes whole frames through
+        const short *samples = nullptr;
+        size_t n = 0;
+        auto started = std::chrono::steady_clock::now();
+        std::string settings = source->settings();
+        if (!settings.empty())
+            say(OutputKind::Status) << prefix << "Audio input " << source->name() << ": " << settings << "\n";
+
+        // Frame k (counting from 0) ends at sample (k + 1) * frame size of the
+        // stream; samples within a block are taken to be 1/16 ms apart, as
+        // from a device (replays faster than real time read low)
+        const size_t frame_samples = framer.frameSamples();
+        long long samples_in = 0;
+        long long frames_out = 0;
+        long long overruns = 0;
+
+        auto next_block = [&]
+        {
+            TraceScope trace("capture wait");
+            return source->next(samples, n);
+        };
+        while (next_block())
+        {
+            stats.audio_seconds += n / 16000.0;
+            Metrics::global().audio_seconds.add(n / 16000.0);
+            if (source->overruns() != overruns)
+            {
+                Metrics::global().capture_overruns.add(static_cast<uint64_t>(source->overruns() - overruns));
+                overruns = source->overruns();
+            }
+            auto block_captured = source->blockCaptured();
+            bool stamped = block_captured.time_since_epoch().count() != 0;
+            if (recorder)
+                recorder->block(samples, n, block_captured, source->lostSamples());
+            double lost_ms = capture_gaps.block(n, block_captured, source->lostSamples());
+            if (lost_ms > 0)
+            {
+                stats.capture_gaps++;
+                stats.capture_lost_ms += lost_ms;
+                Metrics::global().capture_gaps.add();
+                Metrics::global().capture_lost_seconds.add(lost_ms / 1000.0);
+                if (!quiet_mode)
+                    say(OutputKind::Diagnostic) << "[capture gap: " << (int)lost_ms << " ms of audio lost] ";
+            }
+            if (stamped)
+                StageLatency::global().record(Stage::Capture, block_captured);
+            framer.push(samples, n, [&](const short *frame)
+                        {
+                            frame_number = frames_out++;
+                            frame_end = frames_out * static_cast<long long>(frame_samples);
+                            if (stamped)
+                            {
+                                long long newest = frames_out * static_cast<long long>(frame_samples) - 1 - samples_in;
+                                frame_captured = block_captured + std::chrono::microseconds(newest * 1000000 / 16000);
+                                frame_gap.record(std::chrono::duration<double, std::milli>(
+                                                     std::chrono::steady_clock::now() - frame_captured)
+                                                     .count());
+                            }
+                            else
+                            {
+                                frame_captured = {};
+                            }
+                            processFrame(frame);
+                        });
+            samples_in += static_cast<long long>(n);
+        }
 
-        while (true)
+        // File, pipe and network sources end; flush a session that was still open
+        if (is_listening)
         {
-            audio_in->read(samples);
+            say(OutputKind::Status) << "\n" << prefix << "End of stream. Finalizing transcription...\n";
+            finalizeTranscription();
+            endSession();
+        }
 
-            if (!is_listening)
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        {
+            OutputChannel::Line input = say(OutputKind::Diagnostic);
+            input << "\n" << prefix << "[input] " << source->name() << ": " << stats.audio_seconds << " s of audio in "
+                  << wall << " s (" << (wall > 0 ? stats.audio_seconds / wall : 0.0) << "x real time)";
+            if (source->captureLatency().measured())
             {
-                auto detection_result = detector->RunDetection(samples.data(), samples.size(), false);
+                CaptureLatency::Summary latency = source->captureLatency().summary();
+                input << ", capture latency p50 " << latency.p50_ms << " ms, p99 " << latency.p99_ms << " ms, max "
+                      << latency.max_ms << " ms";
+            }
+            if (capture_gaps.count() > 0)
+                input << ", lost " << (int)capture_gaps.lostMs() << " ms in " << capture_gaps.count() << " gap(s)";
+            input << "\n";
+        }
+        if (recorder)
+        {
+            OutputChannel::Line line = say(OutputKind::Status);
+            line << prefix << "[record] " << recorder->seconds() << " s of audio in " << recorder->blockCount() << " blocks written to "
+                 << recorder->file();
+            if (recorder->droppedRecords() > 0)
+                line << " (" << recorder->droppedRecords() << " records dropped: disk too slow, replay will differ)";
+            line << "\n";
+        }
+        if (replay)
+            say(OutputKind::Status) << prefix << "[replay] " << replay->hotwordCount() << " recorded hotword(s); live VAD disagreed on "
+                                    << replay->vadMismatches() << " of " << replay->vadFrames() << " frames\n";
+        printCaptureGap();
+        OutputChannel::global().flush();
+    }
 
-                if (++loop_count % 100 == 0)
-                {
-                    std::cout << "." << std::flush;
-                }
+    const StreamStats &streamStats() const { return stats; }
 
-                if (detection_result > 0)
-                {
-                    std::cout << "\nHOTWORD DETECTED! Starting real-time transcription..." << std::endl;
-                    is_listening = true;
-                    audio_buffer.clear();
-                    silence_counter = 0;
-                    speech_counter = 0;
-                    current_transcription.clear();
-                    transcription_started = false;
-                    recorded_samples = 0;
-                    loop_count = 0;
-                    resetChunkCounter();
-                }
-            }
-            else
-            {
-                audio_buffer.insert(audio_buffer.end(), samples.begin(), samples.end());
-                recorded_samples += samples.size();
+    void startSession()
+    {
+        is_listening = true;
+        stats.sessions++;
+        Metrics::global().sessions.add();
+        monitor->setSessionActive(true);
+        audio_buffer.clear();
+        silence_ms = 0;
+        speech_ms = 0;
+        current_transcription.clear();
+        transcription_started = false;
+        recorded_samples = 0;
+        session_origin = frame_end;
+        session_allocations = MemoryStats::allocations();
+        session_buffer_peak = 0;
+        idle_ms = 0;
+        deferred_size = 0;
+        session_id++;
+        spec_submitted_origin = -1;
+        spec_submitted_length = 0;
+        spec_submitted_speech_ms = 0;
+        last_speech_time = std::chrono::steady_clock::now();
+        vad->reset();
+        endpointer.reset();
+        resetChunkCounter();
+    }
 
-                auto vad_result = vad->RunVad(samples.data(), samples.size());
+    void endSession()
+    {
+        is_listening = false;
+        monitor->setSessionActive(false);
+        if (monitor->droppedFrames() > 0 && !quiet_mode)
+        {
+            say(OutputKind::Diagnostic) << "[hotword monitor dropped " << monitor->droppedFrames() << " frames so far]\n";
+        }
+        if (!quiet_mode)
+        {
+            printCaptureGap();
+            printSessionMemory();
+        }
+    }
 
-                if (vad_result == -2)
-                {
-                    silence_counter++;
-                    if (silence_counter % 20 == 0)
-                    {
-                        std::cout << "." << std::flush;
-                    }
-                }
-                else
-                {
-                    silence_counter = 0;
-                    speech_counter++;
-                    if (speech_counter % 10 == 0)
-                    {
-                        std::cout << "*" << std::flush;
-                    }
+    // Time from a sample's capture to the hotword detector (on its own
+    // thread) and to the VAD/endpointing path, for tuning capture buffers
+    void printCaptureGap()
+    {
+        CaptureLatency::Summary detector_gap = monitor->detectorGap();
+        if (!frame_gap.measured() || detector_gap.blocks == 0)
+            return;
+        CaptureLatency::Summary vad_gap = frame_gap.summary();
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                      "%s[latency] capture -> detector p50 %.1f ms, p99 %.1f ms, max %.1f ms; capture -> VAD p50 %.1f ms, "
+                      "p99 %.1f ms\n",
+                      prefix.c_str(), detector_gap.p50_ms, detector_gap.p99_ms, detector_gap.max_ms, vad_gap.p50_ms,
+                      vad_gap.p99_ms);
+        say(OutputKind::Diagnostic) << line;
+    }
 
-                    if (speech_counter > MIN_SPEECH_LENGTH / 2048)
-                    {
-                        processAudioChunk();
-                    }
-                }
+    // Allocations are counted process-wide (and only in builds with
+    // WAKE2TEXT_COUNT_ALLOCATIONS), so they cover everything the process
+    // did during this session, other streams included
+    void printSessionMemory()
+    {
+        char line[224];
+        if (MemoryStats::countingAllocations())
+        {
+            MemoryStats::Allocations a = MemoryStats::allocations().since(session_allocations);
+            std::snprintf(line, sizeof(line),
+                          "%s[memory] session: audio buffer peak %.1f KB; process during session: %llu allocations (%.1f KB), live %+lld\n",
+                          prefix.c_str(), session_buffer_peak * sizeof(short) / 1024.0, a.count, a.bytes / 1024.0, a.live());
+        }
+        else
+        {
+            std::snprintf(line, sizeof(line), "%s[memory] session: audio buffer peak %.1f KB\n", prefix.c_str(),
+                          session_buffer_peak * sizeof(short) / 1024.0);
+        }
+        say(OutputKind::Diagnostic) << line;
+    }
 
-                if (audio_buffer.size() >= TRANSCRIPTION_CHUNK_SIZE)
-                {
-                    if (!quiet_mode)
-                    {
-                        std::cout << "[buffer full, processing...] " << std::flush;
-                    }
-                    processAudioChunk();
-                }
+    void processFrame(const short *frame)
+    {
+        TraceScope trace("processFrame");
+        const int n = static_cast<int>(framer.frameSamples());
+        const int frame_ms = framer.frameMs();
 
-                if (silence_counter >= SILENCE_THRESHOLD)
-                {
-                    std::cout << "\nSilence detected. Finalizing transcription..." << std::endl;
-                    finalizeTranscription();
+        if (!is_listening || barge_in)
+        {
+            monitor->push(frame, frame_captured);
+        }
 
-                    is_listening = false;
-                    std::cout << "\nReady for next command. Say '" << hotword << "' to start transcription..." << std::endl;
-                }
+        bool detected = monitor->takeDetection();
+        if (replay)
+        {
+            detected = replay->hotwordAt(frame_number);
+            if (detected && is_listening)
+                cancel_generation++;
+        }
+        if (detected)
+        {
+            if (recorder)
+                recorder->hotword(frame_number);
+            Metrics::global().hotword_triggers.add();
+            if (is_listening)
+            {
+                // Barge-in: in-flight Whisper work has already been told to
+                // abort; drop this session's audio and start over
+                OutputChannel::Line hotword_line = say(OutputKind::Status);
+                hotword_line << "\n" << prefix << "HOTWORD DETECTED AGAIN! Discarding current session";
+                if (!current_transcription.empty())
+                    hotword_line << " (" << current_transcription.size() << " chars of text)";
+                hotword_line << " and restarting...\n";
+            }
+            else
+            {
+                say(OutputKind::Status) << "\n" << prefix << "HOTWORD DETECTED! Starting real-time transcription...\n";
+            }
+            if (events.on_hotword)
+                events.on_hotword(is_listening);
+            startSession();
+            return;
+        }
 
-                if (audio_buffer.size() > 16000 * 60)
-                {
-                    std::cout << "\nWARNING: Maximum listening time reached (60s). Stopping..." << std::endl;
-                    finalizeTranscription();
-                    is_listening = false;
-                }
+        if (!is_listening)
+        {
+            idle_ms += frame_ms;
+            if (idle_ms >= 12800)
+            {
+                idle_ms = 0;
+                say(OutputKind::Diagnostic) << ".";
             }
+            return;
         }
-    }
-};
 
-void print_usage()
-{
-    std::cout << "Usage: wake2text [options]" << std::endl;
+        audio_buffer.insert(audio_buffer.end(), frame, frame + n);
+        recorded_samples += n;
+        if (audio_buffer.size() > session_buffer_peak)
+        {
+            session_buffer_peak = audio_buffer.size();
+            MemoryStats::global().noteBuffer(MemoryBuffer::SessionAudio, session_buffer_peak * sizeof(short));
+        }
+
+        bool is_speech;
+        {
+            TraceScope trace_vad("vad");
+            is_speech = vad->isSpeech(frame, n);
+        }
+        if (replay)
+            is_speech = replay->vadAt(frame_number, is_speech);
+        if (recorder)
+            recorder->vad(frame_number, is_speech);
+        if (frame_captured.time_since_epoch().count() != 0)
+            StageLatency::global().record(Stage::Vad, frame_captured);
+        bool endpoint = endpointer.update(is_speech, frame_ms);
+
+        if (!is_speech)
+        {
+            silence_ms += frame_ms;
+            if (silence_ms % 2500 < frame_ms)
+            {
+                say(OutputKind::Diagnostic) << ".";
+            }
+        }
+        else
+        {
+            silence_ms = 0;
+            speech_ms += frame_ms;
+            last_speech_time = std::chrono::steady_clock::now();
+            if (speech_ms % 1250 < frame_ms)
+            {
+                say(OutputKind::Diagnostic) << "*";
+            }
+
+            if (speech_ms > MIN_SPEECH_MS)
+            {
+                processAudioChunk();
+            }
+        }
+
+        if (audio_buffer.size() >= TRANSCRIPTION_CHUNK_SIZE)
+        {
+            if (!quiet_mode && deferred_size == 0)
+            {
+                say(OutputKind::Diagnostic) << "[buffer full, processing...] ";
+            }
+            processAudioChunk();
+        }
+
+        if (speculative_enabled && !endpoint)
+        {
+            pollSpeculative();
+            submitSpeculative();
+        }
+
+        if (endpoint)
+        {
+            say(OutputKind::Status) << "\n" << prefix << "Silence detected (" << endpointer.silenceMs() << " ms, window "
+                                    << endpointer.silenceWindowMs() << " ms). Finalizing transcription...\n";
+            finalizeTranscription();
+
+            endSession();
+            say(OutputKind::Status) << "\n" << prefix << "Ready for next command. Say '" << hotword << "' to start transcription...\n";
+        }
+        else if (audio_buffer.size() > static_cast<size_t>(MAX_SESSION_MS) * 16)
+        {
+            say(OutputKind::Status) << "\n" << prefix << "WARNING: Maximum listening time reached (" << MAX_SESSION_MS / 1000 << "s). Stopping...\n";
+            finalizeTranscription();
+            endSession();
+        }
+    }
+};
+
+void print_usage()
+{
+    std::cout << "Usage: wake2text [options]" << std::endl;
     std::cout << "\nOptions:" << std::endl;
     std::cout << "  --help              Show this help message and exit" << std::endl;
     std::cout << "  --model=<path>      Path to hotword model file (.pmdl or .umdl)" << std::endl;
@@ -593,10 +1326,997 @@ void print_usage()
     std::cout << "  --gpu               Enable GPU acceleration (requires CUDA)" << std::endl;
     std::cout << "  --ngl=<n>           Number of GPU layers to offload (default: 0 = CPU only)" << std::endl;
     std::cout << "  --quiet, -q         Quiet mode (minimal output)" << std::endl;
+    std::cout << "  --vad=<engine>      Voice activity detector: snowboy (default), energy, whisper" << std::endl;
+    std::cout << "  --vad-model=<path>  Silero model for --vad=whisper (e.g. ggml-silero-v5.1.2.bin)" << std::endl;
+    std::cout << "  --vad-bench=<path>  Benchmark all VAD engines on a WAV file or directory and exit" << std::endl;
+    std::cout << "  --endpoint=<mode>   End-of-utterance policy: adaptive (default) or fixed" << std::endl;
+    std::cout << "  --endpoint-min-ms=<n>  Silence window once the transcript looks complete (default: 300)" << std::endl;
+    std::cout << "  --endpoint-max-ms=<n>  Longest silence window; fixed mode always uses it (default: 2000)" << std::endl;
+    std::cout << "  --grammar=<file>    Command phrases (one per line, '*' = any words) that end a session early" << std::endl;
+    std::cout << "  --frame-ms=<n>      Analysis frame size for hotword/VAD: 10, 20 (default) or 30" << std::endl;
+    std::cout << "  --no-speculative    Disable background decoding of the utterance tail while speaking" << std::endl;
+    std::cout << "  --barge-in-cpu=<f>  CPU share (0-1) for hotword detection during sessions (default: 0.25)" << std::endl;
+    std::cout << "  --no-barge-in       Do not listen for the hotword while transcribing" << std::endl;
+    std::cout << "  --server            Run several streams in one process sharing one Whisper model" << std::endl;
+    std::cout << "  --input=<source>    Audio input: pulse (default), pulse-async, alsa[:device], - (raw s16le 16 kHz mono" << std::endl;
+    std::cout << "                      on stdin), a named pipe or .raw file of the same, synth:sine|noise|silence[:secs]," << std::endl;
+    std::cout << "                      shm:<name> (shared-memory ring, Linux), replay:<recording> or a .wav file" << std::endl;
+    std::cout << "  --record=<file>     Record the input and the hotword/VAD decisions for replay:<file> (single stream)" << std::endl;
+    std::cout << "  --period-ms=<n>     Capture period: the block size requested from the device or server" << std::endl;
+    std::cout << "  --buffer-ms=<n>     Capture buffer: how much the device or server may queue" << std::endl;
+    std::cout << "  --latency=<preset>  Capture period preset: low (10 ms), balanced (20 ms), default, powersave (200 ms)" << std::endl;
+    std::cout << "  --pa-fragsize=<bytes>   PulseAudio fragment size (overrides the period; 640 B = 20 ms)" << std::endl;
+    std::cout << "  --pa-maxlength=<bytes>  PulseAudio maximum queued bytes (overrides the buffer)" << std::endl;
+    std::cout << "  --capture-test=<source>  Capture 5 s and report block size, capture latency and CPU (Linux)" << std::endl;
+    std::cout << "  --ingest-bench=<s>  Compare the shared-memory ring and every capture backend for s seconds and exit (Linux)" << std::endl;
+    std::cout << "  --stream=<name>=<source>  Add a server stream; source is as for --input" << std::endl;
+    std::cout << "  --whisper-states=<n>  Pooled Whisper inference states (default: 2)" << std::endl;
+    std::cout << "  --whisper-threads=<n> Threads per Whisper decode (default: cores/2, or cores/states in server mode)" << std::endl;
+    std::cout << "  --replay-speed=<x>  Pace for .wav/.raw files: 1 = real time (default), 0 = as fast as possible" << std::endl;
+    std::cout << "  --beam=<n>          Beam search with n beams (default: 5; 1 = greedy)" << std::endl;
+    std::cout << "  --fallback-model=<path>  Smaller Whisper model to switch to when inference falls behind" << std::endl;
+    std::cout << "  --max-pending=<n>   Global cap on queued decodes before interim work is refused (default: 2 x states)" << std::endl;
+    std::cout << "  --deadline-factor=<x>  Decode deadline as a multiple of the audio it covers (default: 1.0)" << std::endl;
+    std::cout << "  --no-degrade        Never degrade decoding under overload" << std::endl;
+    std::cout << "  --listen=<port>     Serve the local WebSocket/HTTP API on 127.0.0.1:<port> (Linux)" << std::endl;
+    std::cout << "  --batch-max=<n>     Server: decode up to n streams' chunks together (default: 1 = off)" << std::endl;
+    std::cout << "  --batch-window-ms=<n>  Server: how long a chunk may wait for others to join its batch (default: 50)" << std::endl;
+    std::cout << "  --batch-bench=<wav> Benchmark batching throughput vs added latency and exit" << std::endl;
+    std::cout << "  --batch-clients=<n> Concurrent clients for --batch-bench (default: 4)" << std::endl;
+    std::cout << "  --metrics-port=<port>  Serve Prometheus metrics at http://127.0.0.1:<port>/metrics (Linux)" << std::endl;
+    std::cout << "  --metrics-file=<path>  Rewrite Prometheus metrics to <path> every 5 s (textfile collector)" << std::endl;
+    std::cout << "  --output=<mode>     Console output: human (default), json (one JSON object per line) or quiet (final text only)" << std::endl;
+    std::cout << "  --decode-log=<file> Append one JSON line of Whisper timings per decode (- = stderr)" << std::endl;
+    std::cout << "  --trace=<file.json> Record a Chrome trace-event timeline of the pipeline (chrome://tracing, Perfetto)" << std::endl;
     std::cout << "\nExamples:" << std::endl;
     std::cout << "  wake2text                          Use default hotword model with auto language detection" << std::endl;
     std::cout << "  wake2text --model=custom.pmdl      Use custom hotword model" << std::endl;
     std::cout << "  wake2text --lang=en --gpu          Use English language with GPU acceleration" << std::endl;
+    std::cout << "  wake2text --server --stream=kitchen=pulse --stream=replay=rec.wav" << std::endl;
+    std::cout << "  arecord -f S16_LE -r 16000 -c 1 -t raw | wake2text --input=-" << std::endl;
+}
+
+// Reference end of speech for a benchmark file: "<file>.eos" holding the
+// time in milliseconds if present, otherwise the last 10 ms frame whose RMS
+// exceeds a fixed gate (independent of the engines being compared).
+size_t reference_speech_end(const std::string &path, const std::vector<short> &audio)
+{
+    std::ifstream eos_file(path + ".eos");
+    long long eos_ms = 0;
+    if (eos_file >> eos_ms)
+    {
+        return std::min(audio.size(), static_cast<size_t>(eos_ms * 16));
+    }
+
+    const size_t FRAME = 160;
+    const double GATE_RMS = 300.0;
+    size_t end = 0;
+    for (size_t off = 0; off + FRAME <= audio.size(); off += FRAME)
+    {
+        long long sum_squares = 0;
+        for (size_t i = off; i < off + FRAME; i++)
+        {
+            sum_squares += (long long)audio[i] * audio[i];
+        }
+        if (sqrt((double)sum_squares / FRAME) > GATE_RMS)
+        {
+            end = off + FRAME;
+        }
+    }
+    return end;
+}
+
+// Replays WAV files through every VAD engine using the live read size and
+// endpointing policy, reporting CPU cost per second of audio and endpoint latency.
+int run_vad_benchmark(const std::string &path, const std::string &vad_model, const EndpointConfig &endpoint, int frame_ms)
+{
+    std::vector<std::string> files;
+    if (std::filesystem::is_directory(path))
+    {
+        for (const auto &entry : std::filesystem::directory_iterator(path))
+        {
+            if (entry.path().extension() == ".wav")
+                files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+    }
+    else
+    {
+        files.push_back(path);
+    }
+    if (files.empty())
+    {
+        throw std::runtime_error("No .wav files found in " + path);
+    }
+
+    std::vector<WavData> corpus;
+    std::vector<size_t> speech_end;
+    double audio_seconds = 0.0;
+    for (const auto &file : files)
+    {
+        corpus.push_back(read_wav_file(file));
+        speech_end.push_back(reference_speech_end(file, corpus.back().samples));
+        audio_seconds += corpus.back().samples.size() / 16000.0;
+    }
+
+    const size_t BLOCK = 2048; // typical PulseAudio read size, re-framed like live capture
+
+    std::cout << "[vad-bench] " << files.size() << " file(s), " << audio_seconds << " s of audio" << std::endl;
+    std::cout << "engine    cpu_ms/s  endpoints  early  missed  latency_mean_ms  latency_max_ms" << std::endl;
+
+    for (const std::string kind : {"snowboy", "energy", "whisper"})
+    {
+        if (kind == "whisper" && vad_model.empty())
+        {
+            std::cout << "whisper   (skipped: pass --vad-model=<path>)" << std::endl;
+            continue;
+        }
+        std::unique_ptr<VadEngine> engine = make_vad_engine(kind, "resources/common.res", vad_model);
+
+        double cpu_seconds = 0.0;
+        int endpoints = 0, early = 0, missed = 0;
+        double latency_sum_ms = 0.0, latency_max_ms = 0.0;
+
+        for (size_t f = 0; f < corpus.size(); f++)
+        {
+            const std::vector<short> &audio = corpus[f].samples;
+            engine->reset();
+            Endpointer endpointer(endpoint);
+            AudioFramer framer(frame_ms);
+            bool fired = false;
+            size_t position = 0;
+
+            auto on_frame = [&](const short *frame)
+            {
+                position += framer.frameSamples();
+                if (fired)
+                    return;
+                bool speech = engine->isSpeech(frame, framer.frameSamples());
+                if (!endpointer.update(speech, framer.frameMs()))
+                    return;
+
+                if (position < speech_end[f])
+                {
+                    // Would have cut the utterance short; keep listening
+                    early++;
+                    endpointer.reset();
+                    return;
+                }
+                double latency_ms = (position - speech_end[f]) / 16.0;
+                latency_sum_ms += latency_ms;
+                latency_max_ms = std::max(latency_max_ms, latency_ms);
+                endpoints++;
+                fired = true;
+            };
+
+            std::clock_t cpu_start = std::clock();
+            for (size_t off = 0; off < audio.size() && !fired; off += BLOCK)
+            {
+                framer.push(audio.data() + off, std::min(BLOCK, audio.size() - off), on_frame);
+            }
+            cpu_seconds += (double)(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+            if (!fired)
+                missed++;
+        }
+
+        char line[160];
+        snprintf(line, sizeof(line), "%-9s %8.2f  %9d  %5d  %6d  %15.1f  %14.1f",
+                 kind.c_str(), cpu_seconds * 1000.0 / audio_seconds, endpoints, early, missed,
+                 endpoints ? latency_sum_ms / endpoints : 0.0, latency_max_ms);
+        std::cout << line << std::endl;
+    }
+    return 0;
+}
+
+// Finds ggml-large-v3.bin in the project's models/ or whisper.cpp/models/
+std::string locate_whisper_model()
+{
+    std::filesystem::path base = std::filesystem::path(detect_project_root());
+    std::filesystem::path large_v3_project = base / "models" / "ggml-large-v3.bin";
+    std::filesystem::path large_v3_whisper = base / "whisper.cpp" / "models" / "ggml-large-v3.bin";
+
+    std::string whisper_model_path;
+    if (std::filesystem::exists(large_v3_project))
+    {
+        whisper_model_path = std::filesystem::absolute(large_v3_project).string();
+    }
+    else if (std::filesystem::exists(large_v3_whisper))
+    {
+        whisper_model_path = std::filesystem::absolute(large_v3_whisper).string();
+    }
+    else
+    {
+        std::string msg = "Required model ggml-large-v3.bin not found. Checked:\n  " + (large_v3_project.string()) + "\n  " + (large_v3_whisper.string()) +
+                          "\nYou can download it with: whisper.cpp\\models\\download-ggml-model.cmd large-v3";
+        throw std::runtime_error(msg);
+    }
+
+#ifdef _WIN32
+    for (auto &c : whisper_model_path)
+        if (c == '/')
+            c = '\\';
+#endif
+    return whisper_model_path;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+struct ServerOptions
+{
+    int ngl = 0;
+    int whisper_states = 0;  // 0 = 2, or the batch size when batching
+    int whisper_threads = 0; // 0 = cores / states
+    AudioSourceOptions audio;
+    int batch_window_ms = 50;
+    int batch_max = 1; // 1 = no cross-session batching
+    std::string fallback_model; // smaller model for overload, e.g. ggml-base.en.bin
+    int max_pending = 0;        // 0 = 2 x states
+    double deadline_factor = 1.0;
+    bool degrade = true;
+};
+
+std::shared_ptr<WhisperEngine> make_server_engine(const ServerOptions &server)
+{
+    int states = server.whisper_states > 0 ? server.whisper_states : std::max(2, server.batch_max);
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    int threads = server.whisper_threads > 0 ? server.whisper_threads : static_cast<int>(std::max(1u, hw / states));
+    return std::make_shared<WhisperEngine>(locate_whisper_model(), server.ngl > 0, states, threads);
+}
+
+// Engine, optional fallback model and batch scheduler, plus the admission
+// controller every decode goes through
+SharedInference make_shared_inference(const ServerOptions &server, std::shared_ptr<WhisperEngine> engine, bool beam)
+{
+    SharedInference shared;
+    shared.engine = std::move(engine);
+    Metrics::global().model_load_seconds.set(shared.engine->loadMs() / 1000.0);
+    if (!server.fallback_model.empty())
+    {
+        shared.fallback = std::make_shared<WhisperEngine>(server.fallback_model, server.ngl > 0, shared.engine->stateCount(),
+                                                          shared.engine->threadsPerDecode());
+    }
+    if (server.batch_max > 1)
+    {
+        shared.batcher = std::make_shared<BatchScheduler>(shared.engine, server.batch_window_ms, server.batch_max);
+    }
+
+    AdmissionController::Config config;
+    config.max_pending = server.max_pending > 0 ? server.max_pending : 2 * shared.engine->stateCount();
+    config.deadline_factor = server.deadline_factor;
+    config.max_level = server.degrade ? AdmissionController::SMALL_MODEL : AdmissionController::NORMAL;
+    config.beam = beam;
+    config.fallback = shared.fallback != nullptr;
+    shared.admission = std::make_shared<AdmissionController>(config);
+    return shared;
+}
+
+void print_admission_summary(const std::string &tag, AdmissionController &admission)
+{
+    AdmissionController::Counters c = admission.snapshot();
+    std::cout << tag << " admission: " << c.admitted << " decodes (" << c.finals << " final), deadline misses "
+              << c.deadline_misses << ", level " << c.level << " (max " << c.max_level_reached << "), escalations "
+              << c.escalations << ", recoveries " << c.recoveries << std::endl;
+    std::cout << tag << " degraded: interim dropped " << c.interim_dropped << ", speculative dropped "
+              << c.speculative_dropped << ", queue full " << c.queue_full << ", greedy " << c.greedy_decodes
+              << ", fallback model " << c.fallback_decodes << std::endl;
+}
+
+const DecodePriority ALL_PRIORITIES[] = {DecodePriority::Final, DecodePriority::Interim, DecodePriority::Background};
+
+void print_priority_summary(const std::string &tag, WhisperEngine &engine)
+{
+    for (DecodePriority priority : ALL_PRIORITIES)
+    {
+        PriorityMetrics::Class c = engine.metrics().snapshot(priority);
+        std::printf("%s %-10s decodes %5lld  wait mean %7.1f ms  p50 %7.1f  p90 %7.1f  max %7.1f  decode mean %7.1f ms"
+                    "  promoted %lld  preempted %lld\n",
+                    tag.c_str(), priority_name(priority), c.count, c.count ? c.wait_total_ms / c.count : 0.0,
+                    percentile(c.recent_waits, 0.5), percentile(c.recent_waits, 0.9), c.wait_max_ms,
+                    c.count ? c.decode_total_ms / c.count : 0.0, c.promoted, c.preempted);
+    }
+    std::fflush(stdout);
+}
+
+std::string priority_json(WhisperEngine &engine)
+{
+    std::string json = "{";
+    for (DecodePriority priority : ALL_PRIORITIES)
+    {
+        PriorityMetrics::Class c = engine.metrics().snapshot(priority);
+        if (json.size() > 1)
+            json += ",";
+        json += "\"" + std::string(priority_name(priority)) + "\":{\"decodes\":" + std::to_string(c.count) +
+                ",\"wait_mean_ms\":" + std::to_string(c.count ? c.wait_total_ms / c.count : 0.0) +
+                ",\"wait_p90_ms\":" + std::to_string(percentile(c.recent_waits, 0.9)) +
+                ",\"wait_max_ms\":" + std::to_string(c.wait_max_ms) + ",\"promoted\":" + std::to_string(c.promoted) +
+                ",\"preempted\":" + std::to_string(c.preempted) + "}";
+    }
+    return json + "}";
+}
+
+std::string admission_json(AdmissionController &admission)
+{
+    AdmissionController::Counters c = admission.snapshot();
+    return "{\"level\":" + std::to_string(c.level) + ",\"max_level\":" + std::to_string(c.max_level_reached) +
+           ",\"pending\":" + std::to_string(c.pending) + ",\"admitted\":" + std::to_string(c.admitted) +
+           ",\"finals\":" + std::to_string(c.finals) + ",\"deadline_misses\":" + std::to_string(c.deadline_misses) +
+           ",\"interim_dropped\":" + std::to_string(c.interim_dropped) + ",\"speculative_dropped\":" +
+           std::to_string(c.speculative_dropped) + ",\"queue_full\":" + std::to_string(c.queue_full) +
+           ",\"greedy_decodes\":" + std::to_string(c.greedy_decodes) + ",\"fallback_decodes\":" +
+           std::to_string(c.fallback_decodes) + ",\"escalations\":" + std::to_string(c.escalations) +
+           ",\"recoveries\":" + std::to_string(c.recoveries) + "}";
+}
+
+// Server mode: every stream gets its own detector, VAD and buffers on its
+// own capture thread, while all of them share one loaded Whisper model and
+// a fixed pool of inference states.
+int run_server(const TranscriberOptions &base, const std::vector<std::pair<std::string, std::string>> &streams,
+               const ServerOptions &server)
+{
+    if (streams.empty())
+    {
+        throw std::runtime_error("Server mode needs at least one --stream=NAME=SOURCE");
+    }
+
+    SharedInference shared = make_shared_inference(server, make_server_engine(server), base.beam_size > 1);
+    WhisperEngine *engine = shared.engine.get();
+    BatchScheduler *batcher = shared.batcher.get();
+
+    std::cout << "[server] Whisper model loaded once in " << (int)engine->loadMs() << " ms; " << engine->stateCount()
+              << " state(s) x " << engine->threadsPerDecode() << " threads shared by " << streams.size() << " stream(s)"
+              << std::endl;
+    if (batcher)
+    {
+        std::cout << "[server] Batching committed chunks: window " << batcher->windowMs() << " ms, up to "
+                  << batcher->maxBatch() << " per batch" << std::endl;
+    }
+
+    std::vector<std::unique_ptr<WhisperStreamingTranscriber>> transcribers;
+    for (const auto &stream : streams)
+    {
+        TranscriberOptions options = base;
+        options.stream_name = stream.first;
+        transcribers.push_back(std::make_unique<WhisperStreamingTranscriber>(
+            options, shared, make_audio_source(stream.second, server.audio)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (auto &transcriber : transcribers)
+    {
+        WhisperStreamingTranscriber *t = transcriber.get();
+        workers.emplace_back([t]()
+                             {
+                                 try
+                                 {
+                                     t->startStreaming();
+                                 }
+                                 catch (const std::exception &e)
+                                 {
+                                     std::cerr << "Stream error: " << e.what() << std::endl;
+                                 }
+                             });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    StreamStats total;
+    for (const auto &transcriber : transcribers)
+    {
+        const StreamStats &st = transcriber->streamStats();
+        total.audio_seconds += st.audio_seconds;
+        total.sessions += st.sessions;
+        total.decodes += st.decodes;
+        total.decode_ms += st.decode_ms;
+        total.decoded_audio_seconds += st.decoded_audio_seconds;
+        total.state_wait_ms += st.state_wait_ms;
+        total.capture_gaps += st.capture_gaps;
+        total.capture_lost_ms += st.capture_lost_ms;
+        total.final_latency_ms.insert(total.final_latency_ms.end(), st.final_latency_ms.begin(), st.final_latency_ms.end());
+    }
+
+    std::cout << "\n[server] streams: " << streams.size() << ", wall: " << wall_seconds << " s, audio: "
+              << total.audio_seconds << " s, throughput: " << (wall_seconds > 0 ? total.audio_seconds / wall_seconds : 0.0)
+              << "x real time" << std::endl;
+    std::cout << "[server] decodes: " << total.decodes << ", decode RTF: "
+              << (total.decoded_audio_seconds > 0 ? total.decode_ms / 1000.0 / total.decoded_audio_seconds : 0.0)
+              << ", mean state wait: " << (total.decodes ? total.state_wait_ms / total.decodes : 0.0) << " ms" << std::endl;
+    if (total.capture_gaps > 0)
+        std::cout << "[server] capture gaps: " << total.capture_gaps << ", audio lost: " << (int)total.capture_lost_ms << " ms"
+                  << std::endl;
+    std::cout << "[server] end of speech -> final text over " << total.final_latency_ms.size() << " session(s): p50 "
+              << (int)percentile(total.final_latency_ms, 0.5) << " ms, p90 " << (int)percentile(total.final_latency_ms, 0.9)
+              << " ms, max " << (int)percentile(total.final_latency_ms, 1.0) << " ms" << std::endl;
+    if (batcher)
+    {
+        BatchScheduler::Stats bs = batcher->snapshot();
+        std::cout << "[server] batches: " << bs.batches << ", mean size: "
+                  << (bs.batches ? static_cast<double>(bs.jobs) / bs.batches : 0.0) << ", mean added wait: "
+                  << (bs.jobs ? bs.queue_wait_ms / bs.jobs : 0.0) << " ms, max " << (int)bs.max_queue_wait_ms << " ms"
+                  << std::endl;
+    }
+    print_admission_summary("[server]", *shared.admission);
+    print_priority_summary("[server]", *shared.engine);
+    return 0;
+}
+
+// Batching benchmark: `clients` threads each decode consecutive 3 s chunks
+// of a WAV file back to back through the batch scheduler, once per
+// (window, batch size) setting, and report decode throughput against the
+// latency the batching window adds. The first row is the unbatched baseline.
+int run_batch_benchmark(const std::string &path, int clients, const ServerOptions &server)
+{
+    WavData wav = read_wav_file(path);
+    const size_t chunk_samples = 3 * 16000;
+    std::vector<std::vector<float>> chunks;
+    for (size_t pos = 0; pos + chunk_samples / 2 <= wav.samples.size(); pos += chunk_samples)
+    {
+        size_t n = std::min(chunk_samples, wav.samples.size() - pos);
+        std::vector<float> chunk(n);
+        for (size_t i = 0; i < n; i++)
+            chunk[i] = wav.samples[pos + i] / 32768.0f;
+        chunks.push_back(std::move(chunk));
+    }
+    if (chunks.empty())
+    {
+        throw std::runtime_error("Benchmark file is shorter than 1.5 s: " + path);
+    }
+
+    clients = std::max(1, clients);
+    ServerOptions sized = server;
+    if (sized.whisper_states <= 0)
+        sized.whisper_states = clients;
+    auto engine = make_server_engine(sized);
+    const int rounds = std::max(1, 8 / static_cast<int>(chunks.size()));
+
+    std::cout << "Batch benchmark: " << path << ", " << chunks.size() << " chunk(s) x " << rounds << " round(s) per client, "
+              << clients << " client(s), " << engine->stateCount() << " state(s), "
+              << engine->threadsPerDecode() * engine->stateCount() << " threads\n"
+              << std::endl;
+    std::printf("%-8s %-6s %10s %10s %12s %12s %12s\n", "window", "batch", "mean size", "xRT", "wait mean", "wait p90",
+                "chunk p90");
+
+    std::vector<std::pair<int, int>> settings = {{0, 1}, {0, clients}, {25, clients}, {50, clients}, {100, clients}, {200, clients}};
+    if (server.batch_max > 1)
+        settings.emplace_back(server.batch_window_ms, server.batch_max);
+
+    for (const auto &setting : settings)
+    {
+        BatchScheduler scheduler(engine, setting.first, setting.second);
+        std::mutex results_mutex;
+        std::vector<double> waits, totals;
+        double audio_seconds = 0.0;
+
+        auto client = [&](int c)
+        {
+            for (int r = 0; r < rounds; r++)
+            {
+                for (size_t k = 0; k < chunks.size(); k++)
+                {
+                    // Stagger clients so they do not submit the same chunk in lockstep
+                    const std::vector<float> &chunk = chunks[(k + c) % chunks.size()];
+                    auto submitted = std::chrono::steady_clock::now();
+                    double wait = scheduler.run([&](struct whisper_state *state, int n_threads)
+                                                {
+                                                    struct whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+                                                    params.n_threads = n_threads;
+                                                    params.language = "en";
+                                                    params.print_progress = false;
+                                                    whisper_full_with_state(engine->context(), state, params, chunk.data(),
+                                                                            static_cast<int>(chunk.size()));
+                                                });
+                    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitted).count();
+
+                    std::lock_guard<std::mutex> lock(results_mutex);
+                    waits.push_back(wait);
+                    totals.push_back(total);
+                    audio_seconds += chunk.size() / 16000.0;
+                }
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int c = 0; c < clients; c++)
+        {
+            workers.emplace_back(client, c);
+        }
+        for (auto &worker : workers)
+            worker.join();
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        BatchScheduler::Stats bs = scheduler.snapshot();
+        double mean_wait = 0.0;
+        for (double w : waits)
+            mean_wait += w;
+        mean_wait = waits.empty() ? 0.0 : mean_wait / waits.size();
+
+        std::printf("%-8d %-6d %10.2f %10.2f %12.1f %12.1f %12.1f\n", setting.first, scheduler.maxBatch(),
+                    bs.batches ? static_cast<double>(bs.jobs) / bs.batches : 0.0, wall > 0 ? audio_seconds / wall : 0.0,
+                    mean_wait, percentile(waits, 0.9), percentile(totals, 0.9));
+    }
+
+    std::cout << "\nxRT: decoded audio per wall second; wait: queue time before the chunk's batch started (ms);"
+              << "\nchunk: submit to result (ms)" << std::endl;
+    return 0;
+}
+
+#ifdef __linux__
+struct IngestResult
+{
+    long long blocks = 0;
+    double audio_seconds = 0.0;
+    double cpu_ms = 0.0; // reading thread
+    std::vector<double> block_ms;
+    CaptureLatency::Summary latency; // blocks == 0 when the source has no capture timestamps
+};
+
+// Drains a source through the framer for the given duration, timing the
+// reading thread's CPU. Producer-side and sound-server CPU is not included.
+IngestResult drain_source(AudioSource &source, double seconds)
+{
+    IngestResult result;
+    AudioFramer framer(10);
+    long long frames = 0;
+    timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+    const short *data = nullptr;
+    size_t n = 0;
+    while (result.audio_seconds < seconds && source.next(data, n))
+    {
+        result.blocks++;
+        result.audio_seconds += n / 16000.0;
+        result.block_ms.push_back(n / 16.0);
+        framer.push(data, n, [&frames](const short *)
+                    { frames++; });
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    result.cpu_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000.0 + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e6;
+    result.latency = source.captureLatency().summary();
+    return result;
+}
+
+void print_ingest_results(const std::vector<std::pair<std::string, IngestResult>> &results)
+{
+    std::printf("\n%-14s %8s %10s %12s %12s %12s %10s\n", "source", "blocks", "block ms", "latency p50", "latency p99",
+                "latency max", "CPU %");
+    for (const auto &entry : results)
+    {
+        const IngestResult &r = entry.second;
+        double cpu_share = r.audio_seconds > 0 ? r.cpu_ms / (r.audio_seconds * 10.0) : 0.0;
+        if (r.latency.blocks == 0)
+        {
+            std::printf("%-14s %8lld %10.1f %12s %12s %12s %10.3f\n", entry.first.c_str(), r.blocks,
+                        percentile(r.block_ms, 0.5), "n/a", "n/a", "n/a", cpu_share);
+        }
+        else
+        {
+            std::printf("%-14s %8lld %10.1f %12.2f %12.2f %12.2f %10.3f\n", entry.first.c_str(), r.blocks,
+                        percentile(r.block_ms, 0.5), r.latency.p50_ms, r.latency.p99_ms, r.latency.max_ms, cpu_share);
+        }
+    }
+    std::cout << "\nblock ms: median block delivered per read; latency: age of a block's oldest sample when"
+              << "\nthe transcriber gets it (ms); CPU %: reading thread CPU per second of audio" << std::endl;
+}
+
+// Captures from one source for a few seconds and reports its block size,
+// capture latency and reading cost
+int run_capture_test(const std::string &spec, const AudioSourceOptions &options, double seconds)
+{
+    std::unique_ptr<AudioSource> source = make_audio_source(spec, options);
+    std::cout << "Capturing " << seconds << " s from " << source->name() << "..." << std::endl;
+    std::vector<std::pair<std::string, IngestResult>> results;
+    results.emplace_back(source->name(), drain_source(*source, seconds));
+    print_ingest_results(results);
+    return 0;
+}
+
+// Compares ingestion through a shared-memory ring (fed by a forked producer
+// writing 10 ms blocks in real time) with every capture backend that opens
+int run_ingest_benchmark(double seconds, const AudioSourceOptions &options)
+{
+    seconds = std::max(1.0, seconds);
+    std::cout << "Ingestion benchmark: " << seconds << " s per source" << std::endl;
+
+    std::vector<std::pair<std::string, IngestResult>> results;
+    long long overruns = 0, waits = 0;
+    double producer_cpu_ms = 0.0;
+    {
+        ShmRingWriter writer;
+        ShmAudioSource source(writer.path());
+
+        pid_t producer = fork();
+        if (producer < 0)
+            throw std::runtime_error("fork failed");
+        if (producer == 0)
+        {
+            const size_t BLOCK = 160;
+            std::vector<short> block(BLOCK);
+            size_t total = static_cast<size_t>((seconds + 0.5) * 16000);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t pos = 0; pos < total; pos += BLOCK)
+            {
+                for (size_t i = 0; i < BLOCK; i++)
+                    block[i] = static_cast<short>(8000 * std::sin((pos + i) * 2 * M_PI * 440 / 16000));
+                std::this_thread::sleep_until(start + std::chrono::microseconds((pos + BLOCK) * 1000000 / 16000));
+                writer.write(block.data(), BLOCK);
+            }
+            writer.finish();
+            _exit(0);
+        }
+
+        results.emplace_back("shm ring", drain_source(source, seconds));
+        overruns = source.ringStats().overrun_samples;
+        waits = source.ringStats().waits;
+
+        int status = 0;
+        waitpid(producer, &status, 0);
+        struct rusage usage;
+        if (getrusage(RUSAGE_CHILDREN, &usage) == 0)
+            producer_cpu_ms = usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 +
+                              usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+    }
+
+    for (const char *spec : {"pulse", "pulse-async", "alsa"})
+    {
+        try
+        {
+            std::unique_ptr<AudioSource> source = make_audio_source(spec, options);
+            results.emplace_back(source->name(), drain_source(*source, seconds));
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << spec << " skipped: " << e.what() << std::endl;
+        }
+    }
+
+    print_ingest_results(results);
+    std::cout << "Ring: " << waits << " futex sleeps, " << overruns << " overrun samples, producer "
+              << producer_cpu_ms << " ms CPU." << std::endl;
+    return 0;
+}
+#endif
+
+#ifdef __linux__
+// One-shot decode of an uploaded WAV file or raw 16 kHz s16le body; returns
+// the JSON response body
+std::string transcribe_upload(const SharedInference &shared, const std::string &language, const std::string &body)
+{
+    std::vector<short> pcm;
+    if (is_wav_data(body))
+    {
+        pcm = parse_wav_bytes(body).samples;
+    }
+    else
+    {
+        pcm.resize(body.size() / 2);
+        std::memcpy(pcm.data(), body.data(), pcm.size() * 2);
+    }
+    std::vector<float> audio(pcm.size());
+    for (size_t i = 0; i < pcm.size(); i++)
+        audio[i] = pcm[i] / 32768.0f;
+
+    // Uploads count as final decodes: never refused, but they follow the
+    // overload policy like any other
+    bool use_fallback = shared.fallback && shared.admission->level() >= AdmissionController::SMALL_MODEL;
+    WhisperEngine &engine = use_fallback ? *shared.fallback : *shared.engine;
+    shared.admission->admit(AdmissionController::Kind::Final);
+    if (use_fallback)
+        shared.admission->noteFallback();
+
+    std::string segments;
+    std::string text;
+    int rc = 0;
+    auto decode = [&](struct whisper_state *state, int n_threads)
+    {
+        struct whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+        params.language = language.c_str();
+        params.n_threads = n_threads;
+        params.print_progress = false;
+        DecodeProbe probe;
+        if (DecodeLog::global().enabled() || Tracer::global().enabled())
+            probe.attach(params);
+        probe.begin();
+        rc = whisper_full_with_state(engine.context(), state, params, audio.data(), static_cast<int>(audio.size()));
+        probe.finish();
+        StageLatency::global().record(Stage::Whisper, probe.wallMs());
+        trace_decode(probe, static_cast<long long>(audio.size()));
+        DecodeRecord record;
+        record.stream = "upload";
+        record.priority = priority_name(DecodePriority::Final);
+        record.audio_ms = audio.size() / 16.0;
+        record.threads = n_threads;
+        record.ok = rc == 0;
+        DecodeLog::global().write(record, probe, state);
+        if (rc != 0)
+            return;
+        Metrics::global().noteDecode(audio.size() / 16000.0, probe.wallMs());
+
+        const int n = whisper_full_n_segments_from_state(state);
+        for (int i = 0; i < n; i++)
+        {
+            std::string segment = whisper_full_get_segment_text_from_state(state, i);
+            segment.erase(0, segment.find_first_not_of(" \t\n\r"));
+            segments += std::string(segments.empty() ? "" : ",") + "{\"t0_ms\":" +
+                        std::to_string(whisper_full_get_segment_t0_from_state(state, i) * 10) + ",\"t1_ms\":" +
+                        std::to_string(whisper_full_get_segment_t1_from_state(state, i) * 10) + ",\"text\":\"" +
+                        json_escape(segment) + "\"}";
+            if (!segment.empty())
+                text += (text.empty() ? "" : " ") + segment;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    double wait_ms = 0.0;
+    Metrics::global().queue_depth.add(1);
+    if (shared.batcher && !use_fallback)
+    {
+        wait_ms = shared.batcher->run(decode, DecodePriority::Final);
+    }
+    else
+    {
+        WhisperEngine::Lease lease = engine.acquire(DecodePriority::Final);
+        wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        decode(lease.get(), engine.threadsPerDecode());
+    }
+    double decode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    Metrics::global().queue_depth.add(-1);
+    shared.admission->complete(wait_ms, decode_ms - wait_ms, pcm.size() / 16.0);
+    shared.engine->metrics().record(DecodePriority::Final, wait_ms, decode_ms - wait_ms);
+    StageLatency::global().record(Stage::Queue, wait_ms);
+    if (rc != 0)
+        throw std::runtime_error("Whisper transcription failed");
+
+    return "{\"text\":\"" + json_escape(text) + "\",\"segments\":[" + segments + "],\"timings\":{\"audio_ms\":" +
+           std::to_string(static_cast<long long>(pcm.size() / 16)) + ",\"decode_ms\":" +
+           std::to_string(static_cast<long long>(decode_ms)) + "}}";
+}
+
+// Local API server on 127.0.0.1:<port>.
+//
+//   WebSocket /stream    binary messages: raw 16 kHz mono s16le PCM
+//                        text message {"type":"end"}: flush and finalize
+//                        events out: ready, hotword, partial, final, error
+//   POST /transcribe     WAV or raw s16le body, JSON transcript back
+//   GET /health          connection and session counts
+//
+// A WebSocket connection gets its transcriber (detector, VAD, buffers and
+// threads) only when its first audio arrives, so idle connections cost a
+// socket and nothing else. All transcribers share one Whisper engine.
+int run_api_server(const TranscriberOptions &base, const ServerOptions &server, int port, StageLatencyReporter &reporter)
+{
+    SharedInference shared = make_shared_inference(server, make_server_engine(server), base.beam_size > 1);
+    WhisperEngine *engine = shared.engine.get();
+
+    struct Worker
+    {
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+    struct ApiSession
+    {
+        std::shared_ptr<PushAudioSource::Channel> channel;
+        std::shared_ptr<Worker> worker;
+        bool odd_byte = false; // the previous message ended mid-sample
+        char carry = 0;
+    };
+
+    // Only touched on the event loop thread
+    std::map<StreamServer::ConnectionId, ApiSession> sessions;
+    std::vector<std::shared_ptr<Worker>> workers;
+    std::atomic<int> active_sessions{0};
+    StreamServer *api = nullptr;
+
+    auto reap = [&]()
+    {
+        for (auto it = workers.begin(); it != workers.end();)
+        {
+            if ((*it)->finished.load())
+            {
+                (*it)->thread.join();
+                it = workers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    };
+
+    auto start_session = [&](StreamServer::ConnectionId id) -> ApiSession &
+    {
+        ApiSession &session = sessions[id];
+        session.channel = std::make_shared<PushAudioSource::Channel>();
+        session.worker = std::make_shared<Worker>();
+        workers.push_back(session.worker);
+
+        TranscriberOptions options = base;
+        options.stream_name = "ws" + std::to_string(id);
+        options.events.on_hotword = [api, id](bool barge_in)
+        {
+            api->sendText(id, std::string("{\"type\":\"hotword\",\"barge_in\":") + (barge_in ? "true" : "false") + "}");
+        };
+        options.events.on_partial = [api, id](const std::string &text)
+        {
+            api->sendText(id, "{\"type\":\"partial\",\"text\":\"" + json_escape(text) + "\"}");
+        };
+        options.events.on_final = [api, id](const std::string &text, double audio_seconds, double latency_ms,
+                                            double finalize_ms, bool speculative)
+        {
+            api->sendText(id, "{\"type\":\"final\",\"text\":\"" + json_escape(text) + "\",\"timings\":{\"audio_ms\":" +
+                                  std::to_string(static_cast<long long>(audio_seconds * 1000)) + ",\"latency_ms\":" +
+                                  std::to_string(static_cast<long long>(latency_ms)) + ",\"finalize_ms\":" +
+                                  std::to_string(static_cast<long long>(finalize_ms)) + ",\"speculative\":" +
+                                  (speculative ? "true" : "false") + "}}");
+        };
+
+        std::shared_ptr<PushAudioSource::Channel> channel = session.channel;
+        std::shared_ptr<Worker> worker = session.worker;
+        worker->thread = std::thread([=, &shared, &active_sessions]()
+                                     {
+                                         active_sessions++;
+                                         try
+                                         {
+                                             WhisperStreamingTranscriber transcriber(
+                                                 options, shared, std::make_unique<PushAudioSource>(channel, options.stream_name));
+                                             transcriber.startStreaming();
+                                         }
+                                         catch (const std::exception &e)
+                                         {
+                                             api->sendText(id, "{\"type\":\"error\",\"message\":\"" + json_escape(e.what()) + "\"}");
+                                         }
+                                         active_sessions--;
+                                         worker->finished = true;
+                                     });
+        return session;
+    };
+
+    auto end_session = [&](StreamServer::ConnectionId id)
+    {
+        auto it = sessions.find(id);
+        if (it == sessions.end())
+            return;
+        it->second.channel->close(); // the transcriber finalizes and its thread exits
+        sessions.erase(it);
+    };
+
+    StreamServer::Handler handler;
+    handler.on_open = [&](StreamServer::ConnectionId id, const std::string &)
+    {
+        reap();
+        api->sendText(id, "{\"type\":\"ready\",\"sample_rate\":16000,\"format\":\"s16le\",\"channels\":1}");
+    };
+    handler.on_binary = [&](StreamServer::ConnectionId id, const char *data, size_t size)
+    {
+        auto it = sessions.find(id);
+        ApiSession &session = it != sessions.end() ? it->second : start_session(id);
+
+        // Messages need not be sample aligned; an odd trailing byte is
+        // carried over to the next message
+        std::vector<short> samples((size + (session.odd_byte ? 1 : 0)) / 2);
+        char *out = reinterpret_cast<char *>(samples.data());
+        size_t bytes = samples.size() * 2;
+        size_t consumed = 0;
+        if (bytes > 0)
+        {
+            if (session.odd_byte)
+            {
+                out[0] = session.carry;
+                std::memcpy(out + 1, data, bytes - 1);
+                consumed = bytes - 1;
+            }
+            else
+            {
+                std::memcpy(out, data, bytes);
+                consumed = bytes;
+            }
+            session.odd_byte = false;
+        }
+        if (consumed < size)
+        {
+            session.odd_byte = true;
+            session.carry = data[size - 1];
+        }
+        session.channel->push(samples.data(), samples.size());
+    };
+    handler.on_text = [&](StreamServer::ConnectionId id, const std::string &text)
+    {
+        if (text.find("\"end\"") != std::string::npos)
+            end_session(id);
+    };
+    handler.on_close = [&](StreamServer::ConnectionId id)
+    {
+        end_session(id);
+        reap();
+    };
+    handler.on_post = [&](StreamServer::ConnectionId id, const std::string &path, std::string body)
+    {
+        reap();
+        if (path != "/transcribe")
+        {
+            api->sendHttp(id, 404, "{\"error\":\"not found\"}");
+            return;
+        }
+        auto worker = std::make_shared<Worker>();
+        workers.push_back(worker);
+        std::string language = base.language;
+        worker->thread = std::thread([=, &shared, body = std::move(body)]()
+                                     {
+                                         try
+                                         {
+                                             api->sendHttp(id, 200, transcribe_upload(shared, language, body));
+                                         }
+                                         catch (const std::exception &e)
+                                         {
+                                             api->sendHttp(id, 400, "{\"error\":\"" + json_escape(e.what()) + "\"}");
+                                         }
+                                         worker->finished = true;
+                                     });
+    };
+    handler.metrics = []
+    { return Metrics::global().registry.render(); };
+    handler.health = [&]()
+    {
+        return "\"sessions\":" + std::to_string(active_sessions.load()) + ",\"whisper_states\":" +
+               std::to_string(engine->stateCount()) + ",\"model_load_ms\":" +
+               std::to_string(static_cast<long long>(engine->loadMs())) + ",\"admission\":" + admission_json(*shared.admission) +
+               ",\"priority\":" + priority_json(*engine);
+    };
+
+    StreamServer server_loop(port, handler);
+    api = &server_loop;
+    std::cout << "[api] Listening on 127.0.0.1:" << port << " (WebSocket /stream, POST /transcribe, GET /health); "
+              << engine->stateCount() << " Whisper state(s) x " << engine->threadsPerDecode() << " threads" << std::endl;
+    // SIGINT/SIGTERM stop the loop; open sessions are then finalized and
+    // every worker is joined before returning
+    reporter.onStop([&server_loop]
+                    { server_loop.stop(); });
+    try
+    {
+        server_loop.run();
+    }
+    catch (...)
+    {
+        reporter.onStop({});
+        throw;
+    }
+    reporter.onStop({});
+    std::cout << "[api] Stopped; finishing " << sessions.size() << " open session(s)" << std::endl;
+
+    for (auto &entry : sessions)
+        entry.second.channel->close();
+    for (auto &worker : workers)
+        worker->thread.join();
+    return 0;
+}
+#endif
+
+// `--flag=<n>` with n > 0, for values where a silent fallback would be wrong
+static int parse_positive_ms(const std::string &arg, size_t value_at)
+{
+    int ms = 0;
+    try
+    {
+        ms = std::stoi(arg.substr(value_at));
+    }
+    catch (...)
+    {
+    }
+    if (ms <= 0)
+        throw std::runtime_error(arg.substr(0, value_at - 1) + " needs a positive number of milliseconds");
+    return ms;
 }
 
 int main(int argc, const char **argv)
@@ -606,14 +2326,26 @@ try
     SetConsoleOutputCP(65001);
     SetConsoleCP(65001);
 #endif
-    std::cout << "Real-time Whisper.cpp Transcriber (C API)" << std::endl;
-    std::cout << "=========================================" << std::endl;
-
-    std::string model_path;
-    std::string lang = "auto";
+    TranscriberOptions options;
+    options.language = "auto";
     int ngl = 0;
-    bool quiet = false;
     bool show_help = false;
+    std::string vad_bench_path;
+    bool server = false;
+    std::vector<std::pair<std::string, std::string>> streams;
+    ServerOptions server_options;
+    int listen_port = 0;
+    std::string batch_bench_path;
+    int batch_clients = 4;
+    std::string input = "pulse";
+    double ingest_bench_seconds = 0.0;
+    std::string capture_test;
+    std::string latency_preset;
+    int metrics_port = 0;
+    std::string metrics_file;
+    std::string trace_path;
+    std::string record_path;
+    OutputChannel::Mode output_mode = OutputChannel::Mode::Human;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -624,7 +2356,7 @@ try
         }
         else if (arg.rfind("--lang=", 0) == 0)
         {
-            lang = arg.substr(7);
+            options.language = arg.substr(7);
         }
         else if (arg == "--gpu")
         {
@@ -642,25 +2374,385 @@ try
         }
         else if (arg.rfind("--model=", 0) == 0)
         {
-            model_path = arg.substr(8);
+            options.hotword_model = arg.substr(8);
         }
         else if (arg == "--quiet" || arg == "-q")
         {
-            quiet = true;
+            options.quiet = true;
+        }
+        else if (arg.rfind("--vad=", 0) == 0)
+        {
+            options.vad_engine = arg.substr(6);
+        }
+        else if (arg.rfind("--vad-model=", 0) == 0)
+        {
+            options.vad_model = arg.substr(12);
+        }
+        else if (arg.rfind("--vad-bench=", 0) == 0)
+        {
+            vad_bench_path = arg.substr(12);
+        }
+        else if (arg == "--endpoint=fixed" || arg == "--endpoint=adaptive")
+        {
+            options.endpoint.adaptive = (arg == "--endpoint=adaptive");
+        }
+        else if (arg.rfind("--endpoint=", 0) == 0)
+        {
+            throw std::runtime_error("Unknown endpoint mode '" + arg.substr(11) + "' (expected adaptive or fixed)");
+        }
+        else if (arg.rfind("--endpoint-min-ms=", 0) == 0)
+        {
+            options.endpoint.min_silence_ms = parse_positive_ms(arg, 18);
+        }
+        else if (arg.rfind("--endpoint-max-ms=", 0) == 0)
+        {
+            options.endpoint.max_silence_ms = parse_positive_ms(arg, 18);
+        }
+        else if (arg.rfind("--grammar=", 0) == 0)
+        {
+            options.endpoint.grammar_path = arg.substr(10);
+        }
+        else if (arg == "--no-speculative")
+        {
+            options.speculative = false;
+        }
+        else if (arg == "--no-barge-in")
+        {
+            options.barge_in_share = 0.0;
+        }
+        else if (arg.rfind("--barge-in-cpu=", 0) == 0)
+        {
+            try
+            {
+                options.barge_in_share = std::stod(arg.substr(15));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--frame-ms=", 0) == 0)
+        {
+            try
+            {
+                options.frame_ms = std::stoi(arg.substr(11));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg == "--server")
+        {
+            server = true;
+        }
+        else if (arg.rfind("--stream=", 0) == 0)
+        {
+            // NAME=SOURCE, or just SOURCE (named after its position)
+            std::string spec = arg.substr(9);
+            size_t eq = spec.find('=');
+            if (eq == std::string::npos)
+                streams.emplace_back("stream" + std::to_string(streams.size() + 1), spec);
+            else
+                streams.emplace_back(spec.substr(0, eq), spec.substr(eq + 1));
+        }
+        else if (arg.rfind("--whisper-states=", 0) == 0)
+        {
+            try
+            {
+                server_options.whisper_states = std::stoi(arg.substr(17));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--whisper-threads=", 0) == 0)
+        {
+            try
+            {
+                server_options.whisper_threads = std::stoi(arg.substr(18));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--replay-speed=", 0) == 0)
+        {
+            try
+            {
+                server_options.audio.replay_speed = std::stod(arg.substr(15));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--batch-window-ms=", 0) == 0)
+        {
+            try
+            {
+                server_options.batch_window_ms = std::stoi(arg.substr(18));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--batch-max=", 0) == 0)
+        {
+            try
+            {
+                server_options.batch_max = std::stoi(arg.substr(12));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--beam=", 0) == 0)
+        {
+            try
+            {
+                options.beam_size = std::stoi(arg.substr(7));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--fallback-model=", 0) == 0)
+        {
+            server_options.fallback_model = arg.substr(17);
+        }
+        else if (arg.rfind("--max-pending=", 0) == 0)
+        {
+            try
+            {
+                server_options.max_pending = std::stoi(arg.substr(14));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--deadline-factor=", 0) == 0)
+        {
+            try
+            {
+                server_options.deadline_factor = std::stod(arg.substr(18));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg == "--no-degrade")
+        {
+            server_options.degrade = false;
+        }
+        else if (arg.rfind("--listen=", 0) == 0)
+        {
+            try
+            {
+                listen_port = std::stoi(arg.substr(9));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--input=", 0) == 0)
+        {
+            input = arg.substr(8);
+        }
+        else if (arg.rfind("--period-ms=", 0) == 0)
+        {
+            try
+            {
+                server_options.audio.period_ms = std::stoi(arg.substr(12));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--buffer-ms=", 0) == 0)
+        {
+            try
+            {
+                server_options.audio.buffer_ms = std::stoi(arg.substr(12));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--latency=", 0) == 0)
+        {
+            latency_preset = arg.substr(10);
+        }
+        else if (arg.rfind("--metrics-port=", 0) == 0)
+        {
+            try
+            {
+                metrics_port = std::stoi(arg.substr(15));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--metrics-file=", 0) == 0)
+        {
+            metrics_file = arg.substr(15);
+        }
+        else if (arg.rfind("--trace=", 0) == 0)
+        {
+            trace_path = arg.substr(8);
+        }
+        else if (arg.rfind("--record=", 0) == 0)
+        {
+            record_path = arg.substr(9);
+        }
+        else if (arg.rfind("--output=", 0) == 0)
+        {
+            output_mode = OutputChannel::parseMode(arg.substr(9));
+        }
+        else if (arg.rfind("--decode-log=", 0) == 0)
+        {
+            DecodeLog::global().open(arg.substr(13));
+        }
+        else if (arg.rfind("--pa-fragsize=", 0) == 0)
+        {
+            try
+            {
+                server_options.audio.pa_fragsize = static_cast<uint32_t>(std::stoul(arg.substr(14)));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--pa-maxlength=", 0) == 0)
+        {
+            try
+            {
+                server_options.audio.pa_maxlength = static_cast<uint32_t>(std::stoul(arg.substr(15)));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--capture-test=", 0) == 0)
+        {
+            capture_test = arg.substr(15);
+        }
+        else if (arg.rfind("--ingest-bench=", 0) == 0)
+        {
+            try
+            {
+                ingest_bench_seconds = std::stod(arg.substr(15));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--batch-bench=", 0) == 0)
+        {
+            batch_bench_path = arg.substr(14);
+        }
+        else if (arg.rfind("--batch-clients=", 0) == 0)
+        {
+            try
+            {
+                batch_clients = std::stoi(arg.substr(16));
+            }
+            catch (...)
+            {
+            }
+        }
+        else if (arg.rfind("--", 0) == 0)
+        {
+            throw std::runtime_error("Unknown option " + arg + " (see --help)");
         }
-        else if (model_path.empty())
+        else if (options.hotword_model.empty())
         {
-            model_path = arg;
+            options.hotword_model = arg;
         }
     }
 
+    if (options.endpoint.min_silence_ms > options.endpoint.max_silence_ms)
+    {
+        throw std::runtime_error("--endpoint-min-ms (" + std::to_string(options.endpoint.min_silence_ms) +
+                                 ") must not exceed --endpoint-max-ms (" + std::to_string(options.endpoint.max_silence_ms) + ")");
+    }
+
+    OutputChannel::global().setMode(output_mode);
+    if (output_mode == OutputChannel::Mode::Human)
+    {
+        std::cout << "Real-time Whisper.cpp Transcriber (C API)" << std::endl;
+        std::cout << "=========================================" << std::endl;
+    }
+
     if (show_help)
     {
         print_usage();
         return 0;
     }
 
-    WhisperStreamingTranscriber transcriber(model_path, lang, ngl, quiet);
+    if (!vad_bench_path.empty())
+    {
+        return run_vad_benchmark(vad_bench_path, options.vad_model, options.endpoint, options.frame_ms);
+    }
+
+    if (!latency_preset.empty())
+    {
+        apply_latency_preset(latency_preset, server_options.audio);
+    }
+
+    if (ingest_bench_seconds > 0)
+    {
+#ifdef __linux__
+        return run_ingest_benchmark(ingest_bench_seconds, server_options.audio);
+#else
+        throw std::runtime_error("--ingest-bench is only supported on Linux");
+#endif
+    }
+
+    if (!capture_test.empty())
+    {
+#ifdef __linux__
+        return run_capture_test(capture_test, server_options.audio, 5.0);
+#else
+        throw std::runtime_error("--capture-test is only supported on Linux");
+#endif
+    }
+
+    // Per-stage latency: SIGUSR1 prints it while running, and it is printed
+    // once more when the transcriber or server returns
+    StageLatencyReporter stage_reporter([]
+                                        { OutputChannel::global().flush(); });
+    MemoryStats::global().captureWhisperLog();
+    MemorySampler memory_sampler;
+    MetricsExporter metrics_exporter(metrics_port, metrics_file);
+    TraceWriter trace_writer(trace_path);
+
+    server_options.ngl = ngl;
+    if (!record_path.empty() && (server || listen_port > 0 || !batch_bench_path.empty()))
+        throw std::runtime_error("--record only works with a single stream");
+    if (!batch_bench_path.empty())
+    {
+        return run_batch_benchmark(batch_bench_path, batch_clients, server_options);
+    }
+
+    if (listen_port > 0)
+    {
+#ifdef __linux__
+        return run_api_server(options, server_options, listen_port, stage_reporter);
+#else
+        throw std::runtime_error("--listen is only supported on Linux");
+#endif
+    }
+
+    if (server)
+    {
+        return run_server(options, streams, server_options);
+    }
+
+    // One stream: a state for committed decodes plus one for speculation
+    int states = server_options.whisper_states > 0 ? server_options.whisper_states : (options.speculative ? 2 : 1);
+    SharedInference shared = make_shared_inference(
+        server_options, std::make_shared<WhisperEngine>(locate_whisper_model(), ngl > 0, states, server_options.whisper_threads),
+        options.beam_size > 1);
+    options.record_path = record_path;
+    WhisperStreamingTranscriber transcriber(options, shared, make_audio_source(input, server_options.audio));
     transcriber.startStreaming();
 
     return 0;
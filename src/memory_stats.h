@@ -0,0 +1,343 @@
+#pragma once
+
+/**
+ * Memory accounting for long-running deployments.
+ *
+ * Four sources, all cheap enough to stay on:
+ *
+ *   buffers      high-water marks of the audio buffers, recorded by the
+ *                code that fills them (one relaxed load and, rarely, a CAS)
+ *   whisper      model and per-state buffer sizes, parsed from whisper.cpp's
+ *                load log (it has no API for them); the log is still printed
+ *   allocations  operator new/delete calls, counted by the replacements in
+ *                alloc_counting.cpp when built with WAKE2TEXT_COUNT_ALLOCATIONS
+ *                (off by default); live = news - deletes, so a leak shows as
+ *                growth
+ *   rss          resident set size from /proc/self/statm, sampled every few
+ *                seconds by MemorySampler and kept for the last hour
+ *
+ * dump() prints all of it with the stage latencies (SIGUSR1 and exit);
+ * the same figures are exported as metrics.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#endif
+#include "whisper.h"
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+enum class MemoryBuffer
+{
+    SessionAudio, // samples of the current session awaiting transcription
+    Chunk,        // copy of the samples passed to one decode
+    FloatPcm,     // the same samples converted for whisper_full
+    Speculative,  // snapshot handed to the speculative decoder
+    COUNT
+};
+
+inline const char *memory_buffer_name(MemoryBuffer buffer)
+{
+    static const char *const names[] = {"session audio", "chunk", "float pcm", "speculative"};
+    return names[static_cast<int>(buffer)];
+}
+
+class MemoryStats
+{
+public:
+    struct Allocations
+    {
+        unsigned long long count = 0;
+        unsigned long long bytes = 0;
+        unsigned long long frees = 0;
+
+        long long live() const { return static_cast<long long>(count) - static_cast<long long>(frees); }
+
+        Allocations since(const Allocations &earlier) const
+        {
+            return {count - earlier.count, bytes - earlier.bytes, frees - earlier.frees};
+        }
+    };
+
+    struct RssSample
+    {
+        std::chrono::steady_clock::time_point time;
+        long long bytes;
+    };
+
+    static constexpr size_t RSS_HISTORY = 360;
+
+private:
+    std::array<std::atomic<long long>, static_cast<size_t>(MemoryBuffer::COUNT)> peaks{};
+
+    // Constant-initialized, so operator new can count before (and while)
+    // the singleton is constructed
+    static inline std::atomic<unsigned long long> alloc_count{0};
+    static inline std::atomic<unsigned long long> alloc_bytes{0};
+    static inline std::atomic<unsigned long long> free_count{0};
+
+    // Whisper sizes in bytes; written by the log callback during model load
+    std::mutex whisper_mutex;
+    std::string log_line;
+    double model_bytes = 0.0;
+    double backend_bytes = 0.0;
+    double state_bytes = 0.0;
+    int states = 0;
+
+    std::mutex rss_mutex;
+    std::deque<RssSample> rss;
+    long long rss_peak = 0;
+
+    // "whisper_init_state: compute buffer (encode) =   85.86 MB" -> bytes
+    static double sizeOf(const std::string &line)
+    {
+        size_t eq = line.rfind('=');
+        if (eq == std::string::npos || line.find("MB", eq) == std::string::npos)
+            return -1.0;
+        return std::atof(line.c_str() + eq + 1) * 1e6;
+    }
+
+    void parseWhisperLine(const std::string &line)
+    {
+        double bytes = sizeOf(line);
+        if (bytes < 0)
+            return;
+        if (line.rfind("whisper_model_load:", 0) == 0)
+        {
+            if (line.find("model size") != std::string::npos)
+                model_bytes += bytes;
+            else if (line.find("total size") != std::string::npos)
+                backend_bytes += bytes;
+        }
+        else if (line.rfind("whisper_init_state:", 0) == 0)
+        {
+            state_bytes += bytes;
+            if (line.find("kv self size") != std::string::npos)
+                states++;
+        }
+    }
+
+    static void onWhisperLog(enum ggml_log_level level, const char *text, void *data)
+    {
+        (void)level;
+        if (!text)
+            return;
+        std::fputs(text, stderr);
+        MemoryStats *self = static_cast<MemoryStats *>(data);
+        std::lock_guard<std::mutex> lock(self->whisper_mutex);
+        self->log_line += text;
+        size_t end;
+        while ((end = self->log_line.find('\n')) != std::string::npos)
+        {
+            self->parseWhisperLine(self->log_line.substr(0, end));
+            self->log_line.erase(0, end + 1);
+        }
+    }
+
+    static double mb(double bytes) { return bytes / 1e6; }
+
+public:
+    static MemoryStats &global()
+    {
+        static MemoryStats instance;
+        return instance;
+    }
+
+    void noteBuffer(MemoryBuffer buffer, size_t bytes)
+    {
+        std::atomic<long long> &peak = peaks[static_cast<size_t>(buffer)];
+        long long v = static_cast<long long>(bytes);
+        long long seen = peak.load(std::memory_order_relaxed);
+        while (v > seen && !peak.compare_exchange_weak(seen, v, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    long long bufferPeak(MemoryBuffer buffer) const { return peaks[static_cast<size_t>(buffer)].load(std::memory_order_relaxed); }
+
+    // Whether the operator new/delete replacements are linked in
+    static constexpr bool countingAllocations()
+    {
+#ifdef WAKE2TEXT_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Called from the global operator new/delete replacements
+    static void countAllocation(size_t bytes)
+    {
+        alloc_count.fetch_add(1, std::memory_order_relaxed);
+        alloc_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static void countFree() { free_count.fetch_add(1, std::memory_order_relaxed); }
+
+    static Allocations allocations()
+    {
+        return {alloc_count.load(std::memory_order_relaxed), alloc_bytes.load(std::memory_order_relaxed),
+                free_count.load(std::memory_order_relaxed)};
+    }
+
+    // Routes whisper.cpp's log through the size parser; call before loading
+    // a model. Messages are still printed to stderr as before.
+    void captureWhisperLog() { whisper_log_set(&MemoryStats::onWhisperLog, this); }
+
+    // Weights of every loaded model ("model size", or the per-backend
+    // buffer totals when the build only prints those)
+    double whisperModelBytes()
+    {
+        std::lock_guard<std::mutex> lock(whisper_mutex);
+        return model_bytes > 0 ? model_bytes : backend_bytes;
+    }
+
+    // KV caches and compute buffers summed over every state
+    double whisperStateBytes(int *count = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(whisper_mutex);
+        if (count)
+            *count = states;
+        return state_bytes;
+    }
+
+    // Current resident set size, or -1 where it cannot be read
+    static long long readRss()
+    {
+#ifdef __linux__
+        FILE *f = std::fopen("/proc/self/statm", "r");
+        if (!f)
+            return -1;
+        long long size = 0, resident = 0;
+        int fields = std::fscanf(f, "%lld %lld", &size, &resident);
+        std::fclose(f);
+        if (fields != 2)
+            return -1;
+        return resident * static_cast<long long>(sysconf(_SC_PAGESIZE));
+#else
+        return -1;
+#endif
+    }
+
+    void sampleRss()
+    {
+        long long bytes = readRss();
+        if (bytes < 0)
+            return;
+        std::lock_guard<std::mutex> lock(rss_mutex);
+        rss.push_back({std::chrono::steady_clock::now(), bytes});
+        if (rss.size() > RSS_HISTORY)
+            rss.pop_front();
+        rss_peak = std::max(rss_peak, bytes);
+    }
+
+    long long rssPeak()
+    {
+        std::lock_guard<std::mutex> lock(rss_mutex);
+        return rss_peak;
+    }
+
+    std::deque<RssSample> rssHistory()
+    {
+        std::lock_guard<std::mutex> lock(rss_mutex);
+        return rss;
+    }
+
+    // To stderr, next to the stage latency table
+    void dump(const char *reason)
+    {
+        sampleRss();
+        std::deque<RssSample> history = rssHistory();
+        if (history.empty() && !countingAllocations())
+            return;
+
+        std::fprintf(stderr, "\n[memory] accounting (%s)\n", reason);
+        if (!history.empty())
+        {
+            const RssSample &first = history.front();
+            const RssSample &last = history.back();
+            double minutes = std::chrono::duration<double>(last.time - first.time).count() / 60.0;
+            std::fprintf(stderr, "[memory] rss %.1f MB, peak %.1f MB, %+.1f MB over the last %.0f min (%zu samples)\n",
+                         mb(last.bytes), mb(rssPeak()), mb(last.bytes - first.bytes), minutes, history.size());
+        }
+        int n_states = 0;
+        double states_total = whisperStateBytes(&n_states);
+        double model = whisperModelBytes();
+        if (model > 0 || states_total > 0)
+            std::fprintf(stderr, "[memory] whisper model %.1f MB, %d state(s) %.1f MB (%.1f MB each)\n", mb(model), n_states,
+                         mb(states_total), n_states > 0 ? mb(states_total / n_states) : 0.0);
+        std::fprintf(stderr, "[memory] buffer peaks:");
+        for (int i = 0; i < static_cast<int>(MemoryBuffer::COUNT); i++)
+            std::fprintf(stderr, "%s %s %.1f KB", i ? "," : "", memory_buffer_name(static_cast<MemoryBuffer>(i)),
+                         bufferPeak(static_cast<MemoryBuffer>(i)) / 1024.0);
+        std::fprintf(stderr, "\n");
+        Allocations a = allocations();
+        if (countingAllocations())
+            std::fprintf(stderr, "[memory] allocations %llu (%.1f MB requested), frees %llu, live %lld\n", a.count,
+                         mb(static_cast<double>(a.bytes)), a.frees, a.live());
+        std::fflush(stderr);
+    }
+};
+
+// Samples RSS into MemoryStats::global() on its own thread from
+// construction to destruction
+class MemorySampler
+{
+private:
+    std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread worker;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        do
+        {
+            lock.unlock();
+            MemoryStats::global().sampleRss();
+            lock.lock();
+        } while (!cv.wait_for(lock, interval, [this]
+                              { return stopping; }));
+    }
+
+public:
+    explicit MemorySampler(std::chrono::milliseconds every = std::chrono::seconds(10)) : interval(every)
+    {
+        if (MemoryStats::readRss() >= 0)
+            worker = std::thread(&MemorySampler::run, this);
+    }
+
+    ~MemorySampler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    MemorySampler(const MemorySampler &) = delete;
+    MemorySampler &operator=(const MemorySampler &) = delete;
+};
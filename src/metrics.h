@@ -0,0 +1,322 @@
+#pragma once
+
+/**
+ * Process-wide metrics in the Prometheus text exposition format.
+ *
+ * Counters and gauges are registered once at startup and then updated
+ * with relaxed atomics, so recording from the capture, detector and decode
+ * threads takes no lock. render() walks the registry for a scrape; the
+ * per-stage latency histograms from stage_latency.h are exported alongside
+ * as summaries, and the memory accounting from memory_stats.h as gauges.
+ *
+ * MetricsExporter either rewrites a textfile-collector file every few
+ * seconds (write to a temporary file, then rename) or, on Linux, answers
+ * GET /metrics on a localhost port through StreamServer.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "stage_latency.h"
+#include "stream_server.h"
+
+class MetricCounter
+{
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// A double stored as its bit pattern; add() retries on contention
+class MetricGauge
+{
+private:
+    std::atomic<uint64_t> bits{0};
+
+    static uint64_t encode(double v)
+    {
+        uint64_t out;
+        std::memcpy(&out, &v, sizeof(out));
+        return out;
+    }
+
+    static double decode(uint64_t v)
+    {
+        double out;
+        std::memcpy(&out, &v, sizeof(out));
+        return out;
+    }
+
+public:
+    void set(double v) { bits.store(encode(v), std::memory_order_relaxed); }
+
+    void add(double delta)
+    {
+        uint64_t seen = bits.load(std::memory_order_relaxed);
+        while (!bits.compare_exchange_weak(seen, encode(decode(seen) + delta), std::memory_order_relaxed))
+        {
+        }
+    }
+
+    double get() const { return decode(bits.load(std::memory_order_relaxed)); }
+};
+
+class MetricsRegistry
+{
+private:
+    struct Entry
+    {
+        std::string name;
+        std::string help;
+        bool counter;
+        MetricCounter *count;
+        MetricGauge *gauge;
+    };
+
+    // Deques keep element addresses stable as metrics are added
+    std::mutex mutex;
+    std::deque<MetricCounter> counters;
+    std::deque<MetricGauge> gauges;
+    std::deque<Entry> entries;
+
+    static std::string format(double v)
+    {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9g", v);
+        return buf;
+    }
+
+public:
+    MetricCounter &counter(const std::string &name, const std::string &help)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.emplace_back();
+        entries.push_back({name, help, true, &counters.back(), nullptr});
+        return counters.back();
+    }
+
+    MetricGauge &gauge(const std::string &name, const std::string &help)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        gauges.emplace_back();
+        entries.push_back({name, help, false, nullptr, &gauges.back()});
+        return gauges.back();
+    }
+
+    // A counter of fractional amounts (seconds); only ever add() to it
+    MetricGauge &sum(const std::string &name, const std::string &help)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        gauges.emplace_back();
+        entries.push_back({name, help, true, nullptr, &gauges.back()});
+        return gauges.back();
+    }
+
+    std::string render()
+    {
+        std::ostringstream out;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const Entry &e : entries)
+            {
+                out << "# HELP " << e.name << " " << e.help << "\n";
+                out << "# TYPE " << e.name << (e.counter ? " counter\n" : " gauge\n");
+                out << e.name << " " << (e.count ? std::to_string(e.count->get()) : format(e.gauge->get())) << "\n";
+            }
+        }
+
+        out << "# HELP wake2text_stage_latency_seconds Latency per pipeline stage\n";
+        out << "# TYPE wake2text_stage_latency_seconds summary\n";
+        for (int i = 0; i < static_cast<int>(Stage::COUNT); i++)
+        {
+            Stage stage = static_cast<Stage>(i);
+            LatencyHistogram::Snapshot s = StageLatency::global().snapshot(stage);
+            std::string label = std::string("stage=\"") + stage_name(stage) + "\"";
+            const std::pair<const char *, double> quantiles[] = {{"0.5", s.p50_ms}, {"0.9", s.p90_ms}, {"0.99", s.p99_ms}};
+            for (const auto &q : quantiles)
+                out << "wake2text_stage_latency_seconds{" << label << ",quantile=\"" << q.first << "\"} "
+                    << format(q.second / 1000.0) << "\n";
+            out << "wake2text_stage_latency_seconds_sum{" << label << "} " << format(s.mean_ms * s.count / 1000.0) << "\n";
+            out << "wake2text_stage_latency_seconds_count{" << label << "} " << s.count << "\n";
+        }
+
+        MemoryStats &memory = MemoryStats::global();
+        long long rss = MemoryStats::readRss();
+        if (rss >= 0)
+        {
+            out << "# HELP wake2text_resident_memory_bytes Resident set size\n";
+            out << "# TYPE wake2text_resident_memory_bytes gauge\n";
+            out << "wake2text_resident_memory_bytes " << rss << "\n";
+        }
+        out << "# HELP wake2text_whisper_memory_bytes Whisper model weights and state buffers (KV caches, compute)\n";
+        out << "# TYPE wake2text_whisper_memory_bytes gauge\n";
+        out << "wake2text_whisper_memory_bytes{part=\"model\"} " << format(memory.whisperModelBytes()) << "\n";
+        out << "wake2text_whisper_memory_bytes{part=\"states\"} " << format(memory.whisperStateBytes()) << "\n";
+        out << "# HELP wake2text_buffer_peak_bytes High-water mark per audio buffer\n";
+        out << "# TYPE wake2text_buffer_peak_bytes gauge\n";
+        for (int i = 0; i < static_cast<int>(MemoryBuffer::COUNT); i++)
+        {
+            MemoryBuffer buffer = static_cast<MemoryBuffer>(i);
+            std::string label = memory_buffer_name(buffer);
+            std::replace(label.begin(), label.end(), ' ', '_');
+            out << "wake2text_buffer_peak_bytes{buffer=\"" << label << "\"} " << memory.bufferPeak(buffer) << "\n";
+        }
+        if (!MemoryStats::countingAllocations())
+            return out.str();
+        MemoryStats::Allocations a = MemoryStats::allocations();
+        out << "# HELP wake2text_allocations_total operator new calls\n";
+        out << "# TYPE wake2text_allocations_total counter\n";
+        out << "wake2text_allocations_total " << a.count << "\n";
+        out << "# HELP wake2text_live_allocations Allocations not yet freed\n";
+        out << "# TYPE wake2text_live_allocations gauge\n";
+        out << "wake2text_live_allocations " << a.live() << "\n";
+        return out.str();
+    }
+};
+
+// The metrics Wake2Text exports, registered in scrape order
+struct Metrics
+{
+    MetricsRegistry registry;
+
+    MetricCounter &hotword_triggers = registry.counter("wake2text_hotword_triggers_total", "Hotword detections, including barge-ins");
+    MetricCounter &sessions = registry.counter("wake2text_sessions_total", "Transcription sessions started");
+    MetricCounter &chunks_transcribed =
+        registry.counter("wake2text_chunks_transcribed_total", "Chunks decoded by Whisper (interim and final)");
+    MetricCounter &chunks_skipped =
+        registry.counter("wake2text_chunks_skipped_total", "Chunks skipped for lack of speech energy");
+    MetricCounter &hallucinations =
+        registry.counter("wake2text_hallucinations_filtered_total", "Segments dropped by the hallucination filter");
+    MetricCounter &capture_overruns =
+        registry.counter("wake2text_capture_overruns_total", "Times a capture source lost audio because the reader fell behind");
+    MetricCounter &capture_gaps =
+        registry.counter("wake2text_capture_gaps_total", "Discontinuities in captured audio (counted or inferred from timestamps)");
+    MetricGauge &capture_lost_seconds =
+        registry.sum("wake2text_capture_lost_seconds_total", "Seconds of audio lost to capture gaps");
+    MetricGauge &audio_seconds = registry.sum("wake2text_audio_seconds_total", "Seconds of audio captured");
+    MetricGauge &decoded_audio_seconds =
+        registry.sum("wake2text_decoded_audio_seconds_total", "Seconds of audio passed to whisper_full");
+    MetricGauge &decode_seconds = registry.sum("wake2text_decode_seconds_total", "Wall time spent in whisper_full");
+    MetricGauge &real_time_factor =
+        registry.gauge("wake2text_real_time_factor", "Decode time over audio duration of the most recent chunk");
+    MetricGauge &queue_depth =
+        registry.gauge("wake2text_inference_queue_depth", "Decodes waiting for or holding a Whisper state");
+    MetricGauge &model_load_seconds = registry.gauge("wake2text_model_load_seconds", "Time to load the Whisper model");
+
+    static Metrics &global()
+    {
+        static Metrics instance;
+        return instance;
+    }
+
+    // Call after each whisper_full
+    void noteDecode(double chunk_seconds, double decode_ms)
+    {
+        chunks_transcribed.add();
+        decoded_audio_seconds.add(chunk_seconds);
+        decode_seconds.add(decode_ms / 1000.0);
+        if (chunk_seconds > 0)
+            real_time_factor.set(decode_ms / 1000.0 / chunk_seconds);
+    }
+};
+
+class MetricsExporter
+{
+private:
+    std::string file;
+    int interval_ms;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+    std::thread writer;
+#ifdef __linux__
+    std::unique_ptr<StreamServer> server;
+    std::thread server_thread;
+#endif
+
+    void writeFile()
+    {
+        std::string tmp = file + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            if (!out)
+                return;
+            out << Metrics::global().registry.render();
+        }
+        std::rename(tmp.c_str(), file.c_str());
+    }
+
+    void writeLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            lock.unlock();
+            writeFile();
+            lock.lock();
+            if (cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]
+                            { return stop; }))
+                break;
+        }
+        lock.unlock();
+        writeFile();
+    }
+
+public:
+    // Either argument may be empty/0 to disable that exporter
+    MetricsExporter(int port, const std::string &textfile, int write_interval_ms = 5000)
+        : file(textfile), interval_ms(write_interval_ms)
+    {
+        if (port > 0)
+        {
+#ifdef __linux__
+            StreamServer::Handler handler;
+            handler.metrics = []
+            { return Metrics::global().registry.render(); };
+            server = std::make_unique<StreamServer>(port, std::move(handler));
+            server_thread = std::thread([this]
+                                        { server->run(); });
+#else
+            throw std::runtime_error("--metrics-port is only supported on Linux");
+#endif
+        }
+        if (!file.empty())
+            writer = std::thread(&MetricsExporter::writeLoop, this);
+    }
+
+    ~MetricsExporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        if (writer.joinable())
+            writer.join();
+#ifdef __linux__
+        if (server)
+        {
+            server->stop();
+            server_thread.join();
+        }
+#endif
+    }
+
+    MetricsExporter(const MetricsExporter &) = delete;
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+};
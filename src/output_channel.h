@@ -0,0 +1,389 @@
+#pragma once
+
+/**
+ * Asynchronous console output.
+ *
+ * The capture and decode threads never write to the terminal themselves:
+ * each message goes into a bounded lock-free queue and one writer thread
+ * prints whatever has accumulated with a single flush, so a slow terminal
+ * or pipe cannot stall audio. When the queue is full, diagnostics are
+ * dropped (and counted); transcripts and status lines go to a small
+ * overflow list instead and are never lost.
+ *
+ * Modes: human (the classic console output), json (one JSON object per
+ * line, no decoration) and quiet (final transcripts only, one per line).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class OutputKind
+{
+    Diagnostic, // progress markers and measurements; dropped under backpressure
+    Status,     // hotword, session and endpoint events
+    Decoration, // banners and headings; human mode only
+    Partial,    // text decoded while the user is speaking
+    Final       // complete transcription of a session
+};
+
+class OutputChannel
+{
+public:
+    enum class Mode
+    {
+        Human,
+        Json,
+        Quiet
+    };
+
+    // Builds one message with operator<< and queues it when destroyed
+    class Line
+    {
+    private:
+        OutputChannel &channel;
+        OutputKind kind;
+        std::string stream;
+        std::string payload;
+        std::ostringstream text;
+
+    public:
+        Line(OutputChannel &owner, OutputKind k, std::string stream_name, std::string payload_text)
+            : channel(owner), kind(k), stream(std::move(stream_name)), payload(std::move(payload_text))
+        {
+        }
+
+        ~Line() { channel.emit(kind, stream, text.str(), std::move(payload)); }
+
+        template <typename T>
+        Line &operator<<(const T &value)
+        {
+            text << value;
+            return *this;
+        }
+
+        Line(const Line &) = delete;
+        Line &operator=(const Line &) = delete;
+    };
+
+private:
+    struct Message
+    {
+        OutputKind kind = OutputKind::Diagnostic;
+        std::string stream;
+        std::string text;    // human rendering
+        std::string payload; // json/quiet text; empty = trimmed `text`
+    };
+
+    // Bounded MPMC queue (Vyukov): a slot is free for the producer whose
+    // ticket matches its sequence number, and readable one step later
+    struct Slot
+    {
+        std::atomic<size_t> sequence{0};
+        Message message;
+    };
+
+    static constexpr size_t CAPACITY = 1024;
+
+    std::vector<Slot> slots;
+    std::atomic<size_t> enqueue_pos{0};
+    size_t dequeue_pos = 0; // writer thread only
+
+    // Messages that must not be dropped when the queue is full. While any
+    // are waiting, later ones follow them here to keep each thread's order.
+    std::mutex overflow_mutex;
+    std::deque<Message> overflow;
+    std::atomic<size_t> overflow_waiting{0};
+
+    std::atomic<Mode> mode{Mode::Human};
+    std::atomic<long long> dropped{0};
+    std::atomic<long long> queued{0};
+    std::atomic<long long> written{0};
+
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    std::condition_variable drained_cv;
+    std::atomic<bool> writer_idle{false};
+    bool stopping = false;
+    std::thread writer;
+
+    bool tryPush(Message &message)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = slots[pos % CAPACITY];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            long long diff = static_cast<long long>(seq) - static_cast<long long>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.message = std::move(message);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(Message &message)
+    {
+        Slot &slot = slots[dequeue_pos % CAPACITY];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+            return false;
+        message = std::move(slot.message);
+        slot.sequence.store(dequeue_pos + CAPACITY, std::memory_order_release);
+        dequeue_pos++;
+        return true;
+    }
+
+    static std::string trim(const std::string &text)
+    {
+        size_t start = text.find_first_not_of(" \t\r\n");
+        if (start == std::string::npos)
+            return "";
+        size_t end = text.find_last_not_of(" \t\r\n");
+        return text.substr(start, end - start + 1);
+    }
+
+    static std::string quote(const std::string &text)
+    {
+        std::string out = "\"";
+        for (unsigned char c : text)
+        {
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (c < 0x20)
+                {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                }
+                else
+                {
+                    out += static_cast<char>(c);
+                }
+            }
+        }
+        return out + "\"";
+    }
+
+    static const char *typeName(OutputKind kind)
+    {
+        switch (kind)
+        {
+        case OutputKind::Diagnostic:
+            return "diag";
+        case OutputKind::Status:
+            return "status";
+        case OutputKind::Decoration:
+            return "decoration";
+        case OutputKind::Partial:
+            return "partial";
+        case OutputKind::Final:
+            return "final";
+        }
+        return "";
+    }
+
+    void print(const Message &message)
+    {
+        Mode current = mode.load(std::memory_order_relaxed);
+        if (current == Mode::Human)
+        {
+            std::fwrite(message.text.data(), 1, message.text.size(), stdout);
+            return;
+        }
+        if (message.kind == OutputKind::Decoration || (current == Mode::Quiet && message.kind != OutputKind::Final))
+            return;
+        std::string text = message.payload.empty() ? trim(message.text) : message.payload;
+        if (text.empty())
+            return;
+        std::string line;
+        if (current == Mode::Quiet)
+        {
+            line = (message.stream.empty() ? "" : "[" + message.stream + "] ") + text + "\n";
+        }
+        else
+        {
+            long long unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    std::chrono::system_clock::now().time_since_epoch())
+                                    .count();
+            line = "{\"time_ms\":" + std::to_string(unix_ms) + ",\"type\":\"" + typeName(message.kind) +
+                   "\",\"stream\":" + quote(message.stream) + ",\"text\":" + quote(text) + "}\n";
+        }
+        std::fwrite(line.data(), 1, line.size(), stdout);
+    }
+
+    // Returns the number of messages printed
+    size_t drainOnce()
+    {
+        size_t n = 0;
+        Message message;
+        while (tryPop(message))
+        {
+            print(message);
+            n++;
+        }
+        if (overflow_waiting.load(std::memory_order_acquire) > 0)
+        {
+            std::deque<Message> batch;
+            {
+                std::lock_guard<std::mutex> lock(overflow_mutex);
+                batch.swap(overflow);
+                overflow_waiting.store(0, std::memory_order_release);
+            }
+            for (const Message &m : batch)
+                print(m);
+            n += batch.size();
+        }
+        if (n > 0)
+            std::fflush(stdout);
+        return n;
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            size_t n = drainOnce();
+            written.fetch_add(static_cast<long long>(n), std::memory_order_release);
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            drained_cv.notify_all();
+            if (n > 0)
+                continue;
+            if (stopping)
+                return;
+            // Producers only take the lock to wake us while we are idle;
+            // the timeout covers a wake that races with going idle
+            writer_idle.store(true);
+            wake_cv.wait_for(lock, std::chrono::milliseconds(50));
+            writer_idle.store(false);
+        }
+    }
+
+    void wake()
+    {
+        if (writer_idle.load())
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            wake_cv.notify_one();
+        }
+    }
+
+public:
+    OutputChannel() : slots(CAPACITY)
+    {
+        for (size_t i = 0; i < CAPACITY; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        writer = std::thread(&OutputChannel::run, this);
+    }
+
+    ~OutputChannel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_cv.notify_all();
+        writer.join();
+        long long lost = dropped.load();
+        if (lost > 0)
+            std::fprintf(stderr, "[output] %lld diagnostic messages dropped (console too slow)\n", lost);
+    }
+
+    OutputChannel(const OutputChannel &) = delete;
+    OutputChannel &operator=(const OutputChannel &) = delete;
+
+    static OutputChannel &global()
+    {
+        static OutputChannel instance;
+        return instance;
+    }
+
+    static Mode parseMode(const std::string &name)
+    {
+        if (name == "human")
+            return Mode::Human;
+        if (name == "json")
+            return Mode::Json;
+        if (name == "quiet")
+            return Mode::Quiet;
+        throw std::runtime_error("Unknown output mode '" + name + "' (use human, json or quiet)");
+    }
+
+    void setMode(Mode m) { mode.store(m); }
+    Mode currentMode() const { return mode.load(); }
+
+    void emit(OutputKind kind, const std::string &stream, std::string text, std::string payload = {})
+    {
+        Message message{kind, stream, std::move(text), std::move(payload)};
+        queued.fetch_add(1, std::memory_order_relaxed);
+        if (overflow_waiting.load(std::memory_order_acquire) == 0 && tryPush(message))
+        {
+            wake();
+            return;
+        }
+        if (kind == OutputKind::Diagnostic)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            written.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(overflow_mutex);
+            overflow.push_back(std::move(message));
+            overflow_waiting.fetch_add(1, std::memory_order_release);
+        }
+        wake();
+    }
+
+    Line line(OutputKind kind, const std::string &stream = "", std::string payload = {})
+    {
+        return Line(*this, kind, stream, std::move(payload));
+    }
+
+    // Blocks until everything queued so far has been written, so that
+    // direct console output (summaries) does not interleave with it
+    void flush()
+    {
+        long long target = queued.load();
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.notify_one();
+        drained_cv.wait(lock, [&]
+                        { return written.load(std::memory_order_acquire) >= target; });
+    }
+
+    long long droppedCount() const { return dropped.load(); }
+};
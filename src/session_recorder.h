@@ -0,0 +1,414 @@
+#pragma once
+
+/**
+ * Session recording and deterministic replay.
+ *
+ * SessionRecorder appends everything the capture thread saw to a compact
+ * binary file: each block exactly as the source returned it (with its
+ * arrival time, capture age and the source's lost-sample count), each
+ * hotword detection and each change of the VAD decision, by frame number.
+ * The capture thread only appends to a memory buffer; a writer thread
+ * does the file I/O. If the writer falls more than MAX_PENDING behind,
+ * records are dropped and counted rather than stalling audio.
+ *
+ * SessionReplaySource (`--input=replay:<file>`) plays the blocks back with
+ * the same boundaries through the normal pipeline, paced by the recorded
+ * arrival times (scaled by --replay-speed; 0 = as fast as possible), and
+ * reports the recorded capture ages and losses. The transcriber then uses
+ * the recorded hotword and VAD decisions instead of the detectors' own: the
+ * hotword detector runs on its own thread, so which frame a detection lands
+ * on depends on timing, and replaying the decision is what makes the session
+ * boundaries identical. Frames where the live VAD disagrees are counted.
+ * The transcriber also turns off everything driven by decode timing
+ * (speculation, overload deferral, downgrades) for a replayed stream.
+ *
+ * File layout (host byte order):
+ *   header  "W2TREC01", u32 sample rate, u32 frame samples, u16 name length, name
+ *   'B'     u32 n, i64 arrival us, i64 capture age us (-1 unknown), i64 lost samples, n x i16
+ *   'H'     i64 frame
+ *   'V'     i64 frame, u8 speech
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "audio_source.h"
+
+namespace session_file
+{
+    static const char MAGIC[8] = {'W', '2', 'T', 'R', 'E', 'C', '0', '1'};
+
+    enum Record : char
+    {
+        Block = 'B',
+        Hotword = 'H',
+        Vad = 'V'
+    };
+}
+
+class SessionRecorder
+{
+public:
+    static constexpr size_t MAX_PENDING = 16 * 1024 * 1024;
+
+private:
+    std::string path;
+    FILE *out = nullptr;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<char> pending;
+    bool stopping = false;
+    std::thread writer;
+
+    // Capture thread only
+    int last_vad = -1;
+    long long blocks = 0;
+    long long samples = 0;
+    long long dropped = 0;
+
+    template <typename T>
+    static void put(std::vector<char> &buffer, T value)
+    {
+        const char *bytes = reinterpret_cast<const char *>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    // Appends one record built by `fill`, unless the writer is too far behind
+    template <typename Fill>
+    bool append(size_t size, Fill fill)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.size() + size > MAX_PENDING)
+            {
+                dropped++;
+                return false;
+            }
+            fill(pending);
+        }
+        cv.notify_one();
+        return true;
+    }
+
+    void run()
+    {
+        std::vector<char> batch;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait_for(lock, std::chrono::milliseconds(100), [this]
+                        { return stopping || pending.size() >= 256 * 1024; });
+            batch.swap(pending);
+            bool last = stopping;
+            lock.unlock();
+            if (!batch.empty())
+            {
+                std::fwrite(batch.data(), 1, batch.size(), out);
+                std::fflush(out);
+                batch.clear();
+            }
+            lock.lock();
+            if (last && pending.empty())
+                return;
+        }
+    }
+
+public:
+    SessionRecorder(const std::string &file, const std::string &source_name, size_t frame_samples) : path(file)
+    {
+        out = std::fopen(path.c_str(), "wb");
+        if (!out)
+            throw std::runtime_error("Cannot write session recording: " + path);
+        std::vector<char> header(session_file::MAGIC, session_file::MAGIC + sizeof(session_file::MAGIC));
+        put<uint32_t>(header, 16000);
+        put<uint32_t>(header, static_cast<uint32_t>(frame_samples));
+        std::string name = source_name.substr(0, 65535);
+        put<uint16_t>(header, static_cast<uint16_t>(name.size()));
+        header.insert(header.end(), name.begin(), name.end());
+        std::fwrite(header.data(), 1, header.size(), out);
+        writer = std::thread(&SessionRecorder::run, this);
+    }
+
+    ~SessionRecorder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        writer.join();
+        std::fclose(out);
+    }
+
+    SessionRecorder(const SessionRecorder &) = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    // `captured` as from AudioSource::blockCaptured() (epoch = unknown)
+    void block(const short *data, size_t n, std::chrono::steady_clock::time_point captured, long long lost_samples)
+    {
+        auto now = std::chrono::steady_clock::now();
+        int64_t arrival_us = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+        int64_t age_us = captured.time_since_epoch().count() == 0
+                             ? -1
+                             : std::chrono::duration_cast<std::chrono::microseconds>(now - captured).count();
+        bool kept = append(1 + 4 + 3 * 8 + n * sizeof(short), [&](std::vector<char> &buffer)
+                           {
+                               buffer.push_back(session_file::Block);
+                               put<uint32_t>(buffer, static_cast<uint32_t>(n));
+                               put<int64_t>(buffer, arrival_us);
+                               put<int64_t>(buffer, age_us);
+                               put<int64_t>(buffer, lost_samples);
+                               const char *bytes = reinterpret_cast<const char *>(data);
+                               buffer.insert(buffer.end(), bytes, bytes + n * sizeof(short)); });
+        if (kept)
+        {
+            blocks++;
+            samples += static_cast<long long>(n);
+        }
+    }
+
+    void hotword(long long frame)
+    {
+        append(1 + 8, [&](std::vector<char> &buffer)
+               {
+                   buffer.push_back(session_file::Hotword);
+                   put<int64_t>(buffer, frame); });
+    }
+
+    // Only changes are stored
+    void vad(long long frame, bool speech)
+    {
+        if (static_cast<int>(speech) == last_vad)
+            return;
+        if (append(1 + 8 + 1, [&](std::vector<char> &buffer)
+                   {
+                       buffer.push_back(session_file::Vad);
+                       put<int64_t>(buffer, frame);
+                       buffer.push_back(speech ? 1 : 0); }))
+            last_vad = speech;
+    }
+
+    const std::string &file() const { return path; }
+    long long blockCount() const { return blocks; }
+    double seconds() const { return samples / 16000.0; }
+    long long droppedRecords() const { return dropped; }
+};
+
+// Hotword and VAD decisions read from a recording, consumed in frame order
+// by the capture thread
+class RecordedDecisions
+{
+private:
+    size_t frame_samples = 0;
+    std::vector<long long> hotwords;
+    size_t next_hotword = 0;
+    std::vector<std::pair<long long, bool>> vad_changes;
+    size_t next_vad = 0;
+    bool vad_now = false;
+    long long vad_frames = 0;
+    long long vad_mismatches = 0;
+
+public:
+    explicit RecordedDecisions(size_t frame_size = 0) : frame_samples(frame_size) {}
+
+    // Frame size of the recording; frame numbers only line up with the same size
+    size_t frameSamples() const { return frame_samples; }
+    void setFrameSamples(size_t n) { frame_samples = n; }
+
+    void addHotword(long long frame) { hotwords.push_back(frame); }
+    void addVad(long long frame, bool speech) { vad_changes.emplace_back(frame, speech); }
+
+    // True if a detection was recorded at this frame
+    bool hotwordAt(long long frame)
+    {
+        while (next_hotword < hotwords.size() && hotwords[next_hotword] < frame)
+            next_hotword++;
+        if (next_hotword < hotwords.size() && hotwords[next_hotword] == frame)
+        {
+            next_hotword++;
+            return true;
+        }
+        return false;
+    }
+
+    // The recorded VAD decision for this frame; `live` is what the VAD
+    // decided now, counted when it differs
+    bool vadAt(long long frame, bool live)
+    {
+        while (next_vad < vad_changes.size() && vad_changes[next_vad].first <= frame)
+            vad_now = vad_changes[next_vad++].second;
+        vad_frames++;
+        if (live != vad_now)
+            vad_mismatches++;
+        return vad_now;
+    }
+
+    size_t hotwordCount() const { return hotwords.size(); }
+    long long vadFrames() const { return vad_frames; }
+    long long vadMismatches() const { return vad_mismatches; }
+};
+
+class SessionReplaySource : public AudioSource
+{
+private:
+    std::string path;
+    FILE *in = nullptr;
+    double speed;
+    uint32_t frame_samples = 0;
+    std::string recorded_name;
+    RecordedDecisions recorded;
+    std::chrono::steady_clock::time_point start;
+    bool started = false;
+    long long lost = 0;
+
+    // One block of read-ahead: the decisions for a block's frames follow it
+    // in the file, so they are read before the block is handed out
+    std::vector<short> block;
+    std::vector<short> current;
+    int64_t block_arrival_us = 0;
+    int64_t block_age_us = -1;
+    long long block_lost = 0;
+    bool have_block = false;
+
+    template <typename T>
+    bool get(T &value)
+    {
+        return std::fread(&value, sizeof(T), 1, in) == 1;
+    }
+
+    // Reads up to and including the next block record
+    bool readBlock()
+    {
+        char type;
+        while (get(type))
+        {
+            if (type == session_file::Hotword)
+            {
+                int64_t frame;
+                if (!get(frame))
+                    return false;
+                recorded.addHotword(frame);
+            }
+            else if (type == session_file::Vad)
+            {
+                int64_t frame;
+                uint8_t speech;
+                if (!get(frame) || !get(speech))
+                    return false;
+                recorded.addVad(frame, speech != 0);
+            }
+            else if (type == session_file::Block)
+            {
+                uint32_t n;
+                int64_t lost_samples;
+                if (!get(n) || !get(block_arrival_us) || !get(block_age_us) || !get(lost_samples))
+                    return false;
+                block.resize(n);
+                if (std::fread(block.data(), sizeof(short), n, in) != n)
+                    return false;
+                block_lost = lost_samples;
+                return true;
+            }
+            else
+            {
+                throw std::runtime_error("Corrupt session recording: " + path);
+            }
+        }
+        return false;
+    }
+
+public:
+    SessionReplaySource(const std::string &file, double replay_speed) : path(file), speed(replay_speed)
+    {
+        in = std::fopen(path.c_str(), "rb");
+        if (!in)
+            throw std::runtime_error("Cannot open session recording: " + path);
+        char magic[sizeof(session_file::MAGIC)];
+        uint32_t rate = 0;
+        uint16_t name_length = 0;
+        if (std::fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+            std::memcmp(magic, session_file::MAGIC, sizeof(magic)) != 0 || !get(rate) || !get(frame_samples) ||
+            !get(name_length))
+        {
+            std::fclose(in);
+            throw std::runtime_error("Not a session recording: " + path);
+        }
+        recorded.setFrameSamples(frame_samples);
+        recorded_name.resize(name_length);
+        if (name_length > 0 && std::fread(&recorded_name[0], 1, name_length, in) != name_length)
+            recorded_name.clear();
+        have_block = readBlock();
+    }
+
+    ~SessionReplaySource() override { std::fclose(in); }
+
+    std::string name() const override { return "replay:" + path; }
+
+    std::string settings() const override
+    {
+        char pace[32];
+        if (speed > 0.0)
+            std::snprintf(pace, sizeof(pace), "%gx recorded timing", speed);
+        else
+            std::snprintf(pace, sizeof(pace), "unpaced");
+        return "recorded from " + recorded_name + ", " + std::to_string(frame_samples) + "-sample frames, " + pace;
+    }
+
+    bool read(std::vector<short> &samples) override
+    {
+        const short *data;
+        size_t n;
+        if (!next(data, n))
+            return false;
+        samples.assign(data, data + n);
+        return true;
+    }
+
+    bool next(const short *&data, size_t &n) override
+    {
+        if (!have_block)
+            return false;
+        // The block handed out stays valid until the next call, so the
+        // read-ahead goes into the other buffer
+        current.swap(block);
+        int64_t arrival_us = block_arrival_us;
+        int64_t age_us = block_age_us;
+        lost = block_lost;
+
+        if (!started)
+        {
+            start = std::chrono::steady_clock::now() -
+                    std::chrono::microseconds(speed > 0.0 ? static_cast<int64_t>(arrival_us / speed) : 0);
+            started = true;
+        }
+        if (speed > 0.0)
+        {
+            // Same arrival schedule as the live capture, on a clock running `speed` times as fast
+            auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double, std::micro>(arrival_us / speed));
+            std::this_thread::sleep_until(due);
+            if (age_us >= 0)
+                noteCaptureAge(replay_age_ms(due) + age_us / 1000.0 / speed);
+        }
+
+        have_block = readBlock();
+        data = current.data();
+        n = current.size();
+        return true;
+    }
+
+    long long lostSamples() const override { return lost; }
+
+    RecordedDecisions *recordedDecisions() override { return &recorded; }
+};
@@ -0,0 +1,339 @@
+#pragma once
+
+/**
+ * Shared-memory audio ring for co-located producers.
+ *
+ * A producer process that already holds PCM writes it into a ring in a
+ * shared mapping (a named POSIX shm object or an anonymous memfd); the
+ * transcriber maps the same pages and hands frames straight from the ring
+ * to the detector, with no sound server, socket or intermediate copy.
+ *
+ * The mapping starts with a 128-byte header describing the sample format
+ * and holding the total number of samples written. The producer never
+ * waits for the reader: if the reader falls more than a ring behind, the
+ * lost samples are skipped and counted as an overrun. A reader blocked on
+ * an empty ring sleeps on a futex in the header; the producer only makes
+ * the wake syscall when a reader is actually asleep. (An eventfd would need
+ * the descriptor passed over a socket; a futex in the mapping does not.)
+ *
+ * Linux only (memfd_create, futex).
+ */
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct ShmRingHeader
+{
+    static constexpr uint32_t MAGIC = 0x52543257; // "W2TR"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t FORMAT_S16LE = 1;
+
+    std::atomic<uint32_t> magic;     // stored last by the producer
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t format;
+    uint32_t capacity;               // samples, a power of two
+    std::atomic<uint64_t> write_index;   // samples written since creation
+    std::atomic<uint64_t> write_time_ns; // CLOCK_MONOTONIC of the last commit
+    std::atomic<uint32_t> futex;         // bumped on every commit
+    std::atomic<uint32_t> sleepers;      // readers blocked on futex
+    std::atomic<uint32_t> closed;        // producer finished
+    uint8_t reserved[128 - 52];
+};
+
+static_assert(sizeof(ShmRingHeader) == 128, "ring header layout is shared between processes");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indices must be lock-free to live in shared memory");
+
+namespace shm_ring_detail
+{
+    inline uint64_t monotonic_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    // Shared (not FUTEX_PRIVATE) so waiters in other processes are found
+    inline void futex_wait(std::atomic<uint32_t> *word, uint32_t expected, int timeout_ms)
+    {
+        timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+    }
+
+    inline void futex_wake(std::atomic<uint32_t> *word)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    inline size_t mapping_size(uint32_t capacity) { return sizeof(ShmRingHeader) + capacity * sizeof(short); }
+}
+
+// Producer side. Creates the ring; the name is a POSIX shm object name, or
+// empty for an anonymous memfd that readers open through path().
+class ShmRingWriter
+{
+private:
+    int fd = -1;
+    std::string shm_name;
+    ShmRingHeader *header = nullptr;
+    short *ring = nullptr;
+    size_t mapped = 0;
+
+public:
+    explicit ShmRingWriter(const std::string &name = "", double seconds = 2.0)
+    {
+        uint32_t capacity = 1024;
+        while (capacity < seconds * 16000 && capacity < (1u << 26))
+            capacity <<= 1;
+
+        if (name.empty())
+        {
+            fd = static_cast<int>(syscall(SYS_memfd_create, "wake2text-ring", 0));
+        }
+        else
+        {
+            shm_name = name[0] == '/' ? name : "/" + name;
+            fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        }
+        if (fd < 0)
+            throw std::runtime_error("Cannot create audio ring: " + std::string(strerror(errno)));
+
+        mapped = shm_ring_detail::mapping_size(capacity);
+        if (ftruncate(fd, static_cast<off_t>(mapped)) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot size audio ring: " + std::string(strerror(errno)));
+        }
+        void *base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot map audio ring: " + std::string(strerror(errno)));
+        }
+
+        header = new (base) ShmRingHeader();
+        ring = reinterpret_cast<short *>(static_cast<char *>(base) + sizeof(ShmRingHeader));
+        header->version = ShmRingHeader::VERSION;
+        header->sample_rate = 16000;
+        header->channels = 1;
+        header->format = ShmRingHeader::FORMAT_S16LE;
+        header->capacity = capacity;
+        header->write_index.store(0, std::memory_order_relaxed);
+        header->write_time_ns.store(0, std::memory_order_relaxed);
+        header->futex.store(0, std::memory_order_relaxed);
+        header->sleepers.store(0, std::memory_order_relaxed);
+        header->closed.store(0, std::memory_order_relaxed);
+        header->magic.store(ShmRingHeader::MAGIC, std::memory_order_release);
+    }
+
+    ~ShmRingWriter()
+    {
+        if (header)
+            munmap(header, mapped);
+        if (fd >= 0)
+            close(fd);
+        if (!shm_name.empty())
+            shm_unlink(shm_name.c_str());
+    }
+
+    ShmRingWriter(const ShmRingWriter &) = delete;
+    ShmRingWriter &operator=(const ShmRingWriter &) = delete;
+
+    // What a reader passes to ShmAudioSource
+    std::string path() const
+    {
+        if (!shm_name.empty())
+            return shm_name.substr(1);
+        return "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd);
+    }
+
+    uint32_t capacity() const { return header->capacity; }
+
+    void write(const short *samples, size_t n)
+    {
+        const uint32_t mask = header->capacity - 1;
+        uint64_t w = header->write_index.load(std::memory_order_relaxed);
+        while (n > 0)
+        {
+            size_t start = static_cast<size_t>(w & mask);
+            size_t take = std::min(n, static_cast<size_t>(header->capacity) - start);
+            memcpy(ring + start, samples, take * sizeof(short));
+            samples += take;
+            n -= take;
+            w += take;
+        }
+        header->write_time_ns.store(shm_ring_detail::monotonic_ns(), std::memory_order_relaxed);
+        header->write_index.store(w, std::memory_order_release);
+        header->futex.fetch_add(1);
+        if (header->sleepers.load() > 0)
+            shm_ring_detail::futex_wake(&header->futex);
+    }
+
+    void finish()
+    {
+        header->closed.store(1);
+        header->futex.fetch_add(1);
+        shm_ring_detail::futex_wake(&header->futex);
+    }
+};
+
+// Reader side: a POSIX shm object name, or the path of any mappable file
+// such as /proc/<pid>/fd/<n> of a producer's memfd.
+class ShmRingReader
+{
+public:
+    struct Stats
+    {
+        long long blocks = 0;
+        long long waits = 0;            // futex sleeps on an empty ring
+        long long overrun_samples = 0;  // skipped or possibly overwritten while in use
+        double last_latency_ms = 0.0;   // age of the oldest sample handed out, for a real-time producer
+    };
+
+private:
+    int fd = -1;
+    ShmRingHeader *header = nullptr;
+    const short *ring = nullptr;
+    size_t mapped = 0;
+    uint64_t read_index = 0;
+    uint64_t lent_start = 0; // first sample of the block handed out last
+    bool lent = false;
+    size_t max_block;
+    Stats stats;
+
+public:
+    explicit ShmRingReader(const std::string &spec, size_t block = 4096) : max_block(block)
+    {
+        if (spec.find('/') != std::string::npos)
+            fd = open(spec.c_str(), O_RDWR);
+        else
+            fd = shm_open(("/" + spec).c_str(), O_RDWR, 0);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open audio ring " + spec + ": " + std::string(strerror(errno)) +
+                                     " (start the producer first)");
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmRingHeader))
+        {
+            close(fd);
+            throw std::runtime_error("Audio ring " + spec + " is not initialized");
+        }
+        mapped = static_cast<size_t>(st.st_size);
+        // Mapped writable only for the futex and sleeper count
+        void *base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot map audio ring " + spec + ": " + std::string(strerror(errno)));
+        }
+        header = static_cast<ShmRingHeader *>(base);
+
+        if (header->magic.load(std::memory_order_acquire) != ShmRingHeader::MAGIC ||
+            header->version != ShmRingHeader::VERSION)
+        {
+            munmap(base, mapped);
+            close(fd);
+            throw std::runtime_error("Audio ring " + spec + " has an unknown header");
+        }
+        if (header->sample_rate != 16000 || header->channels != 1 || header->format != ShmRingHeader::FORMAT_S16LE)
+        {
+            munmap(base, mapped);
+            close(fd);
+            throw std::runtime_error("Audio ring " + spec + " must carry 16 kHz mono s16le");
+        }
+        if (shm_ring_detail::mapping_size(header->capacity) > mapped || (header->capacity & (header->capacity - 1)) != 0)
+        {
+            munmap(base, mapped);
+            close(fd);
+            throw std::runtime_error("Audio ring " + spec + " has an inconsistent size");
+        }
+        ring = reinterpret_cast<const short *>(static_cast<const char *>(base) + sizeof(ShmRingHeader));
+        // Join live: audio written before we attached is not replayed
+        read_index = header->write_index.load(std::memory_order_acquire);
+    }
+
+    ~ShmRingReader()
+    {
+        if (header)
+            munmap(header, mapped);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    ShmRingReader(const ShmRingReader &) = delete;
+    ShmRingReader &operator=(const ShmRingReader &) = delete;
+
+    const Stats &ringStats() const { return stats; }
+
+    // Points into the ring itself. The block stays valid while the producer
+    // is less than a ring ahead; a block overwritten while it was in use is
+    // counted as an overrun on the next call.
+    bool next(const short *&data, size_t &n)
+    {
+        const uint64_t capacity = header->capacity;
+        uint64_t w = header->write_index.load(std::memory_order_acquire);
+        if (lent && w - lent_start > capacity)
+            stats.overrun_samples += static_cast<long long>(std::min(w - lent_start - capacity, read_index - lent_start));
+        lent = false;
+
+        while (w == read_index)
+        {
+            if (header->closed.load())
+                return false;
+            header->sleepers.fetch_add(1);
+            uint32_t seq = header->futex.load();
+            w = header->write_index.load(std::memory_order_acquire);
+            if (w == read_index && !header->closed.load())
+            {
+                stats.waits++;
+                shm_ring_detail::futex_wait(&header->futex, seq, 1000);
+            }
+            header->sleepers.fetch_sub(1);
+            w = header->write_index.load(std::memory_order_acquire);
+        }
+
+        if (w - read_index > capacity)
+        {
+            // Lapped: resume a quarter ring behind the producer
+            uint64_t resume = w - capacity + capacity / 4;
+            stats.overrun_samples += static_cast<long long>(resume - read_index);
+            read_index = resume;
+        }
+
+        size_t start = static_cast<size_t>(read_index & (capacity - 1));
+        n = static_cast<size_t>(std::min<uint64_t>({w - read_index, capacity - start, max_block}));
+        data = ring + start;
+        lent_start = read_index;
+        lent = true;
+        read_index += n;
+        stats.blocks++;
+
+        // The newest sample is as old as the last commit; the block's first
+        // sample was written (w - lent_start) samples of real time earlier
+        uint64_t committed = header->write_time_ns.load(std::memory_order_relaxed);
+        if (committed > 0)
+            stats.last_latency_ms = (shm_ring_detail::monotonic_ns() - committed) / 1e6 + (w - lent_start) / 16.0;
+        return true;
+    }
+};
+
+#endif
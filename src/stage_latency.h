@@ -0,0 +1,333 @@
+#pragma once
+
+/**
+ * Per-stage latency histograms.
+ *
+ * Every stage of the pipeline records into a fixed log-linear histogram
+ * (HDR style: 16 linear sub-buckets per power of two of microseconds, so
+ * any value is resolved to within about 6%). Recording is a handful of
+ * relaxed atomic increments with no lock and no allocation, so capture,
+ * detector and decode threads never wait on each other or on a reader.
+ *
+ * StageLatencyReporter prints p50/p90/p99/max per stage, followed by the
+ * memory accounting, when the process gets SIGUSR1, on SIGINT/SIGTERM, and
+ * when it is destroyed at exit. The
+ * dump runs on the reporter's own thread and only reads the atomics, so the
+ * audio loop keeps running while it prints.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "memory_stats.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <csignal>
+#include <unistd.h>
+#endif
+
+class LatencyHistogram
+{
+public:
+    struct Snapshot
+    {
+        uint64_t count = 0;
+        double mean_ms = 0.0;
+        double p50_ms = 0.0;
+        double p90_ms = 0.0;
+        double p99_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr uint64_t SUB = 1ull << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum_us{0};
+    std::atomic<uint64_t> max_us{0};
+
+    // Position of the highest set bit; us is non-zero
+    static int highestBit(uint64_t us)
+    {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanReverse64(&bit, us);
+        return static_cast<int>(bit);
+#else
+        return 63 - __builtin_clzll(us);
+#endif
+    }
+
+    static size_t index(uint64_t us)
+    {
+        if (us < SUB)
+            return static_cast<size_t>(us);
+        int exponent = highestBit(us);
+        uint64_t sub = (us >> (exponent - SUB_BITS)) & (SUB - 1);
+        return static_cast<size_t>(exponent - SUB_BITS + 1) * SUB + sub;
+    }
+
+    // Midpoint of a bucket's range, in microseconds
+    static double value(size_t idx)
+    {
+        if (idx < SUB)
+            return static_cast<double>(idx);
+        int exponent = static_cast<int>(idx / SUB) + SUB_BITS - 1;
+        uint64_t sub = idx % SUB;
+        uint64_t width = 1ull << (exponent - SUB_BITS);
+        uint64_t lower = (SUB + sub) << (exponent - SUB_BITS);
+        return lower + (width - 1) / 2.0;
+    }
+
+public:
+    void record(double us)
+    {
+        uint64_t v = us > 0.0 ? static_cast<uint64_t>(us) : 0;
+        counts[index(v)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(v, std::memory_order_relaxed);
+        uint64_t seen = max_us.load(std::memory_order_relaxed);
+        while (v > seen && !max_us.compare_exchange_weak(seen, v, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Concurrent records may land between the reads; the snapshot is
+    // consistent to within those few samples
+    Snapshot snapshot() const
+    {
+        Snapshot out;
+        std::array<uint64_t, BUCKETS> copy;
+        uint64_t n = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            copy[i] = counts[i].load(std::memory_order_relaxed);
+            n += copy[i];
+        }
+        out.count = n;
+        if (n == 0)
+            return out;
+
+        auto at = [&](double q)
+        {
+            uint64_t rank = static_cast<uint64_t>(q * (n - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; i++)
+            {
+                seen += copy[i];
+                if (seen >= rank)
+                    return value(i) / 1000.0;
+            }
+            return value(BUCKETS - 1) / 1000.0;
+        };
+        out.mean_ms = sum_us.load(std::memory_order_relaxed) / 1000.0 / std::max<uint64_t>(1, total.load());
+        out.max_ms = max_us.load(std::memory_order_relaxed) / 1000.0;
+        out.p50_ms = std::min(at(0.5), out.max_ms);
+        out.p90_ms = std::min(at(0.9), out.max_ms);
+        out.p99_ms = std::min(at(0.99), out.max_ms);
+        return out;
+    }
+};
+
+// Pipeline stages. Each is an interval ending at the named point:
+enum class Stage
+{
+    Capture, // sample captured -> block handed to the transcriber
+    Hotword, // sample captured -> hotword decision for its frame
+    Vad,     // sample captured -> VAD decision for its frame
+    Queue,   // chunk enqueued for decoding -> whisper_full starts
+    Whisper, // whisper_full start -> end
+    Filter,  // segment extraction and hallucination filter
+    Output,  // chunk enqueued -> its text is emitted
+    Final,   // end of speech -> final text emitted
+    COUNT
+};
+
+inline const char *stage_name(Stage stage)
+{
+    static const char *const names[] = {"capture", "hotword", "vad", "queue", "whisper", "filter", "output", "final"};
+    return names[static_cast<int>(stage)];
+}
+
+class StageLatency
+{
+private:
+    std::array<LatencyHistogram, static_cast<size_t>(Stage::COUNT)> stages;
+
+public:
+    // One set for the whole process; server streams aggregate
+    static StageLatency &global()
+    {
+        static StageLatency instance;
+        return instance;
+    }
+
+    void record(Stage stage, double ms) { stages[static_cast<size_t>(stage)].record(ms * 1000.0); }
+
+    void record(Stage stage, std::chrono::steady_clock::time_point from)
+    {
+        auto elapsed = std::chrono::steady_clock::now() - from;
+        stages[static_cast<size_t>(stage)].record(std::chrono::duration<double, std::micro>(elapsed).count());
+    }
+
+    LatencyHistogram::Snapshot snapshot(Stage stage) const { return stages[static_cast<size_t>(stage)].snapshot(); }
+
+    // To stderr, so it never interleaves with transcript lines on stdout
+    void dump(const char *reason) const
+    {
+        bool any = false;
+        for (int i = 0; i < static_cast<int>(Stage::COUNT); i++)
+            any = any || snapshot(static_cast<Stage>(i)).count > 0;
+        if (!any)
+            return;
+        std::fprintf(stderr, "\n[stages] latency per stage (%s)\n", reason);
+        std::fprintf(stderr, "[stages] %-8s %9s %9s %9s %9s %9s %9s\n", "stage", "count", "mean ms", "p50", "p90", "p99",
+                     "max");
+        for (int i = 0; i < static_cast<int>(Stage::COUNT); i++)
+        {
+            LatencyHistogram::Snapshot s = snapshot(static_cast<Stage>(i));
+            if (s.count == 0)
+                continue;
+            std::fprintf(stderr, "[stages] %-8s %9llu %9.2f %9.2f %9.2f %9.2f %9.2f\n", stage_name(static_cast<Stage>(i)),
+                         static_cast<unsigned long long>(s.count), s.mean_ms, s.p50_ms, s.p90_ms, s.p99_ms, s.max_ms);
+        }
+        std::fflush(stderr);
+    }
+};
+
+// Dumps StageLatency::global() on SIGUSR1 and at exit. SIGINT/SIGTERM dump
+// and then end the process as before, unless a stop handler is installed:
+// then the first one only calls it so the caller can shut down and return
+// normally, and a second one ends the process. Signal handlers only write a
+// byte to a pipe; the dump itself runs on this thread.
+class StageLatencyReporter
+{
+private:
+#ifndef _WIN32
+    static int &pipeWrite()
+    {
+        static int fd = -1;
+        return fd;
+    }
+
+    static void onSignal(int sig)
+    {
+        char code = static_cast<char>(sig);
+        if (pipeWrite() >= 0)
+        {
+            ssize_t ignored = write(pipeWrite(), &code, 1);
+            (void)ignored;
+        }
+    }
+
+    int fds[2] = {-1, -1};
+    std::function<void()> before_exit;
+    std::thread worker;
+    std::mutex stop_mutex;
+    std::function<void()> stop_handler;
+
+    void run()
+    {
+        char code;
+        while (read(fds[0], &code, 1) == 1)
+        {
+            if (code == 0)
+                return;
+            if (code == SIGUSR1)
+            {
+                StageLatency::global().dump("SIGUSR1");
+                MemoryStats::global().dump("SIGUSR1");
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(stop_mutex);
+                if (stop_handler)
+                {
+                    std::fprintf(stderr, "\n%s: shutting down (again to exit now)\n", code == SIGINT ? "SIGINT" : "SIGTERM");
+                    auto stop = std::move(stop_handler);
+                    stop_handler = nullptr;
+                    stop();
+                    continue;
+                }
+            }
+            StageLatency::global().dump(code == SIGINT ? "SIGINT" : "SIGTERM");
+            MemoryStats::global().dump(code == SIGINT ? "SIGINT" : "SIGTERM");
+            if (before_exit)
+                before_exit();
+            std::_Exit(128 + code);
+        }
+    }
+#endif
+
+public:
+    // `on_terminate` runs on SIGINT/SIGTERM just before the process exits,
+    // e.g. to flush queued console output
+    explicit StageLatencyReporter(std::function<void()> on_terminate = {})
+    {
+#ifndef _WIN32
+        before_exit = std::move(on_terminate);
+        if (pipe(fds) != 0)
+            return;
+        pipeWrite() = fds[1];
+        struct sigaction action;
+        action.sa_handler = &StageLatencyReporter::onSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        worker = std::thread(&StageLatencyReporter::run, this);
+#else
+        (void)on_terminate;
+#endif
+    }
+
+    // Installs (or with an empty function removes) the handler the first
+    // SIGINT/SIGTERM calls instead of exiting. It runs on the reporter thread.
+    void onStop(std::function<void()> stop)
+    {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stop_handler = std::move(stop);
+#else
+        (void)stop;
+#endif
+    }
+
+    ~StageLatencyReporter()
+    {
+#ifndef _WIN32
+        if (worker.joinable())
+        {
+            char stop = 0;
+            ssize_t ignored = write(fds[1], &stop, 1);
+            (void)ignored;
+            worker.join();
+            signal(SIGUSR1, SIG_IGN);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            pipeWrite() = -1;
+            close(fds[0]);
+            close(fds[1]);
+        }
+#endif
+        StageLatency::global().dump("exit");
+        MemoryStats::global().dump("exit");
+    }
+
+    StageLatencyReporter(const StageLatencyReporter &) = delete;
+    StageLatencyReporter &operator=(const StageLatencyReporter &) = delete;
+};
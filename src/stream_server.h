@@ -0,0 +1,770 @@
+#pragma once
+
+/**
+ * Embedded localhost HTTP/WebSocket server.
+ *
+ * One thread runs an epoll loop over non-blocking sockets bound to
+ * 127.0.0.1 only. A connection costs a socket and a small parse buffer
+ * until it sends data, so hundreds of idle clients are cheap. WebSocket
+ * messages and HTTP POST bodies are handed to callbacks on the loop
+ * thread; callbacks must not block. Replies may be queued from any thread
+ * with sendText()/sendHttp(); an eventfd wakes the loop to write them.
+ *
+ * Linux only (epoll, eventfd).
+ */
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace stream_server_detail
+{
+    // SHA-1 for the WebSocket accept key (RFC 6455 section 4.2.2)
+    inline std::string sha1(const std::string &input)
+    {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        std::string msg = input;
+        uint64_t bit_len = static_cast<uint64_t>(input.size()) * 8;
+        msg += static_cast<char>(0x80);
+        while (msg.size() % 64 != 56)
+            msg += static_cast<char>(0);
+        for (int i = 7; i >= 0; i--)
+            msg += static_cast<char>((bit_len >> (i * 8)) & 0xFF);
+
+        auto rotl = [](uint32_t v, int n)
+        { return (v << n) | (v >> (32 - n)); };
+
+        for (size_t chunk = 0; chunk < msg.size(); chunk += 64)
+        {
+            uint32_t w[80];
+            for (int i = 0; i < 16; i++)
+            {
+                const unsigned char *p = reinterpret_cast<const unsigned char *>(msg.data() + chunk + i * 4);
+                w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+            }
+            for (int i = 16; i < 80; i++)
+                w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; i++)
+            {
+                uint32_t f, k;
+                if (i < 20)
+                    f = (b & c) | (~b & d), k = 0x5A827999;
+                else if (i < 40)
+                    f = b ^ c ^ d, k = 0x6ED9EBA1;
+                else if (i < 60)
+                    f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+                else
+                    f = b ^ c ^ d, k = 0xCA62C1D6;
+                uint32_t t = rotl(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = t;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+
+        std::string digest;
+        for (uint32_t v : h)
+            for (int i = 3; i >= 0; i--)
+                digest += static_cast<char>((v >> (i * 8)) & 0xFF);
+        return digest;
+    }
+
+    inline std::string base64(const std::string &data)
+    {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        size_t i = 0;
+        for (; i + 2 < data.size(); i += 3)
+        {
+            uint32_t v = (uint8_t(data[i]) << 16) | (uint8_t(data[i + 1]) << 8) | uint8_t(data[i + 2]);
+            out += table[(v >> 18) & 63];
+            out += table[(v >> 12) & 63];
+            out += table[(v >> 6) & 63];
+            out += table[v & 63];
+        }
+        if (i < data.size())
+        {
+            uint32_t v = uint8_t(data[i]) << 16;
+            if (i + 1 < data.size())
+                v |= uint8_t(data[i + 1]) << 8;
+            out += table[(v >> 18) & 63];
+            out += table[(v >> 12) & 63];
+            out += i + 1 < data.size() ? table[(v >> 6) & 63] : '=';
+            out += '=';
+        }
+        return out;
+    }
+}
+
+inline std::string json_escape(const std::string &text)
+{
+    std::string out;
+    out.reserve(text.size() + 2);
+    for (unsigned char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+            {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out;
+}
+
+class StreamServer
+{
+public:
+    using ConnectionId = uint64_t;
+
+    struct Handler
+    {
+        std::function<void(ConnectionId, const std::string &path)> on_open;
+        std::function<void(ConnectionId, const char *data, size_t size)> on_binary;
+        std::function<void(ConnectionId, const std::string &text)> on_text;
+        std::function<void(ConnectionId)> on_close;
+        // The reply is sent later, from any thread, with sendHttp()
+        std::function<void(ConnectionId, const std::string &path, std::string body)> on_post;
+        // Extra fields for the GET /health JSON object
+        std::function<std::string()> health;
+        // Body of GET /metrics (Prometheus text format); 404 when unset
+        std::function<std::string()> metrics;
+    };
+
+    static constexpr size_t MAX_HEADER_BYTES = 16 * 1024;
+    static constexpr size_t MAX_BODY_BYTES = 32 * 1024 * 1024; // about 17 minutes of 16 kHz s16le
+    static constexpr size_t MAX_MESSAGE_BYTES = 16 * 1024 * 1024;
+
+private:
+    enum class Mode
+    {
+        Http,
+        HttpBody,
+        AwaitingReply,
+        WebSocket,
+        Closing
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        Mode mode = Mode::Http;
+        std::string in;
+        std::string out;
+        std::string path;
+        size_t body_length = 0;
+        std::string message; // fragmented WebSocket message being assembled
+        int message_opcode = 0;
+        bool websocket = false; // on_close is only reported for upgraded connections
+        bool want_write = false;
+    };
+
+    struct Outgoing
+    {
+        ConnectionId id;
+        std::string bytes;
+        bool close_after;
+    };
+
+    Handler handler;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int port;
+    std::atomic<bool> stopping{false};
+
+    std::map<ConnectionId, Connection> connections;
+    ConnectionId next_id = 1;
+    std::atomic<size_t> open_connections{0};
+    bool accepting = true; // false while out of file descriptors
+
+    std::mutex outbox_mutex;
+    std::vector<Outgoing> outbox;
+
+    static constexpr ConnectionId LISTEN_ID = 0;
+    static constexpr ConnectionId WAKE_ID = ~ConnectionId(0);
+    static constexpr int ACCEPT_RETRY_MS = 1000;
+
+    static std::string lower(std::string s)
+    {
+        for (auto &c : s)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return s;
+    }
+
+    static std::string wsFrame(int opcode, const std::string &payload)
+    {
+        std::string frame;
+        frame += static_cast<char>(0x80 | opcode);
+        size_t n = payload.size();
+        if (n < 126)
+        {
+            frame += static_cast<char>(n);
+        }
+        else if (n <= 0xFFFF)
+        {
+            frame += static_cast<char>(126);
+            frame += static_cast<char>((n >> 8) & 0xFF);
+            frame += static_cast<char>(n & 0xFF);
+        }
+        else
+        {
+            frame += static_cast<char>(127);
+            for (int i = 7; i >= 0; i--)
+                frame += static_cast<char>((static_cast<uint64_t>(n) >> (i * 8)) & 0xFF);
+        }
+        frame += payload;
+        return frame;
+    }
+
+    static std::string httpResponse(int status, const std::string &content_type, const std::string &body)
+    {
+        const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request"
+                                                : status == 404   ? "Not Found"
+                                                : status == 411   ? "Length Required"
+                                                : status == 413   ? "Payload Too Large"
+                                                : status == 503   ? "Service Unavailable"
+                                                                  : "Internal Server Error";
+        return "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\nContent-Type: " + content_type +
+               "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    }
+
+    void watch(ConnectionId id, Connection &conn, bool write)
+    {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | (write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        ev.data.u64 = id;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.want_write = write;
+    }
+
+    void closeConnection(ConnectionId id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        bool was_websocket = it->second.websocket;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        ::close(it->second.fd);
+        connections.erase(it);
+        open_connections--;
+        resumeAccepting();
+        if (was_websocket && handler.on_close)
+            handler.on_close(id);
+    }
+
+    // Writes as much of the output buffer as the socket takes
+    void flush(ConnectionId id, Connection &conn)
+    {
+        while (!conn.out.empty())
+        {
+            ssize_t n = ::send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+            if (n > 0)
+            {
+                conn.out.erase(0, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                if (!conn.want_write)
+                    watch(id, conn, true);
+                return;
+            }
+            closeConnection(id);
+            return;
+        }
+        if (conn.want_write)
+            watch(id, conn, false);
+        if (conn.mode == Mode::Closing)
+            closeConnection(id);
+    }
+
+    // The listen fd is level-triggered: while accept4() fails with EMFILE/ENFILE it stays readable,
+    // so it is taken out of the poll set until a descriptor frees up or the retry timeout passes
+    void pauseAccepting()
+    {
+        if (!accepting)
+            return;
+        struct epoll_event ev = {};
+        ev.data.u64 = LISTEN_ID;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &ev);
+        accepting = false;
+    }
+
+    void resumeAccepting()
+    {
+        if (accepting)
+            return;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTEN_ID;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &ev);
+        accepting = true;
+    }
+
+    void acceptAll()
+    {
+        while (true)
+        {
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                int error = errno;
+                bool exhausted = error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+                std::fprintf(stderr, "[api] accept failed: %s%s\n", std::strerror(error),
+                             exhausted ? "; pausing new connections" : "");
+                if (exhausted)
+                    pauseAccepting();
+                return;
+            }
+            ConnectionId id = next_id++;
+            Connection &conn = connections[id];
+            conn.fd = fd;
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = id;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            open_connections++;
+        }
+    }
+
+    void drainOutbox()
+    {
+        uint64_t counter;
+        while (::read(wake_fd, &counter, sizeof(counter)) > 0)
+        {
+        }
+
+        std::vector<Outgoing> pending;
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            pending.swap(outbox);
+        }
+        for (auto &item : pending)
+        {
+            auto it = connections.find(item.id);
+            if (it == connections.end())
+                continue; // closed by the peer in the meantime
+            it->second.out += item.bytes;
+            if (item.close_after)
+                it->second.mode = Mode::Closing;
+            flush(item.id, it->second);
+        }
+    }
+
+    void reply(ConnectionId id, Connection &conn, int status, const std::string &body,
+               const char *content_type = "application/json")
+    {
+        conn.out += httpResponse(status, content_type, body);
+        conn.mode = Mode::Closing;
+        flush(id, conn);
+    }
+
+    // Returns false once the connection is gone
+    bool handleHttp(ConnectionId id, Connection &conn)
+    {
+        size_t end = conn.in.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+            if (conn.in.size() > MAX_HEADER_BYTES)
+                reply(id, conn, 400, "{\"error\":\"header too large\"}");
+            return false;
+        }
+
+        std::string head = conn.in.substr(0, end);
+        conn.in.erase(0, end + 4);
+
+        size_t line_end = head.find("\r\n");
+        std::string request_line = head.substr(0, line_end);
+        std::map<std::string, std::string> headers;
+        size_t pos = line_end == std::string::npos ? head.size() : line_end + 2;
+        while (pos < head.size())
+        {
+            size_t next = head.find("\r\n", pos);
+            if (next == std::string::npos)
+                next = head.size();
+            std::string line = head.substr(pos, next - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos)
+            {
+                std::string value = line.substr(colon + 1);
+                value.erase(0, value.find_first_not_of(" \t"));
+                headers[lower(line.substr(0, colon))] = value;
+            }
+            pos = next + 2;
+        }
+
+        size_t sp1 = request_line.find(' ');
+        size_t sp2 = request_line.find(' ', sp1 + 1);
+        if (sp1 == std::string::npos || sp2 == std::string::npos)
+        {
+            reply(id, conn, 400, "{\"error\":\"bad request line\"}");
+            return false;
+        }
+        std::string method = request_line.substr(0, sp1);
+        conn.path = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+
+        if (method == "GET" && lower(headers["upgrade"]) == "websocket" && !headers["sec-websocket-key"].empty())
+        {
+            std::string accept = stream_server_detail::base64(
+                stream_server_detail::sha1(headers["sec-websocket-key"] + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+            conn.out += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Accept: " +
+                        accept + "\r\n\r\n";
+            conn.mode = Mode::WebSocket;
+            conn.websocket = true;
+            if (handler.on_open)
+                handler.on_open(id, conn.path);
+            flush(id, conn);
+            return connections.count(id) > 0;
+        }
+
+        if (method == "GET" && conn.path == "/health")
+        {
+            std::string extra = handler.health ? handler.health() : "";
+            reply(id, conn, 200, "{\"connections\":" + std::to_string(open_connections.load()) +
+                                     (extra.empty() ? "" : "," + extra) + "}");
+            return false;
+        }
+
+        if (method == "GET" && conn.path == "/metrics" && handler.metrics)
+        {
+            reply(id, conn, 200, handler.metrics(), "text/plain; version=0.0.4");
+            return false;
+        }
+
+        if (method == "POST")
+        {
+            auto length = headers.find("content-length");
+            if (length == headers.end())
+            {
+                reply(id, conn, 411, "{\"error\":\"Content-Length required\"}");
+                return false;
+            }
+            conn.body_length = static_cast<size_t>(std::strtoull(length->second.c_str(), nullptr, 10));
+            if (conn.body_length > MAX_BODY_BYTES)
+            {
+                reply(id, conn, 413, "{\"error\":\"body too large\"}");
+                return false;
+            }
+            conn.mode = Mode::HttpBody;
+            return true;
+        }
+
+        reply(id, conn, 404, "{\"error\":\"not found\"}");
+        return false;
+    }
+
+    bool handleBody(ConnectionId id, Connection &conn)
+    {
+        if (conn.in.size() < conn.body_length)
+            return false;
+        std::string body = conn.in.substr(0, conn.body_length);
+        conn.in.clear();
+        conn.mode = Mode::AwaitingReply;
+        if (handler.on_post)
+            handler.on_post(id, conn.path, std::move(body));
+        else
+            reply(id, conn, 404, "{\"error\":\"not found\"}");
+        return false;
+    }
+
+    // Parses complete frames from the input buffer; returns false once the
+    // connection is gone or no complete frame remains
+    bool handleWebSocket(ConnectionId id, Connection &conn)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(conn.in.data());
+        size_t avail = conn.in.size();
+        if (avail < 2)
+            return false;
+
+        bool fin = (p[0] & 0x80) != 0;
+        int opcode = p[0] & 0x0F;
+        bool masked = (p[1] & 0x80) != 0;
+        uint64_t length = p[1] & 0x7F;
+        size_t header = 2;
+        if (length == 126)
+        {
+            if (avail < 4)
+                return false;
+            length = (uint64_t(p[2]) << 8) | p[3];
+            header = 4;
+        }
+        else if (length == 127)
+        {
+            if (avail < 10)
+                return false;
+            length = 0;
+            for (int i = 0; i < 8; i++)
+                length = (length << 8) | p[2 + i];
+            header = 10;
+        }
+        if (!masked || length > MAX_MESSAGE_BYTES || conn.message.size() + length > MAX_MESSAGE_BYTES)
+        {
+            // Clients must mask (RFC 6455 section 5.1); 1009 = message too big
+            conn.out += wsFrame(0x8, std::string("\x03\xf1", 2));
+            conn.mode = Mode::Closing;
+            flush(id, conn);
+            return false;
+        }
+        if (avail < header + 4 + length)
+            return false;
+
+        const unsigned char *mask = p + header;
+        std::string payload(reinterpret_cast<const char *>(p + header + 4), static_cast<size_t>(length));
+        for (size_t i = 0; i < payload.size(); i++)
+            payload[i] = static_cast<char>(payload[i] ^ mask[i % 4]);
+        conn.in.erase(0, header + 4 + static_cast<size_t>(length));
+
+        switch (opcode)
+        {
+        case 0x8: // close: echo and hang up
+            conn.out += wsFrame(0x8, payload.substr(0, 2));
+            conn.mode = Mode::Closing;
+            flush(id, conn);
+            return false;
+        case 0x9: // ping
+            conn.out += wsFrame(0xA, payload);
+            flush(id, conn);
+            return connections.count(id) > 0;
+        case 0xA: // pong
+            return true;
+        case 0x0: // continuation
+            conn.message += payload;
+            break;
+        default:
+            conn.message_opcode = opcode;
+            conn.message = std::move(payload);
+            break;
+        }
+
+        if (fin)
+        {
+            if (conn.message_opcode == 0x2 && handler.on_binary)
+                handler.on_binary(id, conn.message.data(), conn.message.size());
+            else if (conn.message_opcode == 0x1 && handler.on_text)
+                handler.on_text(id, conn.message);
+            conn.message.clear();
+        }
+        return connections.count(id) > 0;
+    }
+
+    void readFrom(ConnectionId id)
+    {
+        auto it = connections.find(id);
+        if (it == connections.end())
+            return;
+        Connection &conn = it->second;
+
+        char buffer[64 * 1024];
+        while (true)
+        {
+            ssize_t n = ::recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (n > 0)
+            {
+                if (conn.mode != Mode::Closing && conn.mode != Mode::AwaitingReply)
+                    conn.in.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            closeConnection(id); // EOF or error
+            return;
+        }
+
+        bool more = true;
+        while (more && connections.count(id))
+        {
+            switch (conn.mode)
+            {
+            case Mode::Http:
+                more = handleHttp(id, conn);
+                break;
+            case Mode::HttpBody:
+                more = handleBody(id, conn);
+                break;
+            case Mode::WebSocket:
+                more = handleWebSocket(id, conn);
+                break;
+            default:
+                more = false;
+            }
+        }
+    }
+
+    void queue(ConnectionId id, std::string bytes, bool close_after)
+    {
+        {
+            std::lock_guard<std::mutex> lock(outbox_mutex);
+            outbox.push_back({id, std::move(bytes), close_after});
+        }
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+public:
+    StreamServer(int listen_port, Handler callbacks) : handler(std::move(callbacks)), port(listen_port)
+    {
+        listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            throw std::runtime_error("socket() failed: " + std::string(std::strerror(errno)));
+
+        int yes = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (::bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(listen_fd, 1024) < 0)
+        {
+            std::string error = std::strerror(errno);
+            ::close(listen_fd);
+            throw std::runtime_error("Cannot listen on 127.0.0.1:" + std::to_string(port) + ": " + error);
+        }
+
+        epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTEN_ID;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+        ev.data.u64 = WAKE_ID;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    }
+
+    ~StreamServer()
+    {
+        for (auto &entry : connections)
+            ::close(entry.second.fd);
+        ::close(wake_fd);
+        ::close(epoll_fd);
+        ::close(listen_fd);
+    }
+
+    StreamServer(const StreamServer &) = delete;
+    StreamServer &operator=(const StreamServer &) = delete;
+
+    // Runs the event loop on the calling thread until stop()
+    void run()
+    {
+        std::vector<struct epoll_event> events(256);
+        while (!stopping.load())
+        {
+            int n = ::epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()),
+                                 accepting ? -1 : ACCEPT_RETRY_MS);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("epoll_wait failed: " + std::string(std::strerror(errno)));
+            }
+            if (n == 0)
+                resumeAccepting(); // descriptors may have been freed elsewhere in the process
+            for (int i = 0; i < n; i++)
+            {
+                ConnectionId id = events[i].data.u64;
+                if (id == LISTEN_ID)
+                {
+                    acceptAll();
+                }
+                else if (id == WAKE_ID)
+                {
+                    drainOutbox();
+                }
+                else
+                {
+                    if (events[i].events & EPOLLOUT)
+                    {
+                        auto it = connections.find(id);
+                        if (it != connections.end())
+                            flush(id, it->second);
+                    }
+                    if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                        readFrom(id);
+                }
+            }
+        }
+    }
+
+    // Thread-safe
+    void stop()
+    {
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    // Thread-safe; dropped if the connection has closed
+    void sendText(ConnectionId id, const std::string &text) { queue(id, wsFrame(0x1, text), false); }
+
+    // Thread-safe; answers a POST handed to on_post and closes the connection
+    void sendHttp(ConnectionId id, int status, const std::string &json)
+    {
+        queue(id, httpResponse(status, "application/json", json), true);
+    }
+
+    int listenPort() const { return port; }
+    size_t connectionCount() const { return open_connections.load(); }
+};
+
+#endif // __linux__
@@ -0,0 +1,248 @@
+#pragma once
+
+/**
+ * Pipeline timeline in Chrome trace-event format (chrome://tracing,
+ * Perfetto).
+ *
+ * Each thread appends complete ("X") events to its own fixed-size ring, so
+ * recording takes no lock. One writer thread drains all rings every
+ * 100 ms and appends the events to the trace file. A full ring drops new
+ * events and counts them, so a stalled disk never blocks the audio loop.
+ * While tracing is off, a TraceScope costs a single relaxed load.
+ *
+ * Event names must be string literals (or otherwise outlive the trace).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Tracer
+{
+public:
+    struct Event
+    {
+        const char *name;
+        int64_t start_us;
+        int64_t duration_us;
+        long long arg; // shown as args.n when >= 0
+    };
+
+private:
+    static constexpr size_t RING_EVENTS = 16384;
+
+    struct ThreadRing
+    {
+        std::vector<Event> events = std::vector<Event>(RING_EVENTS);
+        std::atomic<size_t> head{0}; // written by the owning thread
+        std::atomic<size_t> tail{0}; // written by the writer thread
+        std::atomic<long long> dropped{0};
+        int tid = 0;
+        std::string name;
+        bool named = false;
+    };
+
+    std::atomic<bool> on{false};
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    int next_tid = 1;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    ThreadRing &ring()
+    {
+        thread_local std::shared_ptr<ThreadRing> mine;
+        if (!mine)
+        {
+            mine = std::make_shared<ThreadRing>();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            mine->tid = next_tid++;
+            rings.push_back(mine);
+        }
+        return *mine;
+    }
+
+public:
+    static Tracer &global()
+    {
+        static Tracer instance;
+        return instance;
+    }
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    int64_t nowUs() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    int64_t toUs(std::chrono::steady_clock::time_point t) const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+    }
+
+    void record(const char *name, int64_t start_us, int64_t duration_us, long long arg = -1)
+    {
+        ThreadRing &r = ring();
+        size_t head = r.head.load(std::memory_order_relaxed);
+        if (head - r.tail.load(std::memory_order_acquire) >= RING_EVENTS)
+        {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        r.events[head % RING_EVENTS] = {name, start_us, duration_us, arg};
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    // Label for the calling thread in the viewer; call once when it starts
+    void nameThread(const std::string &name)
+    {
+        if (!enabled())
+            return;
+        ThreadRing &r = ring();
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        r.name = name;
+        r.named = false;
+    }
+
+    void start() { on.store(true); }
+    void stop() { on.store(false); }
+
+    // Writer side: appends every pending event as a JSON object (each
+    // preceded by ",\n" unless it is the first). Returns events dropped so far.
+    long long drain(FILE *out, bool &first)
+    {
+        std::vector<std::shared_ptr<ThreadRing>> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            snapshot = rings;
+            for (auto &r : snapshot)
+            {
+                if (r->named || r->name.empty())
+                    continue;
+                std::fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                             first ? "" : ",\n", r->tid, r->name.c_str());
+                first = false;
+                r->named = true;
+            }
+        }
+
+        long long dropped = 0;
+        for (auto &r : snapshot)
+        {
+            size_t tail = r->tail.load(std::memory_order_relaxed);
+            size_t head = r->head.load(std::memory_order_acquire);
+            for (; tail != head; tail++)
+            {
+                const Event &e = r->events[tail % RING_EVENTS];
+                std::fprintf(out, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld", first ? "" : ",\n",
+                             e.name, r->tid, static_cast<long long>(e.start_us), static_cast<long long>(e.duration_us));
+                if (e.arg >= 0)
+                    std::fprintf(out, ",\"args\":{\"n\":%lld}", e.arg);
+                std::fputs("}", out);
+                first = false;
+            }
+            r->tail.store(tail, std::memory_order_release);
+            dropped += r->dropped.load(std::memory_order_relaxed);
+        }
+        return dropped;
+    }
+};
+
+// Records one complete event covering its lifetime
+class TraceScope
+{
+private:
+    const char *name;
+    int64_t start_us = -1;
+    long long arg;
+
+public:
+    explicit TraceScope(const char *event, long long n = -1) : name(event), arg(n)
+    {
+        if (Tracer::global().enabled())
+            start_us = Tracer::global().nowUs();
+    }
+
+    ~TraceScope()
+    {
+        if (start_us >= 0)
+            Tracer::global().record(name, start_us, Tracer::global().nowUs() - start_us, arg);
+    }
+
+    void setArg(long long n) { arg = n; }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+// Owns the trace file and the writer thread. Tracing runs from
+// construction to destruction; the file is a complete JSON array once
+// the writer has finished.
+class TraceWriter
+{
+private:
+    FILE *out = nullptr;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    bool first = true;
+    long long dropped = 0;
+    std::thread worker;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, std::chrono::milliseconds(100), [this]
+                            { return stopping; }))
+        {
+            lock.unlock();
+            dropped = Tracer::global().drain(out, first);
+            std::fflush(out);
+            lock.lock();
+        }
+    }
+
+public:
+    // An empty path leaves tracing off
+    explicit TraceWriter(const std::string &path)
+    {
+        if (path.empty())
+            return;
+        out = std::fopen(path.c_str(), "w");
+        if (!out)
+            throw std::runtime_error("Cannot write trace file: " + path);
+        std::fputs("[\n", out);
+        Tracer::global().start();
+        Tracer::global().nameThread("main");
+        worker = std::thread(&TraceWriter::run, this);
+    }
+
+    ~TraceWriter()
+    {
+        if (!out)
+            return;
+        Tracer::global().stop();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+        dropped = Tracer::global().drain(out, first);
+        std::fputs("\n]\n", out);
+        std::fclose(out);
+        if (dropped > 0)
+            std::fprintf(stderr, "[trace] %lld events dropped (writer fell behind)\n", dropped);
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+};
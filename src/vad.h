@@ -0,0 +1,270 @@
+#pragma once
+
+/**
+ * Voice activity detection engines used for endpointing.
+ *
+ * - snowboy: the snowman SnowboyVad (original behaviour)
+ * - energy:  SIMD short-time energy / zero-crossing detector with an
+ *            adaptive noise floor, no model required
+ * - whisper: whisper.cpp's built-in Silero VAD model (--vad-model)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "snowboy-detect.h"
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#endif
+#include "whisper.h"
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WAKE2TEXT_VAD_SSE2 1
+#endif
+
+class VadEngine
+{
+public:
+    virtual ~VadEngine() = default;
+
+    virtual const char *name() const = 0;
+
+    // Returns true when the block of 16 kHz mono samples contains speech
+    virtual bool isSpeech(const short *samples, size_t n) = 0;
+
+    virtual void reset() = 0;
+};
+
+class SnowboyVadEngine : public VadEngine
+{
+private:
+    snowboy::SnowboyVad vad;
+
+public:
+    explicit SnowboyVadEngine(const std::string &resource) : vad(resource) {}
+
+    const char *name() const override { return "snowboy"; }
+
+    bool isSpeech(const short *samples, size_t n) override
+    {
+        // RunVad returns -2 for silence; errors (-1) are treated as speech
+        // so a faulty frame never ends a session early.
+        return vad.RunVad(samples, static_cast<int>(n), false) != -2;
+    }
+
+    void reset() override { vad.Reset(); }
+};
+
+class EnergyVadEngine : public VadEngine
+{
+private:
+    static constexpr int FRAME = 160; // 10 ms analysis frames
+
+    double noise_floor = 1e4;         // mean square energy of background noise
+    const double MIN_ENERGY = 2500.0; // ~RMS 50, same floor as hasSubstantialSpeech
+    const double SPEECH_RATIO = 8.0;  // ~9 dB above the noise floor
+    const double WEAK_RATIO = 2.5;    // ~4 dB, accepted only for fricative-like frames
+    const double MIN_ZCR = 0.10;
+    const double MAX_ZCR = 0.50;
+
+    static void frameStats(const short *s, int n, double &energy, int &crossings)
+    {
+        uint64_t sum_squares = 0;
+        int zc = 0;
+        int i = 0;
+#ifdef WAKE2TEXT_VAD_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128();
+        __m128i zc_acc = _mm_setzero_si128();
+        for (; i + 9 <= n; i += 8)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i + 1));
+            // Pairwise products fit in uint32 (max 2 * 32768^2 = 2^31)
+            __m128i sq = _mm_madd_epi16(a, a);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+            // Sign change between neighbours -> top bit of a ^ b set -> lane = -1
+            zc_acc = _mm_sub_epi16(zc_acc, _mm_srai_epi16(_mm_xor_si128(a, b), 15));
+        }
+        uint64_t acc_lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc_lanes), acc);
+        sum_squares = acc_lanes[0] + acc_lanes[1];
+        short zc_lanes[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(zc_lanes), zc_acc);
+        for (short lane : zc_lanes)
+        {
+            zc += lane;
+        }
+#endif
+        for (; i < n; i++)
+        {
+            sum_squares += static_cast<uint64_t>(static_cast<int>(s[i]) * s[i]);
+            if (i + 1 < n && ((s[i] ^ s[i + 1]) < 0))
+            {
+                zc++;
+            }
+        }
+        energy = static_cast<double>(sum_squares) / n;
+        crossings = zc;
+    }
+
+public:
+    const char *name() const override { return "energy"; }
+
+    bool isSpeech(const short *samples, size_t n) override
+    {
+        bool speech = false;
+        for (size_t off = 0; off < n; off += FRAME)
+        {
+            int len = static_cast<int>(std::min<size_t>(FRAME, n - off));
+            if (len < 2)
+                break;
+
+            double energy;
+            int crossings;
+            frameStats(samples + off, len, energy, crossings);
+            double zcr = static_cast<double>(crossings) / (len - 1);
+
+            bool loud = energy > MIN_ENERGY && energy > noise_floor * SPEECH_RATIO;
+            bool fricative = energy > MIN_ENERGY && energy > noise_floor * WEAK_RATIO &&
+                             zcr > MIN_ZCR && zcr < MAX_ZCR;
+            if (loud || fricative)
+            {
+                speech = true;
+                // Let the floor creep up slowly so stationary noise is absorbed
+                noise_floor = noise_floor * 0.9995 + energy * 0.0005;
+            }
+            else
+            {
+                // Track quiet frames quickly, louder background slowly
+                double rate = energy < noise_floor ? 0.1 : 0.01;
+                noise_floor = noise_floor * (1.0 - rate) + energy * rate;
+            }
+            noise_floor = std::max(noise_floor, 1.0);
+        }
+        return speech;
+    }
+
+    void reset() override { noise_floor = 1e4; }
+};
+
+class WhisperVadEngine : public VadEngine
+{
+private:
+    static constexpr int WINDOW = 512;        // Silero window at 16 kHz
+    static constexpr int WARMUP = WINDOW * 2; // history re-fed before the new windows
+
+    // whisper_vad_detect_speech() clears the LSTM state on every call and
+    // the API has no way to carry it over. A short warm-up of the last two
+    // windows keeps the decision close to a continuously run model at
+    // about 3x the compute of the new audio alone.
+    struct whisper_vad_context *vctx = nullptr;
+    float threshold;
+    std::vector<float> history; // warm-up followed by the windows being judged
+    std::vector<float> pending;
+    bool last_decision = false;
+
+public:
+    WhisperVadEngine(const std::string &model_path, float speech_threshold = 0.5f, int n_threads = 1)
+        : threshold(speech_threshold)
+    {
+        if (model_path.empty())
+        {
+            throw std::runtime_error("Whisper VAD requires a model: --vad-model=<ggml-silero-*.bin>");
+        }
+        struct whisper_vad_context_params vparams = whisper_vad_default_context_params();
+        vparams.n_threads = n_threads;
+        vparams.use_gpu = false;
+        vctx = whisper_vad_init_from_file_with_params(model_path.c_str(), vparams);
+        if (!vctx)
+        {
+            throw std::runtime_error("Failed to initialize Whisper VAD model: " + model_path);
+        }
+        history.reserve(WARMUP + 4 * WINDOW);
+        pending.reserve(4 * WINDOW);
+    }
+
+    ~WhisperVadEngine() override
+    {
+        if (vctx)
+        {
+            whisper_vad_free(vctx);
+        }
+    }
+
+    WhisperVadEngine(const WhisperVadEngine &) = delete;
+    WhisperVadEngine &operator=(const WhisperVadEngine &) = delete;
+
+    const char *name() const override { return "whisper"; }
+
+    bool isSpeech(const short *samples, size_t n) override
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            pending.push_back(static_cast<float>(samples[i]) / 32768.0f);
+        }
+
+        // Blocks shorter than one window keep the previous decision
+        size_t n_new = (pending.size() / WINDOW) * WINDOW;
+        if (n_new == 0)
+        {
+            return last_decision;
+        }
+
+        size_t n_ctx = history.size();
+        history.insert(history.end(), pending.begin(), pending.begin() + n_new);
+        pending.erase(pending.begin(), pending.begin() + n_new);
+
+        if (whisper_vad_detect_speech(vctx, history.data(), static_cast<int>(history.size())))
+        {
+            const int n_probs = whisper_vad_n_probs(vctx);
+            const float *probs = whisper_vad_probs(vctx);
+            const int first_new = static_cast<int>(n_ctx / WINDOW);
+            float max_prob = 0.0f;
+            for (int i = first_new; i < n_probs; i++)
+            {
+                max_prob = std::max(max_prob, probs[i]);
+            }
+            last_decision = max_prob >= threshold;
+        }
+        else
+        {
+            last_decision = true;
+        }
+
+        if (history.size() > WARMUP)
+        {
+            history.erase(history.begin(), history.end() - WARMUP);
+        }
+        return last_decision;
+    }
+
+    void reset() override
+    {
+        history.clear();
+        pending.clear();
+        last_decision = false;
+    }
+};
+
+inline std::unique_ptr<VadEngine> make_vad_engine(const std::string &kind, const std::string &resource,
+                                                  const std::string &whisper_vad_model)
+{
+    if (kind == "snowboy")
+        return std::make_unique<SnowboyVadEngine>(resource);
+    if (kind == "energy")
+        return std::make_unique<EnergyVadEngine>();
+    if (kind == "whisper")
+        return std::make_unique<WhisperVadEngine>(whisper_vad_model);
+    throw std::runtime_error("Unknown VAD engine: " + kind + " (expected snowboy, energy or whisper)");
+}
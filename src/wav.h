@@ -0,0 +1,122 @@
+#pragma once
+
+/**
+ * Minimal RIFF/WAVE reader for 16 kHz mono 16-bit PCM files.
+ *
+ * Used for replaying recorded audio through the same processing path as
+ * live capture (benchmarks, file input) and for files uploaded to the
+ * local API server.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct WavData
+{
+    int sample_rate = 0;
+    int channels = 0;
+    std::vector<short> samples;
+};
+
+// `path` only labels error messages
+inline WavData read_wav(std::istream &in, const std::string &path)
+{
+    auto read_u32 = [&in]()
+    {
+        unsigned char b[4] = {0, 0, 0, 0};
+        in.read(reinterpret_cast<char *>(b), 4);
+        return static_cast<uint32_t>(b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24));
+    };
+    auto read_u16 = [&in]()
+    {
+        unsigned char b[2] = {0, 0};
+        in.read(reinterpret_cast<char *>(b), 2);
+        return static_cast<uint16_t>(b[0] | (b[1] << 8));
+    };
+
+    char tag[4];
+    in.read(tag, 4);
+    read_u32();
+    char wave[4];
+    in.read(wave, 4);
+    if (!in || std::memcmp(tag, "RIFF", 4) != 0 || std::memcmp(wave, "WAVE", 4) != 0)
+    {
+        throw std::runtime_error("Not a RIFF/WAVE file: " + path);
+    }
+
+    WavData wav;
+    int bits_per_sample = 0;
+    int format = 0;
+    while (in.read(tag, 4))
+    {
+        uint32_t size = read_u32();
+        if (std::memcmp(tag, "fmt ", 4) == 0)
+        {
+            format = read_u16();
+            wav.channels = read_u16();
+            wav.sample_rate = static_cast<int>(read_u32());
+            read_u32(); // byte rate
+            read_u16(); // block align
+            bits_per_sample = read_u16();
+            if (size > 16)
+            {
+                in.seekg(size - 16, std::ios::cur);
+            }
+        }
+        else if (std::memcmp(tag, "data", 4) == 0)
+        {
+            if (format != 1 || bits_per_sample != 16 || wav.channels < 1)
+            {
+                throw std::runtime_error("Unsupported WAV format (need 16-bit PCM): " + path);
+            }
+            std::vector<short> interleaved(size / 2);
+            in.read(reinterpret_cast<char *>(interleaved.data()), static_cast<std::streamsize>(interleaved.size() * 2));
+            interleaved.resize(static_cast<size_t>(in.gcount()) / 2);
+
+            // Keep the first channel only
+            wav.samples.reserve(interleaved.size() / wav.channels);
+            for (size_t i = 0; i + wav.channels <= interleaved.size(); i += wav.channels)
+            {
+                wav.samples.push_back(interleaved[i]);
+            }
+            break;
+        }
+        else
+        {
+            in.seekg(size + (size & 1), std::ios::cur);
+        }
+    }
+
+    if (wav.sample_rate != 16000)
+    {
+        throw std::runtime_error("WAV file must be 16 kHz: " + path + " (" + std::to_string(wav.sample_rate) + " Hz)");
+    }
+    return wav;
+}
+
+inline WavData read_wav_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("Cannot open WAV file: " + path);
+    }
+    return read_wav(in, path);
+}
+
+inline bool is_wav_data(const std::string &bytes)
+{
+    return bytes.size() >= 12 && bytes.compare(0, 4, "RIFF") == 0 && bytes.compare(8, 4, "WAVE") == 0;
+}
+
+inline WavData parse_wav_bytes(const std::string &bytes)
+{
+    std::istringstream in(bytes);
+    return read_wav(in, "<upload>");
+}
@@ -0,0 +1,356 @@
+#pragma once
+
+/**
+ * Shared Whisper model with a pool of inference states.
+ *
+ * The model weights are loaded once per process. Each decode leases one of
+ * a fixed number of whisper_state objects (KV cache + compute buffers), so
+ * any number of audio streams can share the model while the number of
+ * concurrent decodes, and their memory, stays bounded.
+ *
+ * When every state is busy, waiters are served by priority class: finals,
+ * then interim chunks, then background re-decodes, first come first served
+ * within a class. A waiter is promoted one class for every AGING_MS it has
+ * waited, so lower classes are delayed under load but never starved.
+ * Background decodes can poll preemptRequested() and abort early when
+ * higher-priority work is queued.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#endif
+#include "whisper.h"
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+enum class DecodePriority
+{
+    Final = 0,
+    Interim = 1,
+    Background = 2
+};
+
+inline const char *priority_name(DecodePriority priority)
+{
+    switch (priority)
+    {
+    case DecodePriority::Final:
+        return "final";
+    case DecodePriority::Interim:
+        return "interim";
+    default:
+        return "background";
+    }
+}
+
+// Per-class queue wait and decode time; keeps the latest waits for percentiles
+class PriorityMetrics
+{
+public:
+    static constexpr size_t CLASSES = 3;
+    static constexpr size_t WINDOW = 1024;
+
+    struct Class
+    {
+        long long count = 0;
+        long long promoted = 0;  // served after aging into a higher class
+        long long preempted = 0; // background decodes aborted for higher-priority work
+        double wait_total_ms = 0.0;
+        double wait_max_ms = 0.0;
+        double decode_total_ms = 0.0;
+        std::vector<double> recent_waits;
+    };
+
+private:
+    std::mutex mutex;
+    std::array<Class, CLASSES> classes;
+    std::array<size_t, CLASSES> next = {0, 0, 0};
+
+public:
+    void record(DecodePriority priority, double wait_ms, double decode_ms)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t i = static_cast<size_t>(priority);
+        Class &c = classes[i];
+        c.count++;
+        c.wait_total_ms += wait_ms;
+        c.wait_max_ms = std::max(c.wait_max_ms, wait_ms);
+        c.decode_total_ms += decode_ms;
+        if (c.recent_waits.size() < WINDOW)
+            c.recent_waits.push_back(wait_ms);
+        else
+            c.recent_waits[next[i]] = wait_ms;
+        next[i] = (next[i] + 1) % WINDOW;
+    }
+
+    void notePromoted(DecodePriority priority)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        classes[static_cast<size_t>(priority)].promoted++;
+    }
+
+    void notePreempted(DecodePriority priority)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        classes[static_cast<size_t>(priority)].preempted++;
+    }
+
+    Class snapshot(DecodePriority priority)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return classes[static_cast<size_t>(priority)];
+    }
+};
+
+class WhisperEngine
+{
+public:
+    static constexpr int AGING_MS = 1000;
+
+private:
+    struct Waiter
+    {
+        DecodePriority priority;
+        std::chrono::steady_clock::time_point since;
+        long long sequence;
+        struct whisper_state *granted = nullptr;
+    };
+
+    struct whisper_context *ctx = nullptr;
+    std::string model_path;
+    bool gpu = false;
+    int threads_per_decode = 1;
+    double load_ms = 0.0;
+
+    std::vector<struct whisper_state *> states;
+    std::vector<struct whisper_state *> free_states;
+    std::vector<Waiter *> waiters;
+    std::array<std::atomic<int>, PriorityMetrics::CLASSES> waiting{}; // per class, readable without the lock
+    long long next_sequence = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+    PriorityMetrics priority_metrics;
+
+    // Class after aging; lower is served first
+    static int effectiveClass(const Waiter &w, std::chrono::steady_clock::time_point now)
+    {
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - w.since).count();
+        return static_cast<int>(w.priority) - static_cast<int>(waited / AGING_MS);
+    }
+
+    void release(struct whisper_state *state)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (waiters.empty())
+            {
+                free_states.push_back(state);
+                return;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            auto best = waiters.begin();
+            for (auto it = waiters.begin() + 1; it != waiters.end(); ++it)
+            {
+                int a = effectiveClass(**it, now);
+                int b = effectiveClass(**best, now);
+                if (a < b || (a == b && (*it)->sequence < (*best)->sequence))
+                    best = it;
+            }
+            Waiter *chosen = *best;
+            // Promoted: served ahead of a waiter from a higher native class
+            for (Waiter *w : waiters)
+            {
+                if (w != chosen && w->priority < chosen->priority)
+                {
+                    priority_metrics.notePromoted(chosen->priority);
+                    break;
+                }
+            }
+            chosen->granted = state;
+            waiting[static_cast<size_t>(chosen->priority)]--;
+            waiters.erase(best);
+        }
+        cv.notify_all();
+    }
+
+public:
+    // RAII handle for a leased state; returns it to the pool on destruction
+    class Lease
+    {
+    private:
+        WhisperEngine *engine = nullptr;
+        struct whisper_state *state = nullptr;
+
+    public:
+        Lease() = default;
+        Lease(WhisperEngine *e, struct whisper_state *s) : engine(e), state(s) {}
+        Lease(Lease &&other) noexcept : engine(other.engine), state(other.state)
+        {
+            other.state = nullptr;
+        }
+        Lease &operator=(Lease &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                engine = other.engine;
+                state = other.state;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease() { reset(); }
+
+        void reset()
+        {
+            if (state)
+            {
+                engine->release(state);
+                state = nullptr;
+            }
+        }
+
+        struct whisper_state *get() const { return state; }
+        explicit operator bool() const { return state != nullptr; }
+    };
+
+private:
+    Lease waitForState(DecodePriority priority, const std::chrono::steady_clock::time_point *deadline,
+                       std::chrono::steady_clock::time_point since)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (waiters.empty() && !free_states.empty())
+        {
+            struct whisper_state *state = free_states.back();
+            free_states.pop_back();
+            return Lease(this, state);
+        }
+
+        Waiter self{priority, since, next_sequence++};
+        waiters.push_back(&self);
+        waiting[static_cast<size_t>(priority)]++;
+        auto granted = [&self]
+        { return self.granted != nullptr; };
+        if (deadline)
+        {
+            if (!cv.wait_until(lock, *deadline, granted))
+            {
+                waiters.erase(std::find(waiters.begin(), waiters.end(), &self));
+                waiting[static_cast<size_t>(priority)]--;
+                return Lease();
+            }
+        }
+        else
+        {
+            cv.wait(lock, granted);
+        }
+        return Lease(this, self.granted);
+    }
+
+public:
+    WhisperEngine(const std::string &path, bool use_gpu, int n_states, int n_threads)
+        : model_path(path), gpu(use_gpu)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        struct whisper_context_params cparams = whisper_context_default_params();
+        cparams.use_gpu = use_gpu;
+        ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+        if (!ctx)
+        {
+            throw std::runtime_error("Failed to initialize Whisper model: " + model_path);
+        }
+
+        for (int i = 0; i < std::max(1, n_states); i++)
+        {
+            struct whisper_state *state = whisper_init_state(ctx);
+            if (!state)
+            {
+                for (auto *s : states)
+                    whisper_free_state(s);
+                whisper_free(ctx);
+                throw std::runtime_error("Failed to allocate Whisper state " + std::to_string(i + 1));
+            }
+            states.push_back(state);
+        }
+        free_states = states;
+
+        unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+        threads_per_decode = n_threads > 0 ? n_threads : static_cast<int>(std::max(1u, hw / 2));
+
+        load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    ~WhisperEngine()
+    {
+        for (auto *state : states)
+            whisper_free_state(state);
+        if (ctx)
+            whisper_free(ctx);
+    }
+
+    WhisperEngine(const WhisperEngine &) = delete;
+    WhisperEngine &operator=(const WhisperEngine &) = delete;
+
+    // Blocks until a state is granted to this caller
+    Lease acquire(DecodePriority priority = DecodePriority::Final)
+    {
+        return waitForState(priority, nullptr, std::chrono::steady_clock::now());
+    }
+
+    // Gives up after `timeout`, returning an empty lease. A caller retrying
+    // after a timeout passes the time it first asked, so it keeps its aging.
+    Lease acquireFor(DecodePriority priority, std::chrono::milliseconds timeout,
+                     std::chrono::steady_clock::time_point queued_since = std::chrono::steady_clock::now())
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return waitForState(priority, &deadline, queued_since);
+    }
+
+    // Returns an empty lease when no state is free or others are waiting
+    Lease tryAcquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_states.empty() || !waiters.empty())
+            return Lease();
+        struct whisper_state *state = free_states.back();
+        free_states.pop_back();
+        return Lease(this, state);
+    }
+
+    // True while work of a higher class than `priority` is waiting for a
+    // state. Lock-free, so it can be polled from Whisper's abort callback.
+    bool preemptRequested(DecodePriority priority) const
+    {
+        for (size_t c = 0; c < static_cast<size_t>(priority); c++)
+        {
+            if (waiting[c].load(std::memory_order_relaxed) > 0)
+                return true;
+        }
+        return false;
+    }
+
+    PriorityMetrics &metrics() { return priority_metrics; }
+
+    struct whisper_context *context() const { return ctx; }
+    const std::string &modelPath() const { return model_path; }
+    bool usesGpu() const { return gpu; }
+    int threadsPerDecode() const { return threads_per_decode; }
+    int stateCount() const { return static_cast<int>(states.size()); }
+    double loadMs() const { return load_ms; }
+};